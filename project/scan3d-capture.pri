@@ -17,6 +17,7 @@ HEADERS += \
         $$SOURCEDIR/TreeModel.hpp \
         $$SOURCEDIR/CalibrationData.hpp \
         $$SOURCEDIR/structured_light.hpp \
+        $$SOURCEDIR/frame_stack.hpp \
         $$SOURCEDIR/scan3d.hpp \
         $$SOURCEDIR/GLWidget.hpp \
         $$(NULL)
@@ -37,6 +38,7 @@ SOURCES += \
         $$SOURCEDIR/TreeModel.cpp \
         $$SOURCEDIR/CalibrationData.cpp \
         $$SOURCEDIR/structured_light.cpp \
+        $$SOURCEDIR/frame_stack.cpp \
         $$SOURCEDIR/scan3d.cpp \
         $$SOURCEDIR/GLWidget.cpp \
         $$(NULL)
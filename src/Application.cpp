@@ -31,19 +31,28 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QProgressDialog>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QImageReader>
 
 #include <cmath>
 #include <iostream>
 #include <ctime>
 #include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
 
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/calib3d.hpp>
 
 #include "structured_light.hpp"
+#include "frame_stack.hpp"
 
 #include "cognex_util.hpp"
+#include "io_util.hpp"
 
 
 Application::Application(int & argc, char ** argv) : 
@@ -121,6 +130,50 @@ void Application::load_config(void)
     {
         config.setValue(ROBUST_M_CONFIG, ROBUST_M_DEFAULT);
     }
+    if (!config.value(DECODE_THREADS_CONFIG).isValid())
+    {
+        config.setValue(DECODE_THREADS_CONFIG, DECODE_THREADS_DEFAULT);
+    }
+    if (!config.value(DECODE_PREFETCH_CONFIG).isValid())
+    {
+        config.setValue(DECODE_PREFETCH_CONFIG, DECODE_PREFETCH_DEFAULT);
+    }
+    if (!config.value(DECODE_ON_CAPTURE_CONFIG).isValid())
+    {
+        config.setValue(DECODE_ON_CAPTURE_CONFIG, DECODE_ON_CAPTURE_DEFAULT);
+    }
+    if (!config.value(DECODE_COMPACT_CONFIG).isValid())
+    {
+        config.setValue(DECODE_COMPACT_CONFIG, DECODE_COMPACT_DEFAULT);
+    }
+    if (!config.value(DECODE_PACKED_CONFIG).isValid())
+    {
+        config.setValue(DECODE_PACKED_CONFIG, DECODE_PACKED_DEFAULT);
+    }
+    if (!config.value(DECODE_STATS_CONFIG).isValid())
+    {
+        config.setValue(DECODE_STATS_CONFIG, DECODE_STATS_DEFAULT);
+    }
+    if (!config.value(DECODE_MIN_RESOLVED_CONFIG).isValid())
+    {
+        config.setValue(DECODE_MIN_RESOLVED_CONFIG, DECODE_MIN_RESOLVED_DEFAULT);
+    }
+    if (!config.value(DECODE_ROI_CONFIG).isValid())
+    {
+        config.setValue(DECODE_ROI_CONFIG, DECODE_ROI_DEFAULT);
+    }
+    if (!config.value(DECODE_CACHE_CONFIG).isValid())
+    {
+        config.setValue(DECODE_CACHE_CONFIG, DECODE_CACHE_DEFAULT);
+    }
+    if (!config.value(DECODE_PARALLEL_SETS_CONFIG).isValid())
+    {
+        config.setValue(DECODE_PARALLEL_SETS_CONFIG, DECODE_PARALLEL_SETS_DEFAULT);
+    }
+    if (!config.value(DECODE_MEMORY_BUDGET_CONFIG).isValid())
+    {
+        config.setValue(DECODE_MEMORY_BUDGET_CONFIG, DECODE_MEMORY_BUDGET_DEFAULT);
+    }
 
     //checkerboard size
     if (!config.value("main/corner_count_x").isValid())
@@ -166,6 +219,7 @@ void Application::set_root_dir(const QString & dirname)
     //reset internal data
     model.clear();
     clear();
+    FrameStack::release_shared();
 
     QStringList dirlist = root_dir.entryList(QDir::Dirs|QDir::NoDotAndDotDot, QDir::Name);
     foreach (const QString & item, dirlist)
@@ -175,11 +229,18 @@ void Application::set_root_dir(const QString & dirname)
         QStringList filters;
         filters << "*.jpg" << "*.bmp" << "*.png";
 
-        QStringList filelist = dir.entryList(filters, QDir::Files, QDir::Name);
+        //a frame stack has every image of the set, the image files are not used
+        std::shared_ptr<FrameStack> stack;
+        if (dir.exists(FRAME_STACK_FILENAME))
+        {
+            stack = FrameStack::shared(dir.filePath(FRAME_STACK_FILENAME).toStdString());
+        }
+
+        QStringList filelist = (stack ? QStringList() : dir.entryList(filters, QDir::Files, QDir::Name));
         QString path = dir.path();
 
         //setup the model
-        int filecount = filelist.count();
+        int filecount = (stack ? static_cast<int>(stack->frame_count()) : filelist.count());
 
         if (filecount<1)
         {   //no images, skip
@@ -200,16 +261,37 @@ void Application::set_root_dir(const QString & dirname)
         model.setData(parent, Qt::Checked, Qt::CheckStateRole);
 
         //read projector info
-        int projector_width = 1024, projector_height = 768; //defaults compatible with old software 
+        int pattern_width = 1024, pattern_height = 768; //defaults compatible with old software 
+        int projector_width = 0, projector_height = 0; //the pattern size unless the finest bits were not projected
+        int images_per_bit = 2; //normal and inverted pattern
+        bool columns_only = false; //vertical and horizontal patterns
+        int phase_steps = 0; //Gray code only
         QString projector_filename = dirname + "/" + item + "/projector_info.txt";
         FILE * fp = fopen(qPrintable(projector_filename), "r");
         if (fp)
         {   //projector info file exists
-            int width, height;
+            int width, height, per_bit, directions, steps;
             if (fscanf(fp, "%u %u", &width, &height)==2 && width>0 && height)
             {   //ok
-                projector_width = width;
-                projector_height = height;
+                pattern_width = width;
+                pattern_height = height;
+                if (fscanf(fp, "%u", &per_bit)==1 && (per_bit==1 || per_bit==2))
+                {   //optional: missing in old files
+                    images_per_bit = per_bit;
+                    if (fscanf(fp, "%u", &directions)==1 && (directions==1 || directions==2))
+                    {
+                        columns_only = (directions==1);
+                        if (fscanf(fp, "%u", &steps)==1 && steps<256)
+                        {
+                            phase_steps = steps;
+                            if (fscanf(fp, "%u %u", &width, &height)==2 && width>=pattern_width && height>=pattern_height)
+                            {   //optional: projector resolution of a set with fewer bits
+                                projector_width = width;
+                                projector_height = height;
+                            }
+                        }
+                    }
+                }
                 std::cerr << "Projector info file loaded: " << projector_filename.toStdString() << std::endl;
             }
             else
@@ -222,13 +304,36 @@ void Application::set_root_dir(const QString & dirname)
         {
             std::cerr << "Projector info file failed to open: " << projector_filename.toStdString() << std::endl;
         }
-        std::cerr << "Projector info file: using width=" << projector_width << " height=" << projector_height << std::endl;
+        if (stack)
+        {   //the frame stack header has the same values
+            const FrameStack::Layout & layout = stack->layout();
+            pattern_width = layout.projector_size.width;
+            pattern_height = layout.projector_size.height;
+            images_per_bit = layout.images_per_bit;
+            columns_only = layout.columns_only;
+            phase_steps = layout.phase_steps;
+            std::cerr << "Frame stack loaded: " << dir.filePath(FRAME_STACK_FILENAME).toStdString() << std::endl;
+        }
+        if (projector_width<pattern_width || projector_height<pattern_height)
+        {   //full resolution set
+            projector_width = pattern_width;
+            projector_height = pattern_height;
+        }
+        std::cerr << "Projector info file: using width=" << projector_width << " height=" << projector_height 
+                  << " pattern=" << pattern_width << "x" << pattern_height
+                  << " images_per_bit=" << images_per_bit << " columns_only=" << columns_only 
+                  << " phase_steps=" << phase_steps << std::endl;
         model.setData(parent, projector_width,  ProjectorWidthRole);
         model.setData(parent, projector_height,  ProjectorHeightRole);
+        model.setData(parent, pattern_width,  PatternWidthRole);
+        model.setData(parent, pattern_height,  PatternHeightRole);
+        model.setData(parent, images_per_bit,  ImagesPerBitRole);
+        model.setData(parent, columns_only,  ColumnsOnlyRole);
+        model.setData(parent, phase_steps,  PhaseStepsRole);
 
         for (int i=0; i<filecount; i++)
         {
-            const QString & filename = filelist.at(i);
+            QString filename = (stack ? QString("%1 frame %2").arg(FRAME_STACK_FILENAME).arg(i) : filelist.at(i));
             if (!model.insertRow(i, parent))
             {
                 std::cout << "Failed model insert " << filename.toStdString() << "("<< row << ")" << std::endl;
@@ -241,7 +346,8 @@ void Application::set_root_dir(const QString & dirname)
             model.setData(index, label, Qt::ToolTipRole);
 
             //additional data
-            model.setData(index, path + "/" + filename, ImageFilenameRole);
+            model.setData(index, (stack ? QString::fromStdString(FrameStack::frame_name(dir.filePath(FRAME_STACK_FILENAME).toStdString(), i)) 
+                                        : path + "/" + filename), ImageFilenameRole);
         }
     }
 
@@ -295,23 +401,38 @@ const cv::Mat Application::get_image(unsigned level, unsigned n, Role role) cons
     QString filename = model.data(index, ImageFilenameRole).toString();
     std::cout << "[" << (role==GrayImageRole ? "gray" : "color") << "] Filename: " << filename.toStdString() << std::endl;
 
-    //load image
-    cv::Mat rgb_image = cv::imread(filename.toStdString());
-    if (rgb_image.rows>0 && rgb_image.cols>0)
-    {
-        //color
-        if (role==ColorImageRole)
+    std::string stack_filename;
+    unsigned frame = 0;
+    if (FrameStack::split_frame_name(filename.toStdString(), stack_filename, frame))
+    {   //frame stack: a copy of the mapped frame, the texture is the color version of the first frame;
+        //16 bit frames are scaled to 8 bit like imread() does with image files
+        std::shared_ptr<FrameStack> stack = FrameStack::shared(stack_filename);
+        cv::Mat image = (stack ? stack->frame(frame) : cv::Mat());
+        if (image.depth()==CV_16U)
         {
-            return rgb_image;
+            cv::Mat image8;
+            image.convertTo(image8, CV_8U, 1.0/256.0);
+            image = image8;
         }
-        
-        //gray scale
-        if (role==GrayImageRole)
+        if (role==ColorImageRole && image.data)
         {
-            cv::Mat gray_image;
-            cvtColor(rgb_image, gray_image, cv::COLOR_BGR2GRAY);
-            return gray_image;
+            cv::Mat texture = (frame==0 ? stack->texture() : cv::Mat());
+            if (texture.data)
+            {
+                return texture.clone();
+            }
+            cv::Mat color_image;
+            cv::cvtColor(image, color_image, cv::COLOR_GRAY2BGR);
+            return color_image;
         }
+        return image.clone();
+    }
+
+    //load image: gray scale images are read directly, color is only created when requested
+    cv::Mat image = cv::imread(filename.toStdString(), (role==GrayImageRole ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR));
+    if (image.rows>0 && image.cols>0)
+    {
+        return image;
     }
 
     return cv::Mat();
@@ -319,12 +440,27 @@ const cv::Mat Application::get_image(unsigned level, unsigned n, Role role) cons
 
 int Application::get_camera_width(unsigned level) const
 {
-  return get_image(level, 0, ColorImageRole).cols;
+  return get_image(level, 0, GrayImageRole).cols;
 }
 
 int Application::get_camera_height(unsigned level) const
 {
-  return get_image(level, 0, ColorImageRole).rows;
+  return get_image(level, 0, GrayImageRole).rows;
+}
+
+cv::Size Application::get_camera_size(unsigned level) const
+{   //image header only, the image is not loaded
+    QModelIndex parent = model.index(level, 0);
+    QString filename = model.data(model.index(0, 0, parent), ImageFilenameRole).toString();
+    std::string stack_filename;
+    unsigned frame = 0;
+    if (FrameStack::split_frame_name(filename.toStdString(), stack_filename, frame))
+    {   //frame stack header
+        std::shared_ptr<FrameStack> stack = FrameStack::shared(stack_filename);
+        return (stack ? stack->size() : cv::Size());
+    }
+    QSize size = QImageReader(filename).size();
+    return (size.isValid() ? cv::Size(size.width(), size.height()) : cv::Size());
 }
 
 int Application::get_projector_width(unsigned level) const
@@ -347,6 +483,46 @@ int Application::get_projector_height(unsigned level) const
     return 0;
 }
 
+cv::Size Application::get_pattern_size(unsigned level) const
+{
+    if (static_cast<int>(level)<model.rowCount())
+    {   //ok
+        QModelIndex parent = model.index(level, 0);
+        return cv::Size(model.data(parent, PatternWidthRole).toInt(), model.data(parent, PatternHeightRole).toInt());
+    }
+    return cv::Size();
+}
+
+int Application::get_images_per_bit(unsigned level) const
+{
+    if (static_cast<int>(level)<model.rowCount())
+    {   //ok
+        QModelIndex parent = model.index(level, 0);
+        return model.data(parent, ImagesPerBitRole).toInt();
+    }
+    return 2;
+}
+
+bool Application::get_columns_only(unsigned level) const
+{
+    if (static_cast<int>(level)<model.rowCount())
+    {   //ok
+        QModelIndex parent = model.index(level, 0);
+        return model.data(parent, ColumnsOnlyRole).toBool();
+    }
+    return false;
+}
+
+int Application::get_phase_steps(unsigned level) const
+{
+    if (static_cast<int>(level)<model.rowCount())
+    {   //ok
+        QModelIndex parent = model.index(level, 0);
+        return model.data(parent, PhaseStepsRole).toInt();
+    }
+    return 0;
+}
+
 bool Application::extract_chessboard_corners(void)
 {
     corner_count = cv::Size(config.value("main/corner_count_x").toUInt(), config.value("main/corner_count_y").toUInt()); //interior number of corners
@@ -484,7 +660,8 @@ void Application::decode_all(void)
 
     QString path = config.value("main/root_dir").toString();
  
-    //decode gray patterns
+    //selected sets
+    std::vector<unsigned> levels;
     for (unsigned i=0; i<count; i++)
     {
         QModelIndex index = model.index(i, 0);
@@ -493,41 +670,41 @@ void Application::decode_all(void)
         if (!checked)
         {   //skip
             processing_message(QString(" * %1: skipped [not selected]").arg(set_name));
-            processing_set_progress_value(i+1);
             continue;
         }
+        levels.push_back(i);
+    }
 
-        processing_set_current_message(QString("Decoding... %1").arg(set_name));
-
-        cv::Mat & pattern_image = pattern_list[i];
-        cv::Mat & min_max_image = min_max_list[i];
-        if (!decode_gray_set(i, pattern_image, min_max_image))
-        {   //error
-            std::cout << "ERROR: Decode image set " << i << " failed. " << std::endl;
-            return;
-        }
+    //decode gray patterns
+    if (!decode_sets(levels))
+    {   //error or canceled
+        return;
+    }
 
-        if (processing_canceled())
-        {
-            processing_set_current_message("Decode canceled");
-            processing_message("Decode canceled");
-            return;
-        }
+    //check decoded sets
+    for (size_t k=0; k<levels.size(); k++)
+    {
+        unsigned i = levels[k];
+        QModelIndex index = model.index(i, 0);
+        QString set_name = model.data(index, Qt::DisplayRole).toString();
+        //codes may cover only a region of the image
+        cv::Size set_size = get_camera_size(i);
 
         if (imageSize.width==0)
         {
-            imageSize = pattern_image.size();
+            imageSize = set_size;
         }
-        else if (imageSize != pattern_image.size())
+        else if (imageSize != set_size)
         {
             processing_message(QString("ERROR: pattern image of different size: set %1").arg(set_name));
             std::cout << "ERROR: pattern image of different size: set " << i << std::endl;
             return;
         }
-        else if (get_projector_width(0)!=get_projector_width(i) || get_projector_height(0)!=get_projector_height(i))
-        {
+        else if (get_projector_width(levels.front())!=get_projector_width(i) || get_projector_height(levels.front())!=get_projector_height(i))
+        {   //sets with fewer bits are decoded to the projector resolution: only that must match
             QString error_message = QString("ERROR: projector resolution does not match: set %1 [expected %2x%3, got %4x%5").arg(set_name)
-                        .arg(get_projector_width(0)).arg(get_projector_height(0)).arg(get_projector_width(i)).arg(get_projector_height(i));
+                        .arg(get_projector_width(levels.front())).arg(get_projector_height(levels.front()))
+                        .arg(get_projector_width(i)).arg(get_projector_height(i));
             processing_message(error_message);
             std::cout << error_message.toStdString() << std::endl;
             return;
@@ -536,13 +713,158 @@ void Application::decode_all(void)
         //save pattern image as PGM for debugging
         //QString filename = path + "/" + set_name;
         //io_util::write_pgm(pattern_image, qPrintable(filename));
-
-        processing_message(QString(" * %1: decoded").arg(set_name));
-        processing_set_progress_value(i+1);
     }
 
     processing_set_current_message("Decode finished");
-    processing_set_progress_value(count);
+}
+
+bool Application::decode_sets(std::vector<unsigned> const& levels)
+{
+    //collect everything on this thread: the workers do not touch the model or the config
+    std::vector<DecodeJob> jobs(levels.size());
+    for (size_t k=0; k<levels.size(); k++)
+    {
+        if (!prepare_decode_job(levels[k], jobs[k]))
+        {   //too few images
+            QString set_name = model.data(model.index(levels[k], 0), Qt::DisplayRole).toString();
+            processing_set_current_message("ERROR: too few pattern images");
+            processing_message(QString("ERROR: too few pattern images: set %1").arg(set_name));
+            return false;
+        }
+    }
+
+    if (pattern_list.size()<model.rowCount<size_t>())
+    {
+        pattern_list.resize(model.rowCount());
+    }
+    if (min_max_list.size()<model.rowCount<size_t>())
+    {
+        min_max_list.resize(model.rowCount());
+    }
+
+    const size_t budget = static_cast<size_t>(config.value(DECODE_MEMORY_BUDGET_CONFIG, DECODE_MEMORY_BUDGET_DEFAULT).toUInt())*1024*1024;
+    unsigned thread_count = config.value(DECODE_PARALLEL_SETS_CONFIG, DECODE_PARALLEL_SETS_DEFAULT).toUInt();
+    if (thread_count==0)
+    {
+        thread_count = std::max(1u, std::thread::hardware_concurrency()/2);
+    }
+    thread_count = std::min(thread_count, static_cast<unsigned>(jobs.size()));
+
+    processing_set_progress_total(static_cast<unsigned>(jobs.size()));
+    processing_set_progress_value(0);
+    processing_set_current_message(QString("Decoding %1 sets (%2 at a time)...").arg(jobs.size()).arg(thread_count));
+
+    //shared state, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t next = 0;
+    size_t running_memory = 0;
+    unsigned running = 0;
+    bool stop = false;
+    std::vector<int> status(jobs.size(), 0);   //0: pending, 1: decoded, 2: from cache, -1: failed
+
+    auto worker = [&]()
+    {
+        for (;;)
+        {
+            size_t k;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                //wait until the next set fits in the memory budget, one set is always allowed
+                cond.wait(lock, [&]{return stop || next>=jobs.size() || running==0 || running_memory + jobs[next].memory<=budget;});
+                if (stop || next>=jobs.size())
+                {
+                    return;
+                }
+                k = next++;
+                running++;
+                running_memory += jobs[k].memory;
+            }
+
+            DecodeJob const& job = jobs[k];
+            bool from_cache = false;
+            bool rv = run_decode_job(job, pattern_list[job.level], min_max_list[job.level], from_cache);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running--;
+                running_memory -= job.memory;
+                status[k] = (rv ? (from_cache ? 2 : 1) : -1);
+                if (!rv)
+                {   //stop on the first error
+                    stop = true;
+                }
+            }
+            cond.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i=0; i<thread_count; i++)
+    {
+        threads.push_back(std::thread(worker));
+    }
+
+    //report progress and forward cancellation from the GUI thread
+    std::vector<bool> reported(jobs.size(), false);
+    unsigned finished = 0;
+    bool canceled = false, failed = false, done = false;
+    while (!done)
+    {
+        std::vector<int> current;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait_for(lock, std::chrono::milliseconds(50));
+            current = status;
+            done = (stop || next>=jobs.size()) && running==0;
+        }
+
+        for (size_t k=0; k<jobs.size(); k++)
+        {
+            if (reported[k] || current[k]==0)
+            {
+                continue;
+            }
+            reported[k] = true;
+            finished++;
+
+            QString set_name = model.data(model.index(jobs[k].level, 0), Qt::DisplayRole).toString();
+            if (current[k]<0)
+            {
+                failed = true;
+                processing_message(QString(" * %1: decode failed").arg(set_name));
+                std::cout << "ERROR: Decode image set " << jobs[k].level << " failed. " << std::endl;
+            }
+            else
+            {
+                processing_message(QString(" * %1: decoded%2").arg(set_name).arg(current[k]==2 ? " [cache]" : ""));
+            }
+            processing_set_progress_value(finished);
+        }
+
+        if (!canceled && processing_canceled())
+        {   //let the running sets finish, do not start new ones
+            canceled = true;
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+            cond.notify_all();
+        }
+        processEvents();
+    }
+
+    for (size_t i=0; i<threads.size(); i++)
+    {
+        threads[i].join();
+    }
+
+    if (canceled)
+    {
+        processing_set_current_message("Decode canceled");
+        processing_message("Decode canceled");
+        return false;
+    }
+    return !failed;
 }
 
 void Application::decode(int level, QWidget * parent_widget)
@@ -560,15 +882,40 @@ void Application::decode(int level, QWidget * parent_widget)
         min_max_list.resize(model.rowCount());
     }
 
-    cv::Mat & pattern_image = pattern_list[level];
+    sl::CodeImage & code_image = pattern_list[level];
     cv::Mat & min_max_image = min_max_list[level];
 
-    if (!decode_gray_set(level, pattern_image, min_max_image, parent_widget))
+    if (!decode_gray_set(level, code_image, min_max_image, parent_widget))
     {   //error
         std::cout << "ERROR: Decode image set " << level << " failed. " << std::endl;
     }
 }
 
+void Application::set_decoded(const QString & set_name, sl::CodeImage const& code_image, cv::Mat const& min_max_image)
+{
+    for (int level=0; level<model.rowCount(); level++)
+    {
+        QModelIndex index = model.index(level, 0);
+        if (model.data(index, Qt::DisplayRole).toString()!=set_name)
+        {
+            continue;
+        }
+
+        //found: keep the set decoded while it was captured
+        if (pattern_list.size()<model.rowCount<size_t>())
+        {
+            pattern_list.resize(model.rowCount());
+        }
+        if (min_max_list.size()<model.rowCount<size_t>())
+        {
+            min_max_list.resize(model.rowCount());
+        }
+        pattern_list[level] = code_image;
+        min_max_list[level] = min_max_image;
+        return;
+    }
+}
+
 bool Application::dump_decoded(const char* filename, int type, cv::Mat2f const& pattern_image, cv::Mat2b const& min_max_image, cv::Mat3b const& color_image) const
 {
     if (!filename || !pattern_image.data || !min_max_image.data || !color_image.data)
@@ -758,6 +1105,22 @@ void Application::calibrate(void)
     pattern_list.resize(count);
     min_max_list.resize(count);
 
+    //decode the selected sets, several at a time
+    std::vector<unsigned> levels;
+    for (unsigned i=0; i<count; i++)
+    {
+        if (model.data(model.index(i, 0), Qt::CheckStateRole).toInt()==Qt::Checked && !get_columns_only(i))
+        {
+            levels.push_back(i);
+        }
+    }
+    processing_message("Decoding:");
+    if (!decode_sets(levels))
+    {   //error or canceled
+        return;
+    }
+    processing_message("");
+
     processing_set_progress_total(count);
     processing_set_progress_value(0);
     processing_set_current_message("Decoding and computing homographies...");
@@ -776,25 +1139,30 @@ void Application::calibrate(void)
             processing_set_progress_value(i+1);
             continue;
         }
+        if (get_columns_only(i))
+        {   //skip: projector corners need both column and row codes
+            processing_message(QString(" * %1: skip (columns only set)").arg(set_name));
+            processing_set_progress_value(i+1);
+            continue;
+        }
 
         //checked: use this set
         proj_corners.clear(); //erase previous points
 
-        processing_set_current_message(QString("Decoding... %1").arg(set_name));
-
-        cv::Mat & pattern_image = pattern_list[i];
+        sl::CodeImage & code_image = pattern_list[i];
         cv::Mat & min_max_image = min_max_list[i];
-        if (!decode_gray_set(i, pattern_image, min_max_image))
+        const bool wide = (min_max_image.depth()==CV_16U);
+        if (code_image.empty())
         {   //error
             std::cout << "ERROR: Decode image set " << i << " failed. " << std::endl;
             return;
         }
 
         if (imageSize.width==0)
-        {
-            imageSize = pattern_image.size();
+        {   //codes may cover only a region of the image
+            imageSize = get_camera_size(i);
         }
-        else if (imageSize != pattern_image.size())
+        else if (imageSize != get_camera_size(i))
         {
             std::cout << "ERROR: pattern image of different size: set " << i << std::endl;
             return;
@@ -817,36 +1185,43 @@ void Application::calibrate(void)
             }
             processEvents();
 
-            //find an homography around p
-            unsigned WINDOW_SIZE = config.value(HOMOGRAPHY_WINDOW_CONFIG, HOMOGRAPHY_WINDOW_DEFAULT).toUInt()/2;
+            //find an homography around p, in code image coordinates: 
+            //the window is clipped to the decoded region, which may end close to the board
+            int WINDOW_SIZE = config.value(HOMOGRAPHY_WINDOW_CONFIG, HOMOGRAPHY_WINDOW_DEFAULT).toInt()/2;
             std::vector<cv::Point2f> img_points, proj_points;
-            if (p.x>WINDOW_SIZE && p.y>WINDOW_SIZE && p.x+WINDOW_SIZE<pattern_image.cols && p.y+WINDOW_SIZE<pattern_image.rows)
+            const cv::Point2f c(p.x - code_image.offset.x, p.y - code_image.offset.y);
+            if (c.x>=0.f && c.y>=0.f && c.x<code_image.codes.cols && c.y<code_image.codes.rows)
             {
-                for (unsigned h=p.y-WINDOW_SIZE; h<p.y+WINDOW_SIZE; h++)
+                const int x0 = std::max(0, static_cast<int>(c.x) - WINDOW_SIZE), x1 = std::min(code_image.codes.cols, static_cast<int>(c.x) + WINDOW_SIZE);
+                const int y0 = std::max(0, static_cast<int>(c.y) - WINDOW_SIZE), y1 = std::min(code_image.codes.rows, static_cast<int>(c.y) + WINDOW_SIZE);
+                for (int h=y0; h<y1; h++)
                 {
-                    register const cv::Vec2f * row = pattern_image.ptr<cv::Vec2f>(h);
-                    register const cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
+                    register const cv::Vec2w * row = code_image.codes_row(h);
+                    register const cv::Vec2b * fraction_row = code_image.fraction_row(h);
+                    register const unsigned char * mask_row = code_image.mask_row(h);
+                    register const unsigned char * min_max_row = min_max_image.ptr<unsigned char>(h);
                     //cv::Vec2f * out_row = out_pattern_image.ptr<cv::Vec2f>(h);
-                    for (unsigned w=p.x-WINDOW_SIZE; w<p.x+WINDOW_SIZE; w++)
+                    for (int w=x0; w<x1; w++)
                     {
-                        const cv::Vec2f & pattern = row[w];
-                        const cv::Vec2b & min_max = min_max_row[w];
                         //cv::Vec2f & out_pattern = out_row[w];
-                        if (sl::INVALID(pattern))
+                        if (!sl::CodeImage::valid(mask_row, w))
                         {
                             continue;
                         }
-                        if ((min_max[1]-min_max[0])<static_cast<int>(threshold))
+                        if (sl::get_contrast(min_max_row, w, wide)<static_cast<int>(threshold))
                         {   //apply threshold and skip
                             continue;
                         }
 
-                        img_points.push_back(cv::Point2f(w, h));
-                        proj_points.push_back(cv::Point2f(pattern));
+                        img_points.push_back(cv::Point2f(w + code_image.offset.x, h + code_image.offset.y));
+                        proj_points.push_back(sl::CodeImage::code_point(row, fraction_row, w));
 
                         //out_pattern = pattern;
                     }
                 }
+            }
+            if (img_points.size()>=4)
+            {   //enough codes around the corner
                 cv::Mat H = cv::findHomography(img_points, proj_points, cv::RANSAC);
                 //std::cout << " H:\n" << H << std::endl;
                 cv::Point3d Q = cv::Point3d(cv::Mat(H*cv::Mat(cv::Point3d(p.x, p.y, 1.0))));
@@ -869,6 +1244,7 @@ void Application::calibrate(void)
     std::vector<std::vector<cv::Point3f> > world_corners_active;
     std::vector<std::vector<cv::Point2f> > camera_corners_active;
     std::vector<std::vector<cv::Point2f> > projector_corners_active;
+    unsigned projector_level = 0; //active sets have the same projector resolution (see decode_all)
     world_corners_active.reserve(count);
     camera_corners_active.reserve(count);
     projector_corners_active.reserve(count);
@@ -879,6 +1255,10 @@ void Application::calibrate(void)
         std::vector<cv::Point2f> const& proj_corners = corners_projector.at(i);
         if (world_corners.size() && cam_corners.size() && proj_corners.size())
         {   //active set
+            if (world_corners_active.empty())
+            {
+                projector_level = i;
+            }
             world_corners_active.push_back(world_corners);
             camera_corners_active.push_back(cam_corners);
             projector_corners_active.push_back(proj_corners);
@@ -907,7 +1287,7 @@ void Application::calibrate(void)
                                             cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 50, DBL_EPSILON));
 
     //calibrate the projector ////////////////////////////////////
-    cv::Size projector_size(get_projector_width(), get_projector_height());
+    cv::Size projector_size(get_projector_width(projector_level), get_projector_height(projector_level));
     processing_message(QString(" * Calibrate projector [%1x%2]").arg(projector_size.width).arg(projector_size.height));
     std::vector<cv::Mat> proj_rvecs, proj_tvecs;
     int proj_flags = cal_flags;
@@ -1116,14 +1496,14 @@ void Application::calibrate(void)
     processing_message("Calibration finished");
 }
 
-bool Application::decode_gray_set(unsigned level, cv::Mat & pattern_image, cv::Mat & min_max_image, QWidget * parent_widget) const
+bool Application::decode_gray_set(unsigned level, sl::CodeImage & code_image, cv::Mat & min_max_image, QWidget * parent_widget) const
 {
     if (model.rowCount()<static_cast<int>(level))
     {   //out of bounds
         return false;
     }
 
-    pattern_image = cv::Mat();
+    code_image.release();
     min_max_image = cv::Mat();
 
     //progress
@@ -1152,52 +1532,79 @@ bool Application::decode_gray_set(unsigned level, cv::Mat & pattern_image, cv::M
     }
     processEvents();
 
-    //parameters
-    const float b = config.value(ROBUST_B_CONFIG, ROBUST_B_DEFAULT).toFloat();
-    const unsigned m = config.value(ROBUST_M_CONFIG, ROBUST_M_DEFAULT).toUInt();
-
-    //estimate direct component
-    std::vector<cv::Mat> images;
-    int total_images = model.rowCount(model.index(level, 0));
-    int total_patterns = total_images/2 - 1;
-    const int direct_light_count = 4;
-    const int direct_light_offset = 4;
-    if (total_patterns<direct_light_count+direct_light_offset)
+    //collect images and parameters
+    DecodeJob job;
+    if (!prepare_decode_job(level, job))
     {   //too few images
         processing_set_current_message("ERROR: too few pattern images");
         processing_message("ERROR: too few pattern images");
+        if (progress)
+        {
+            progress->close();
+            delete progress;
+            progress = NULL;
+        }
         return false;
     }
+
     if (progress)
     {
-        progress->setLabelText("Decoding: estimating direct and global light components...");
+        progress->setValue(10);
+        progress->setLabelText("Decoding: projector column and row values...");
         processEvents();
     }
 
-    QList<unsigned> direct_component_images;
-    for (unsigned i=0; i<direct_light_count; i++)
-    {
-        int index = total_images - total_patterns - direct_light_count - direct_light_offset + i + 1;
-        direct_component_images.append(index);
-        direct_component_images.append(index + total_patterns);
-    }
-    //QList<unsigned> direct_component_images(QList<unsigned>() << 15 << 16 << 17 << 18 << 35 << 36 << 37 << 38);
-    foreach (unsigned i, direct_component_images)
+    processing_message("Decoding, please wait...");
+    bool from_cache = false;
+    bool rv = run_decode_job(job, code_image, min_max_image, from_cache);
+    if (from_cache)
     {
-        images.push_back(get_image(level, i-1));
+        processing_message(QString("Decoded set loaded from cache: %1").arg(QString::fromStdString(job.cache_filename)));
     }
-    cv::Mat direct_light = sl::estimate_direct_light(images, b);
-    processing_message("Estimate direct and global light components... done.");
 
     if (progress)
     {
-        progress->setValue(50);
-        progress->setLabelText("Decoding: projector column and row values...");
+        progress->setValue(100);
+        progress->setLabelText(QString("Decoding: %1").arg((rv?"finished":"failed")));
+        processEvents();
+
+        progress->close();
+        delete progress;
+        progress = NULL;
         processEvents();
     }
 
-    std::vector<std::string> image_names;
+    return rv;
+}
 
+bool Application::prepare_decode_job(unsigned level, DecodeJob & job) const
+{
+    //parameters
+    const int threads = config.value(DECODE_THREADS_CONFIG, DECODE_THREADS_DEFAULT).toInt();
+    const bool compact = config.value(DECODE_COMPACT_CONFIG, DECODE_COMPACT_DEFAULT).toBool();
+    const bool packed = config.value(DECODE_PACKED_CONFIG, DECODE_PACKED_DEFAULT).toBool();
+    const bool use_cache = config.value(DECODE_CACHE_CONFIG, DECODE_CACHE_DEFAULT).toBool();
+    const bool write_stats = config.value(DECODE_STATS_CONFIG, DECODE_STATS_DEFAULT).toBool();
+    job.level = level;
+    job.b = config.value(ROBUST_B_CONFIG, ROBUST_B_DEFAULT).toFloat();
+    job.m = config.value(ROBUST_M_CONFIG, ROBUST_M_DEFAULT).toUInt();
+    job.prefetch = config.value(DECODE_PREFETCH_CONFIG, DECODE_PREFETCH_DEFAULT).toUInt();
+    const bool single = (get_images_per_bit(level)==1);
+    const bool columns = get_columns_only(level);
+    job.phase_steps = static_cast<unsigned>(get_phase_steps(level));
+    job.roi_threshold = (config.value(DECODE_ROI_CONFIG, DECODE_ROI_DEFAULT).toBool() ? 
+                            std::max(1, config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toInt()) : 0);
+    const bool robust = !single && job.phase_steps==0; //the coarse bits of phase shift sets are decoded in simple mode
+    job.flags = (robust ? sl::RobustDecode : sl::SimpleDecode)|(single ? sl::SingleImageDecode : 0)|sl::GrayPatternDecode
+                |(compact ? sl::CompactDecode : 0)|(columns ? sl::ColumnsOnlyDecode : 0)|(packed ? sl::PackedDecode : 0);
+    job.projector_size = cv::Size(get_projector_width(level), get_projector_height(level));
+    job.pattern_size = get_pattern_size(level);
+
+    //decode passes run on the OpenCV thread pool
+    cv::setNumThreads(threads>0 ? threads : -1);
+
+    //images
+    job.image_names.clear();
     QModelIndex parent = model.index(level, 0);
     unsigned level_count = static_cast<unsigned>(model.rowCount(parent));
     for (unsigned i=0; i<level_count; i++)
@@ -1206,40 +1613,159 @@ bool Application::decode_gray_set(unsigned level, cv::Mat & pattern_image, cv::M
         std::string filename = model.data(index, ImageFilenameRole).toString().toStdString();
         std::cout << "[decode_set " << level << "] Filename: " << filename << std::endl;
 
-        image_names.push_back(filename);
+        job.image_names.push_back(filename);
+    }
+    std::string stack_filename;
+    unsigned frame = 0;
+    if (!job.image_names.empty() && FrameStack::split_frame_name(job.image_names.front(), stack_filename, frame))
+    {   //frames are mapped, there is nothing to load ahead
+        job.prefetch = 0;
     }
 
-    if (processing_canceled() || (progress && progress->wasCanceled()))
-    {   //abort
-        processing_set_current_message("Decode canceled");
-        processing_message("Decode canceled");
-        if (progress)
+    //robust mode: the direct light is estimated from these images, loaded before the pattern pairs
+    std::vector<unsigned> direct_light_images = (robust ? sl::get_direct_light_images(level_count, columns) : std::vector<unsigned>());
+    if (robust ? direct_light_images.empty() : level_count<3)
+    {   //too few images
+        return false;
+    }
+    size_t light_frames = direct_light_images.size();
+
+    //decoded set cache: valid while images and decode parameters do not change
+    job.cache_filename = (use_cache ? get_decode_cache_filename(level) : std::string());
+    job.cache_key = get_decode_cache_key(level, job.flags, job.b, job.m, job.projector_size, job.pattern_size, job.roi_threshold);
+    job.stats_filename = (write_stats ? QFileInfo(QString::fromStdString(get_decode_cache_filename(level))).absoluteDir()
+                                            .filePath("decode_stats.json").toStdString() : std::string());
+
+    //memory held while decoding: prefetched frames, the direct light images while it is estimated, plus the output images
+    cv::Size frame_size = get_camera_size(level);
+    size_t frame_bytes = static_cast<size_t>(frame_size.area());
+    job.memory = frame_bytes*(job.prefetch + 2 + light_frames + (robust ? 2 + sizeof(cv::Vec2b) : 0)) 
+                + frame_bytes*(sizeof(cv::Vec2f) + 2*sizeof(cv::Vec2b) + sizeof(cv::Vec2w))
+                + frame_bytes*(job.phase_steps>0 ? 3*2*sizeof(float) + sizeof(cv::Vec2b) : 0); //phase sums, wrapped phase and code fraction
+
+    return true;
+}
+
+bool Application::run_decode_job(DecodeJob const& job, sl::CodeImage & code_image, cv::Mat & min_max_image, bool & from_cache)
+{
+    code_image.release();
+    min_max_image = cv::Mat();
+    from_cache = false;
+
+    cv::Mat direct_light;
+    if (!job.cache_filename.empty() && io_util::read_decode_cache(job.cache_filename, job.cache_key, code_image, min_max_image, direct_light))
+    {   //cache hit
+        std::cout << "[decode_set " << job.level << "] Loaded from cache: " << job.cache_filename << std::endl;
+        from_cache = true;
+        return true;
+    }
+
+    //robust mode: the direct light (empty here) is estimated by the decode pass
+    sl::DecodeStats stats;
+    sl::DecodeStats * report = (job.stats_filename.empty() ? NULL : &stats);
+    cv::Mat pattern_image;
+    cv::Point roi_offset;
+    bool rv = sl::decode_pattern(job.image_names, pattern_image, min_max_image, job.pattern_size, job.flags, direct_light, job.b, job.m, 
+                                 job.prefetch, job.phase_steps, job.roi_threshold, &roi_offset, report);
+    if (rv && job.pattern_size!=job.projector_size)
+    {   //fewer bits projected: codes to the projector resolution of the other sets
+        rv = sl::scale_pattern(pattern_image, job.pattern_size, job.projector_size, (job.flags & sl::ColumnsOnlyDecode)!=0);
+    }
+    if (rv)
+    {   //integer codes, phase shift sets keep the fraction
+        code_image = sl::CodeImage(pattern_image, roi_offset);
+        if (report)
         {
-            progress->close();
-            delete progress;
-            progress = NULL;
+            if (!io_util::write_decode_stats(job.stats_filename, stats))
+            {
+                std::cout << "[decode_set " << job.level << "] Failed to write decode report: " << job.stats_filename << std::endl;
+            }
+        }
+        if (!job.cache_filename.empty() && !io_util::write_decode_cache(job.cache_filename, job.cache_key, code_image, min_max_image, direct_light))
+        {
+            std::cout << "[decode_set " << job.level << "] Failed to write cache: " << job.cache_filename << std::endl;
         }
-        return false;
     }
-    processEvents();
 
-    processing_message("Decoding, please wait...");
-    cv::Size projector_size(get_projector_width(), get_projector_height());
-    bool rv = sl::decode_pattern(image_names, pattern_image, min_max_image, projector_size, sl::RobustDecode|sl::GrayPatternDecode, direct_light, m);
+    return rv;
+}
 
-    if (progress)
+std::string Application::get_decode_cache_filename(unsigned level) const
+{
+    QModelIndex parent = model.index(level, 0);
+    if (model.rowCount(parent)<1)
+    {   //no images
+        return std::string();
+    }
+
+    //next to the set images
+    QFileInfo info(model.data(model.index(0, 0, parent), ImageFilenameRole).toString());
+    return QString("%1/decode_cache.bin").arg(info.absolutePath()).toStdString();
+}
+
+std::string Application::get_decode_cache_key(unsigned level, unsigned flags, float b, unsigned m, cv::Size const& projector_size, 
+                                              cv::Size const& pattern_size, unsigned roi_threshold) const
+{
+    //decode parameters, packed decoding gives the same result
+    QString key = QString("flags=%1 b=%2 m=%3 projector=%4x%5 pattern=%6x%7 phase_steps=%8 roi_threshold=%9\n").arg(flags & ~sl::PackedDecode).arg(b).arg(m)
+                    .arg(projector_size.width).arg(projector_size.height).arg(pattern_size.width).arg(pattern_size.height)
+                    .arg(get_phase_steps(level)).arg(roi_threshold);
+
+    //images: name, size and modification time
+    QModelIndex parent = model.index(level, 0);
+    int count = model.rowCount(parent);
+    for (int i=0; i<count; i++)
     {
-        progress->setValue(100);
-        progress->setLabelText(QString("Decoding: %1").arg((rv?"finished":"failed")));
-        processEvents();
+        std::string filename = model.data(model.index(i, 0, parent), ImageFilenameRole).toString().toStdString();
+        std::string stack_filename;
+        unsigned frame = 0;
+        QFileInfo info(QString::fromStdString(FrameStack::split_frame_name(filename, stack_filename, frame) ? stack_filename : filename));
+        key += QString("%1 %2 %3\n").arg(info.fileName()).arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch());
+    }
+    return key.toStdString();
+}
 
-        progress->close();
-        delete progress;
-        progress = NULL;
-        processEvents();
+unsigned Application::write_frame_stacks(void)
+{
+    unsigned count = 0;
+    for (int level=0; level<model.rowCount(); level++)
+    {
+        QModelIndex parent = model.index(level, 0);
+        std::vector<std::string> images;
+        for (int i=0; i<model.rowCount(parent); i++)
+        {
+            images.push_back(model.data(model.index(i, 0, parent), ImageFilenameRole).toString().toStdString());
+        }
+        std::string stack_filename;
+        unsigned frame = 0;
+        if (images.empty() || FrameStack::split_frame_name(images.front(), stack_filename, frame))
+        {   //nothing to convert
+            continue;
+        }
+
+        //same layout as projector_info.txt, the images are kept
+        FrameStack::Layout layout;
+        layout.projector_size = get_pattern_size(level);
+        layout.images_per_bit = static_cast<unsigned>(get_images_per_bit(level));
+        layout.columns_only = get_columns_only(level);
+        layout.phase_steps = static_cast<unsigned>(get_phase_steps(level));
+        QString filename = QFileInfo(QString::fromStdString(images.front())).absoluteDir().filePath(FRAME_STACK_FILENAME);
+        if (FrameStack::write(filename.toStdString(), images, layout))
+        {
+            count++;
+        }
+        else
+        {
+            std::cerr << "Failed to write frame stack: " << filename.toStdString() << std::endl;
+        }
     }
 
-    return rv;
+    //reload: the sets are read from the new files
+    if (count>0)
+    {
+        set_root_dir(get_root_dir());
+    }
+    return count;
 }
 
 bool Application::load_calibration(QWidget * parent_widget)
@@ -1302,27 +1828,34 @@ void Application::reconstruct_model(int level, scan3d::Pointcloud & pointcloud,
         return;
     }
 
-    cv::Mat pattern_image = pattern_list.at(level);
+    sl::CodeImage const& code_image = pattern_list.at(level);
     cv::Mat min_max_image = min_max_list.at(level);;
     cv::Mat color_image = get_image(level, 0, ColorImageRole);
 
-    if (!pattern_image.data || !min_max_image.data)
+    if (code_image.empty() || !min_max_image.data)
     {   //error: decode failed
         return;
     }
 
-    cv::Size projector_size(get_projector_width(), get_projector_height());
+    cv::Size projector_size(get_projector_width(level), get_projector_height(level));
     int threshold = config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toInt();;
     double max_dist = config.value(MAX_DIST_CONFIG, MAX_DIST_DEFAULT).toDouble();;
     
-    scan3d::reconstruct_model(pointcloud, calib, pattern_image, min_max_image, color_image, projector_size, threshold, max_dist, parent_widget);
+    if (get_columns_only(level))
+    {   //no row code: intersect camera rays with projector column planes
+        scan3d::reconstruct_model_columns(pointcloud, calib, code_image, min_max_image, color_image, projector_size, threshold, parent_widget);
+    }
+    else
+    {
+        scan3d::reconstruct_model(pointcloud, calib, code_image, min_max_image, color_image, projector_size, threshold, max_dist, parent_widget);
+    }
 
     //debug: dump code to file
     /*
     QString path = config.value("main/root_dir").toString();
     QModelIndex index = model.index(level, 0);
     QString set_name = model.data(index, Qt::DisplayRole).toString();
-    dump_decoded(qPrintable(QString("%1/%2/decode_dump.sl").arg(path).arg(set_name)), 0, pattern_image, min_max_image, color_image);
+    dump_decoded(qPrintable(QString("%1/%2/decode_dump.sl").arg(path).arg(set_name)), 0, code_image.to_pattern(), min_max_image, color_image);
     */
 
     //save the projector view
@@ -1345,11 +1878,12 @@ void Application::reconstruct_model_dump(cv::Mat2f const& pattern_image, cv::Mat
         return;
     }
 
-    cv::Size projector_size(get_projector_width(), get_projector_height());
+    //dumps have decoded codes: the projector resolution of the loaded sets
+    cv::Size projector_size(get_projector_width(0), get_projector_height(0));
     int threshold = config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toInt();;
     double max_dist = config.value(MAX_DIST_CONFIG, MAX_DIST_DEFAULT).toDouble();;
     
-    scan3d::reconstruct_model(pointcloud, calib, pattern_image, min_max_image, color_image, projector_size, threshold, max_dist, parent_widget);
+    scan3d::reconstruct_model(pointcloud, calib, sl::CodeImage(pattern_image), min_max_image, color_image, projector_size, threshold, max_dist, parent_widget);
 }
 
 void Application::compute_normals(scan3d::Pointcloud & pointcloud)
@@ -1383,41 +1917,23 @@ void Application::make_pattern_images(int level, cv::Mat & col_image, cv::Mat &
         return;
     }
 
-    cv::Mat const& pattern_image = pattern_list.at(level);
+    sl::CodeImage const& code_image = pattern_list.at(level);
     cv::Mat const& min_max_image = min_max_list.at(level);
 
-    if (!pattern_image.data || !min_max_image.data)
+    if (code_image.empty() || !min_max_image.data)
     {   //no decoded
         return;
     }
 
-    //apply threshold
-    int threshold = config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toInt();
-    cv::Mat pattern_image_new = cv::Mat(pattern_image.size(), pattern_image.type());
-    for (int h=0; h<pattern_image.rows; h++)
-    {
-        const cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
-        const cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
-        cv::Vec2f * pattern_new_row = pattern_image_new.ptr<cv::Vec2f>(h);
-        for (int w=0; w<pattern_image.cols; w++)
-        {
-            cv::Vec2f const& pattern = pattern_row[w];
-            cv::Vec2b const& min_max = min_max_row[w];
-            cv::Vec2f & pattern_new = pattern_new_row[w];
+    //whole camera image: the codes may cover only a region of it
+    cv::Size image_size = get_camera_size(level);
+    image_size.width = std::max(image_size.width, code_image.roi().br().x);
+    image_size.height = std::max(image_size.height, code_image.roi().br().y);
 
-            if (sl::INVALID(pattern) || (min_max[1]-min_max[0])<static_cast<int>(threshold))
-            {   //invalid
-                pattern_new = cv::Vec2f(sl::PIXEL_UNCERTAIN, sl::PIXEL_UNCERTAIN);
-            }
-            else
-            {   //ok
-                pattern_new = pattern;
-            }
-        }   //for each column
-    }   //for each row
-
-    col_image = sl::colorize_pattern(pattern_image_new, 0, get_projector_width(level));
-    row_image = sl::colorize_pattern(pattern_image_new, 1, get_projector_height(level));
+    //apply threshold and colorize both codes in one pass
+    int threshold = config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toInt();
+    cv::Size max_value(get_projector_width(level), get_projector_height(level));
+    sl::colorize_codes(code_image, min_max_image, threshold, image_size, max_value, col_image, row_image);
 }
 
 cv::Mat Application::get_projector_view(int level, bool force_update)
@@ -1441,12 +1957,12 @@ cv::Mat Application::get_projector_view(int level, bool force_update)
     {   //make projector view with the current configuration
         int threshold = config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toInt();
 
-        cv::Mat pattern_image = pattern_list.at(level);
+        sl::CodeImage const& code_image = pattern_list.at(level);
         cv::Mat min_max_image = min_max_list.at(level);;
         cv::Mat color_image = get_image(level, 0, ColorImageRole);
-        cv::Size projector_size(get_projector_width(), get_projector_height());
+        cv::Size projector_size(get_projector_width(level), get_projector_height(level));
     
-        projector_image = scan3d::make_projector_view(pattern_image, min_max_image, color_image, projector_size, threshold);
+        projector_image = scan3d::make_projector_view(code_image, min_max_image, color_image, projector_size, threshold);
     }
 
     return projector_image;
@@ -52,7 +52,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 enum Role {ImageFilenameRole = Qt::UserRole, GrayImageRole, ColorImageRole, 
-           ProjectorWidthRole, ProjectorHeightRole};
+           ProjectorWidthRole, ProjectorHeightRole, ImagesPerBitRole, ColumnsOnlyRole, 
+           PhaseStepsRole, PatternWidthRole, PatternHeightRole};
 
 #ifdef USE_SPINNAKER
 enum NodeType {Enum, Bool};
@@ -86,6 +87,8 @@ enum NodeType {Enum, Bool};
 #define CAMERA_BALANCE_BLUE_DEFAULT  1.0
 #define CAMERA_SHARPNESS_CONFIG      "spinnaker/camera_sharpness"
 #define CAMERA_SHARPNESS_DEFAULT     1.0
+#define CAMERA_RAW_BAYER_CONFIG      "spinnaker/camera_raw_bayer"
+#define CAMERA_RAW_BAYER_DEFAULT     true   //color cameras: pattern frames are not demosaiced
 #endif
 
 #define WINDOW_TITLE "3D Scanning Software"
@@ -99,6 +102,28 @@ enum NodeType {Enum, Bool};
 #define ROBUST_B_DEFAULT    0.5
 #define ROBUST_M_CONFIG     "decode/m"
 #define ROBUST_M_DEFAULT    5
+#define DECODE_THREADS_CONFIG   "decode/threads"
+#define DECODE_THREADS_DEFAULT  0   //0: use all cores
+#define DECODE_PREFETCH_CONFIG  "decode/prefetch_frames"
+#define DECODE_PREFETCH_DEFAULT 8   //max images loaded ahead of the decoder, 0: no prefetch
+#define DECODE_ON_CAPTURE_CONFIG    "decode/on_capture"
+#define DECODE_ON_CAPTURE_DEFAULT   true    //decode while capturing, frames are not read back from disk
+#define DECODE_COMPACT_CONFIG   "decode/compact"
+#define DECODE_COMPACT_DEFAULT  true    //skip pixels already uncertain in the remaining pairs
+#define DECODE_CACHE_CONFIG     "decode/cache"
+#define DECODE_CACHE_DEFAULT    true    //keep decoded sets in decode_cache.bin next to the images
+#define DECODE_PARALLEL_SETS_CONFIG     "decode/parallel_sets"
+#define DECODE_PARALLEL_SETS_DEFAULT    0       //sets decoded at the same time, 0: half the cores
+#define DECODE_MEMORY_BUDGET_CONFIG     "decode/memory_budget_mb"
+#define DECODE_MEMORY_BUDGET_DEFAULT    2048    //estimated memory of the sets decoded at the same time
+#define DECODE_MIN_RESOLVED_CONFIG      "decode/min_resolved"
+#define DECODE_MIN_RESOLVED_DEFAULT     0.75    //a bit is usable when this fraction of lit pixels resolves it
+#define DECODE_ROI_CONFIG       "decode/roi"
+#define DECODE_ROI_DEFAULT      true    //decode only the bounding box of the pixels over the shadow threshold
+#define DECODE_PACKED_CONFIG    "decode/packed"
+#define DECODE_PACKED_DEFAULT   true    //keep one bit per pixel and pair while decoding, codes are assembled at the end
+#define DECODE_STATS_CONFIG     "decode/stats"
+#define DECODE_STATS_DEFAULT    true    //write decode_stats.json next to the images of every decoded set
 
 //checkerboard size
 #define DEFAULT_CORNER_X        7
@@ -123,6 +148,25 @@ enum NodeType {Enum, Bool};
 #define DUMP_ROWS 1
 #define DUMP_COLS 2
 
+//everything needed to decode one set, collected on the GUI thread
+struct DecodeJob
+{
+    unsigned level;
+    std::vector<std::string> image_names;
+    cv::Size projector_size;
+    cv::Size pattern_size;  //smaller than projector_size when the finest bits were not projected: codes are scaled
+    unsigned flags;
+    float b;
+    unsigned m;
+    unsigned prefetch;
+    unsigned phase_steps;   //0: Gray code only
+    unsigned roi_threshold; //0: decode the whole image
+    std::string cache_filename;
+    std::string cache_key;
+    std::string stats_filename;     //empty: no decode report
+    size_t memory;  //estimated bytes held while decoding
+};
+
 class Application : public QApplication
 {
     Q_OBJECT
@@ -140,8 +184,13 @@ public:
     const cv::Mat get_image(unsigned level, unsigned n, Role role = GrayImageRole) const;
     int get_camera_width(unsigned level = 0) const;
     int get_camera_height(unsigned level = 0) const;
+    cv::Size get_camera_size(unsigned level = 0) const;
     int get_projector_width(unsigned level = 0) const;
     int get_projector_height(unsigned level = 0) const;
+    cv::Size get_pattern_size(unsigned level = 0) const;
+    int get_images_per_bit(unsigned level = 0) const;
+    bool get_columns_only(unsigned level = 0) const;
+    int get_phase_steps(unsigned level = 0) const;
 
     bool extract_chessboard_corners(void);
     static void get_chessboard_world_coords(std::vector<cv::Point3f> & world_corners, cv::Size corner_count, cv::Size corner_size);
@@ -149,9 +198,17 @@ public:
     void decode(int level, QWidget * parent_widget = NULL);
     void calibrate(void);
 
-    bool decode_gray_set(unsigned level, cv::Mat & pattern_image, cv::Mat & min_max_image, QWidget * parent_widget = NULL) const;
+    bool decode_gray_set(unsigned level, sl::CodeImage & code_image, cv::Mat & min_max_image, QWidget * parent_widget = NULL) const;
+    bool decode_sets(std::vector<unsigned> const& levels);
+    bool prepare_decode_job(unsigned level, DecodeJob & job) const;
+    static bool run_decode_job(DecodeJob const& job, sl::CodeImage & code_image, cv::Mat & min_max_image, bool & from_cache);
+    std::string get_decode_cache_filename(unsigned level) const;
+    std::string get_decode_cache_key(unsigned level, unsigned flags, float b, unsigned m, cv::Size const& projector_size, 
+                                     cv::Size const& pattern_size, unsigned roi_threshold) const;
+    void set_decoded(const QString & set_name, sl::CodeImage const& code_image, cv::Mat const& min_max_image);
     bool dump_decoded(const char* filename, int type, cv::Mat2f const& pattern_image, cv::Mat2b const& min_max_image, cv::Mat3b const& color_image) const;
     bool load_dump(const char* filename, int type, cv::Mat2f & pattern_image, cv::Mat2b & min_max_image, cv::Mat3b & color_image) const;
+    unsigned write_frame_stacks(void);
 
     void load_config(void);
 
@@ -196,7 +253,7 @@ public:
     std::vector<std::vector<cv::Point3f> > corners_world;
     std::vector<std::vector<cv::Point2f> > corners_camera;
     std::vector<std::vector<cv::Point2f> > corners_projector;
-    std::vector<cv::Mat> pattern_list;
+    std::vector<sl::CodeImage> pattern_list;
     std::vector<cv::Mat> min_max_list;
     std::vector<cv::Mat> projector_view_list;
     scan3d::Pointcloud pointcloud;
@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <iostream>
 #include <opencv2/calib3d.hpp>
+#include <algorithm>
 
 CalibrationData::CalibrationData() :
     cam_K(), cam_kc(),
@@ -38,7 +39,9 @@ CalibrationData::CalibrationData() :
     R(), T(), E(), F(),
     // H1(), H2(),
     cam_error(0.0), proj_error(0.0), stereo_error(0.0),
-    filename()
+    filename(),
+    _camera_rays(), _camera_rays_K(), _camera_rays_kc(),
+    _projector_rays(), _projector_rays_K(), _projector_rays_kc()
 {
 }
 
@@ -59,6 +62,8 @@ void CalibrationData::clear(void)
     // H1 = cv::Mat();
     // H2 = cv::Mat();
     filename = QString();
+    _camera_rays = cv::Mat();
+    _projector_rays = cv::Mat();
 }
 
 bool CalibrationData::is_valid(void) const
@@ -199,4 +204,68 @@ void CalibrationData::display(std::ostream & stream) const
         << " - R:\n" << R << std::endl
         << " - T:\n" << T << std::endl
         ;
+}
+
+//true if both matrices hold exactly the same values
+static bool same_values(const cv::Mat & a, const cv::Mat & b)
+{
+    return (a.size()==b.size() && a.type()==b.type() && (a.empty() || cv::norm(a, b, cv::NORM_INF)==0.0));
+}
+
+const cv::Mat & CalibrationData::update_rays(cv::Mat & rays, cv::Mat & rays_K, cv::Mat & rays_kc, 
+                                                cv::Size const& size, const cv::Mat & K, const cv::Mat & kc)
+{
+    if (rays.size()==size && same_values(rays_K, K) && same_values(rays_kc, kc))
+    {   //up to date
+        return rays;
+    }
+
+    rays.create(size, CV_64FC2);
+    cv::parallel_for_(cv::Range(0, size.height), [&](const cv::Range & range)
+    {
+        cv::Mat pixels(1, size.width, CV_64FC2);
+        cv::Vec2d * pixels_row = pixels.ptr<cv::Vec2d>(0);
+        for (int h=range.start; h<range.end; h++)
+        {
+            for (int w=0; w<size.width; w++)
+            {
+                pixels_row[w] = cv::Vec2d(w, h);
+            }
+            cv::Mat rays_row = rays.row(h);
+            cv::undistortPoints(pixels, rays_row, K, kc);
+        }
+    });
+    rays_K = K.clone();
+    rays_kc = kc.clone();
+
+    return rays;
+}
+
+const cv::Mat & CalibrationData::get_camera_rays(cv::Size const& camera_size) const
+{
+    return update_rays(_camera_rays, _camera_rays_K, _camera_rays_kc, camera_size, cam_K, cam_kc);
+}
+
+const cv::Mat & CalibrationData::get_projector_rays(cv::Size const& projector_size) const
+{
+    return update_rays(_projector_rays, _projector_rays_K, _projector_rays_kc, projector_size, proj_K, proj_kc);
+}
+
+cv::Point2d CalibrationData::interpolate_ray(const cv::Mat & rays, double x, double y)
+{
+    x = std::min(std::max(x, 0.0), rays.cols - 1.0);
+    y = std::min(std::max(y, 0.0), rays.rows - 1.0);
+    int x0 = static_cast<int>(x);
+    int y0 = static_cast<int>(y);
+    int x1 = std::min(x0 + 1, rays.cols - 1);
+    int y1 = std::min(y0 + 1, rays.rows - 1);
+    double fx = x - x0;
+    double fy = y - y0;
+
+    const cv::Vec2d * row0 = rays.ptr<cv::Vec2d>(y0);
+    const cv::Vec2d * row1 = rays.ptr<cv::Vec2d>(y1);
+    cv::Vec2d top = (1.0 - fx)*row0[x0] + fx*row0[x1];
+    cv::Vec2d bottom = (1.0 - fx)*row1[x0] + fx*row1[x1];
+    cv::Vec2d ray = (1.0 - fy)*top + fy*bottom;
+    return cv::Point2d(ray[0], ray[1]);
 }
\ No newline at end of file
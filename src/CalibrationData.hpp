@@ -32,6 +32,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QString>
 #include <opencv2/core.hpp>
 
+//camera and projector calibration; the const ray table getters fill mutable members, so a CalibrationData
+//shared by several threads needs its tables built beforehand
 class CalibrationData
 {
 public:
@@ -54,6 +56,14 @@ public:
 
     void display(std::ostream & stream = std::cout) const;
 
+    //undistorted rays (x, y, 1) of every camera or projector pixel as CV_64FC2 tables: built on first
+    //use and rebuilt when the size or the intrinsics change, not safe to call from several threads
+    const cv::Mat & get_camera_rays(cv::Size const& camera_size) const;
+    const cv::Mat & get_projector_rays(cv::Size const& projector_size) const;
+
+    //ray of a fractional pixel, bilinear interpolation in a ray table
+    static cv::Point2d interpolate_ray(const cv::Mat & rays, double x, double y);
+
     //data
     cv::Mat cam_K;
     cv::Mat cam_kc;
@@ -71,6 +81,14 @@ public:
     double stereo_error;
 
     QString filename;
+
+private:
+    static const cv::Mat & update_rays(cv::Mat & rays, cv::Mat & rays_K, cv::Mat & rays_kc, 
+                                        cv::Size const& size, const cv::Mat & K, const cv::Mat & kc);
+
+    //ray tables and the intrinsics they were built with
+    mutable cv::Mat _camera_rays, _camera_rays_K, _camera_rays_kc;
+    mutable cv::Mat _projector_rays, _projector_rays_K, _projector_rays_kc;
 };
 
 #endif //__CALIBRATIONDATA_HPP__
\ No newline at end of file
@@ -34,10 +34,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QTime>
 
 #include <iostream>
+#include <algorithm>
 #include <opencv2/imgproc.hpp>
 
 #include "Application.hpp"
 #include "im_util.hpp"
+#include "io_util.hpp"
 
 CaptureDialog::CaptureDialog(QWidget * parent, Qt::WindowFlags flags): 
     QDialog(parent, flags),
@@ -47,7 +49,12 @@ CaptureDialog::CaptureDialog(QWidget * parent, Qt::WindowFlags flags):
     _session(),
     _wait_time(0),
     _total(0),
-    _cancel(false)
+    _cancel(false),
+    _decode(false),
+    _decoder(),
+    _decode_pair(),
+    _direct_light_indices(),
+    _measure_bits(false)
 {
     setupUi(this);
     camera_resolution_label->clear();
@@ -62,6 +69,10 @@ CaptureDialog::CaptureDialog(QWidget * parent, Qt::WindowFlags flags):
     update_camera_combo();
 
     projector_patterns_spin->setValue(APP->config.value("capture/pattern_count", 10).toInt());
+    single_image_check->setChecked(APP->config.value("capture/single_image", false).toBool());
+    columns_only_check->setChecked(APP->config.value("capture/columns_only", false).toBool());
+    phase_steps_spin->setValue(APP->config.value("capture/phase_steps", 0).toInt());
+    auto_bits_check->setChecked(APP->config.value("capture/auto_bits", false).toBool());
     camera_exposure_spin->setMaximum(9999);
     camera_exposure_spin->setValue(APP->config.value("capture/exposure_time", 500).toInt());
     output_dir_line->setText(APP->get_root_dir());
@@ -109,6 +120,10 @@ CaptureDialog::~CaptureDialog()
         config.setValue("capture/camera_name", camera_name);
     }
     config.setValue("capture/pattern_count", projector_patterns_spin->value());
+    config.setValue("capture/single_image", single_image_check->isChecked());
+    config.setValue("capture/columns_only", columns_only_check->isChecked());
+    config.setValue("capture/phase_steps", phase_steps_spin->value());
+    config.setValue("capture/auto_bits", auto_bits_check->isChecked());
     config.setValue("capture/exposure_time", camera_exposure_spin->value());
     config.setValue("capture/continuous", continuous_spin->value());
 
@@ -306,6 +321,22 @@ void CaptureDialog::_on_root_dir_changed(const QString & dirname)
 
 void CaptureDialog::_on_new_camera_image(cv::Mat image)
 {
+  int bayer_code = _video_input.get_bayer_code();
+  if (bayer_code && image.channels()==1)
+  {   //raw Bayer frame: only the texture (first captured image) is demosaiced, 
+      //pattern frames and the preview are converted to gray straight from the mosaic
+    if (_capture && _projector.get_current_pattern()==0)
+    {
+      cv::Mat color_image;
+      cv::cvtColor(image, color_image, bayer_code);
+      image = color_image;
+    }
+    else
+    {
+      image = im_util::bayer_to_gray(image, bayer_code);
+    }
+  }
+
   size_t rotation = 0;
   if (rot_000_radio->isChecked()) { rotation = 0; }
   if (rot_090_radio->isChecked()) { rotation = 90; }
@@ -323,6 +354,10 @@ void CaptureDialog::_on_new_camera_image(cv::Mat image)
     if (_capture)
     {   //save this image
         cv::imwrite(QString("%1/cam_%2.png").arg(_session).arg(_projector.get_current_pattern() + 1, 2, 10, QLatin1Char('0')).toStdString(), image);
+        if (_decode)
+        {   //decode now instead of reading it back from disk later
+            decode_camera_image(image, _projector.get_current_pattern());
+        }
         _capture = false;
         _projector.clear_updated();
     }
@@ -409,8 +444,25 @@ void CaptureDialog::on_capture_button_clicked(bool checked)
     //connect projector display signal
     connect(&_projector, SIGNAL(new_image(QPixmap)), this, SLOT(_on_new_projector_image(QPixmap)));
 
+    //skip the bit planes this setup cannot resolve, measured on a previous scan
+    int pattern_count = projector_patterns_spin->value();
+    _measure_bits = auto_bits_check->isChecked();
+    if (auto_bits_check->isChecked() && APP->config.value("capture/usable_bits_setup").toString()==get_setup_name())
+    {
+        int usable_bits = APP->config.value("capture/usable_bits", 0).toInt();
+        if (usable_bits>0 && usable_bits<pattern_count)
+        {
+            std::cout << "Skipping unresolved bits: " << usable_bits << " of " << pattern_count << " bits projected" << std::endl;
+            pattern_count = usable_bits;
+            _measure_bits = false;
+        }
+    }
+
     //open projector
-    _projector.set_pattern_count(projector_patterns_spin->value());
+    _projector.set_pattern_count(pattern_count);
+    _projector.set_single_image(single_image_check->isChecked());
+    _projector.set_columns_only(columns_only_check->isChecked());
+    _projector.set_phase_steps(phase_steps_spin->value()<3 ? 0 : phase_steps_spin->value());
     _projector.start();
 
     //save projector resolution and settings
@@ -421,6 +473,14 @@ void CaptureDialog::on_capture_button_clicked(bool checked)
     if (rot_270_radio->isChecked()) { rotation = 270; }
     _projector.save_info(QString("%1/projector_info.txt").arg(_session), (rotation==90||rotation==270?true:false));
 
+    //decode while capturing
+    _decoder.reset();
+    _decode_pair = cv::Mat();
+    bool robust = !_projector.get_single_image() && _projector.get_phase_steps()==0;
+    _direct_light_indices = (robust ? sl::get_direct_light_images(_projector.get_image_count(), _projector.get_columns_only()) : std::vector<unsigned>());
+    _decode = APP->config.value(DECODE_ON_CAPTURE_CONFIG, DECODE_ON_CAPTURE_DEFAULT).toBool() 
+                && (!robust || !_direct_light_indices.empty());
+
     //init time
     wait(_wait_time);
 
@@ -455,8 +515,17 @@ void CaptureDialog::on_capture_button_clicked(bool checked)
     disconnect(&_projector, SIGNAL(new_image(QPixmap)), this, SLOT(_on_new_projector_image(QPixmap)));
    
 
+    //decoded pattern is ready as soon as the last image was captured
+    sl::CodeImage code_image;
+    cv::Mat min_max_image;
+    bool decoded = finish_decode(code_image, min_max_image);
+
     //re-read images
     APP->set_root_dir(APP->get_root_dir());
+    if (decoded)
+    {
+        APP->set_decoded(QDir(_session).dirName(), code_image, min_max_image);
+    }
 
     //enable GUI interaction
     projector_group->setEnabled(true);
@@ -468,6 +537,121 @@ void CaptureDialog::on_capture_button_clicked(bool checked)
     //TODO: override window close button or allow to close/cancel while capturing
 }
 
+void CaptureDialog::decode_camera_image(cv::Mat const& image, int index)
+{
+    cv::Mat gray_image;
+    if (image.channels()==1)
+    {
+        gray_image = image.clone();
+    }
+    else
+    {
+        cvtColor(image, gray_image, cv::COLOR_BGR2GRAY);
+    }
+
+    if (index==0)
+    {   //first image: start a new set
+        QSize effective_size = _projector.get_effective_size(rot_090_radio->isChecked() || rot_270_radio->isChecked());
+        cv::Size projector_size(effective_size.width(), effective_size.height());
+        const unsigned m = APP->config.value(ROBUST_M_CONFIG, ROBUST_M_DEFAULT).toUInt();
+        const bool compact = APP->config.value(DECODE_COMPACT_CONFIG, DECODE_COMPACT_DEFAULT).toBool();
+        const bool packed = APP->config.value(DECODE_PACKED_CONFIG, DECODE_PACKED_DEFAULT).toBool();
+        const bool report = APP->config.value(DECODE_STATS_CONFIG, DECODE_STATS_DEFAULT).toBool();
+        bool robust = !_projector.get_single_image() && _projector.get_phase_steps()==0;
+        unsigned flags = (robust ? sl::RobustDecode : sl::SimpleDecode)|(_projector.get_single_image() ? sl::SingleImageDecode : 0)
+                        |sl::GrayPatternDecode|(compact ? sl::CompactDecode : 0)|(_projector.get_columns_only() ? sl::ColumnsOnlyDecode : 0)
+                        |(_measure_bits ? sl::BitStatsDecode : 0)|(packed ? sl::PackedDecode : 0)|(report ? sl::ReportDecode : 0);
+        const unsigned roi_threshold = (APP->config.value(DECODE_ROI_CONFIG, DECODE_ROI_DEFAULT).toBool() ? 
+                                            std::max(1, APP->config.value(THRESHOLD_CONFIG, THRESHOLD_DEFAULT).toInt()) : 0);
+        const float b = APP->config.value(ROBUST_B_CONFIG, ROBUST_B_DEFAULT).toFloat();
+        if (_decoder.begin(gray_image.size(), projector_size, _projector.get_pattern_count(), flags, cv::Mat(), m, _projector.get_phase_steps(), 
+                           roi_threshold, gray_image.depth())
+            && robust && !_decoder.estimate_direct_light(_direct_light_indices, b))
+        {   //the direct light images are accumulated by the decoder
+            _decoder.reset();
+        }
+    }
+    if (!_decoder.started())
+    {   //not decoding
+        return;
+    }
+
+    if (index>=_projector.get_gray_image_count())
+    {   //phase shift
+        _decoder.push_phase(gray_image);
+    }
+    else if (_projector.get_single_image() && index>=2)
+    {   //one image per bit
+        _decoder.push_image(gray_image);
+    }
+    else if (index%2==0)
+    {   //first image of the pair
+        _decode_pair = gray_image;
+    }
+    else
+    {
+        _decoder.push_pair(_decode_pair, gray_image);
+        _decode_pair = cv::Mat();
+    }
+}
+
+bool CaptureDialog::finish_decode(sl::CodeImage & code_image, cv::Mat & min_max_image)
+{
+    if (!_decode || !_decoder.started())
+    {   //nothing decoded
+        return false;
+    }
+    _decode = false;
+
+    //robust: the pairs were decoded as soon as the last direct light image was captured
+    if (_measure_bits && _decoder.pushed()==_decoder.pair_count())
+    {   //record the usable bit depth of this setup
+        const double min_resolved = APP->config.value(DECODE_MIN_RESOLVED_CONFIG, DECODE_MIN_RESOLVED_DEFAULT).toDouble();
+        unsigned usable_bits = sl::get_usable_bits(_decoder.bit_stats(), min_resolved);
+        std::cout << "Usable bits: " << usable_bits << " of " << _projector.get_pattern_count() << std::endl;
+        if (usable_bits>0)
+        {
+            APP->config.setValue("capture/usable_bits", usable_bits);
+            APP->config.setValue("capture/usable_bits_setup", get_setup_name());
+        }
+    }
+    _measure_bits = false;
+
+    cv::Mat pattern_image;
+    cv::Point roi_offset;
+    sl::DecodeStats stats;
+    bool report = APP->config.value(DECODE_STATS_CONFIG, DECODE_STATS_DEFAULT).toBool();
+    bool rv = _decoder.finish(pattern_image, min_max_image, &roi_offset, (report ? &stats : NULL));
+    if (rv)
+    {   //integer codes, phase shift sets keep the fraction
+        code_image = sl::CodeImage(pattern_image, roi_offset);
+        if (report)
+        {   //decoded while capturing: there are no load times
+            io_util::write_decode_stats(QString("%1/decode_stats.json").arg(_session).toStdString(), stats);
+        }
+    }
+
+    //clean up
+    _decoder.reset();
+    _decode_pair = cv::Mat();
+
+    return rv;
+}
+
+QString CaptureDialog::get_setup_name(void) const
+{   //usable bits depend on the camera and the projector
+    return QString("%1/%2").arg(camera_combo->currentText()).arg(screen_combo->currentIndex());
+}
+
+void CaptureDialog::on_auto_bits_check_stateChanged(int state)
+{
+    if (state!=Qt::Checked)
+    {   //measure again next time
+        APP->config.remove("capture/usable_bits");
+        APP->config.remove("capture/usable_bits_setup");
+    }
+}
+
 void CaptureDialog::on_test_check_stateChanged(int state)
 {
     //adjust the GUI
@@ -477,6 +661,9 @@ void CaptureDialog::on_test_check_stateChanged(int state)
     capture_button->setEnabled(!checked);
     screen_combo->setEnabled(!checked);
     projector_patterns_spin->setEnabled(!checked);
+    single_image_check->setEnabled(!checked);
+    columns_only_check->setEnabled(!checked);
+    phase_steps_spin->setEnabled(!checked);
 
     if (checked)
     {   //start preview
@@ -486,6 +673,9 @@ void CaptureDialog::on_test_check_stateChanged(int state)
 
         //open projector
         _projector.set_pattern_count(projector_patterns_spin->value());
+        _projector.set_single_image(single_image_check->isChecked());
+        _projector.set_columns_only(columns_only_check->isChecked());
+        _projector.set_phase_steps(phase_steps_spin->value()<3 ? 0 : phase_steps_spin->value());
         _projector.start();
         _projector.next();
 
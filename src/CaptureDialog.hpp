@@ -36,6 +36,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "ProjectorWidget.hpp"
 #include "VideoInput.hpp"
+#include "structured_light.hpp"
 
 #ifdef USE_SPINNAKER
 #include "CameraConfigurationDialog.hpp"
@@ -78,6 +79,7 @@ public slots:
     void on_capture_button_clicked(bool checked = false);
     void on_output_dir_button_clicked(bool checked = false);
     void on_test_check_stateChanged(int state);
+    void on_auto_bits_check_stateChanged(int state);
     void on_test_prev_button_clicked(bool checked = false);
     void on_test_next_button_clicked(bool checked = false);
   #ifdef USE_SPINNAKER
@@ -87,6 +89,11 @@ public slots:
     void auto_next();
 
 private:
+    void decode_camera_image(cv::Mat const& image, int index);
+    bool finish_decode(sl::CodeImage & code_image, cv::Mat & min_max_image);
+    QString get_setup_name(void) const;
+
+
     ProjectorWidget _projector;
     VideoInput _video_input;
     volatile bool _capture;
@@ -94,6 +101,13 @@ private:
     int _wait_time;
     unsigned _total;
     bool _cancel;
+
+    //decode while capturing
+    bool _decode;
+    sl::Decoder _decoder;
+    cv::Mat _decode_pair;
+    std::vector<unsigned> _direct_light_indices;
+    bool _measure_bits;
 };
 
 #endif  /* __CAPTURENDIALOG_HPP__ */
\ No newline at end of file
@@ -235,8 +235,8 @@ void MainWindow::_on_image_tree_currentChanged(const QModelIndex & current, cons
     else if (display_projector_radio->isChecked() && level<APP->corners_projector.size())
     {
         corners = APP->corners_projector.at(level);
-        const float scale_factor_x = image1.cols*1.f/APP->get_projector_width();
-        const float scale_factor_y = image1.rows*1.f/APP->get_projector_height();
+        const float scale_factor_x = image1.cols*1.f/APP->get_projector_width(level);
+        const float scale_factor_y = image1.rows*1.f/APP->get_projector_height(level);
         for (auto it=corners.begin(); it!=corners.end(); ++it)
         {
             it->x *= scale_factor_x;
@@ -719,6 +719,19 @@ void MainWindow::on_reconstruct_dump_action_triggered(bool checked)
 
 }
 
+void MainWindow::on_write_frame_stacks_action_triggered(bool checked)
+{
+    show_message("Writing frame stacks...");
+    QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
+    QApplication::processEvents();
+
+    unsigned count = APP->write_frame_stacks();
+
+    QApplication::restoreOverrideCursor();
+    QApplication::processEvents();
+    show_message(QString("Frame stacks written: %1").arg(count));
+}
+
 int MainWindow::get_current_set(void)
 {
     QModelIndex index = image_tree->selectionModel()->currentIndex();
@@ -52,6 +52,7 @@ public slots:
     void on_save_calibration_action_triggered(bool checked = false);
     void on_display_calibration_action_triggered(bool checked = false);
     void on_reconstruct_dump_action_triggered(bool checked = false);
+    void on_write_frame_stacks_action_triggered(bool checked = false);
     void on_about_action_triggered(bool checked = false);
 
     //buttons
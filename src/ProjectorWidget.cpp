@@ -33,6 +33,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QPainter>
 
 #include <stdio.h>
+#include <math.h>
 #include <iostream>
 #include <assert.h>
 
@@ -45,6 +46,9 @@ ProjectorWidget::ProjectorWidget(QWidget * parent, Qt::WindowFlags flags) :
     _pattern_count(4),
     _vbits(1),
     _hbits(1),
+    _single_image(false),
+    _columns_only(false),
+    _phase_steps(0),
     _updated(false)
 {
 }
@@ -128,7 +132,7 @@ void ProjectorWidget::next(void)
 
 bool ProjectorWidget::finished(void)
 {
-    return (_current_pattern+2 > 2+4*_pattern_count);
+    return (_current_pattern+1 >= get_image_count());
 }
 
 void ProjectorWidget::paintEvent(QPaintEvent *)
@@ -172,6 +176,10 @@ void ProjectorWidget::update_pattern_bit_count(void)
     for (int i=(1<<_vbits); i<cols; i=(1<<_vbits)) { _vbits++; }
     for (int i=(1<<_hbits); i<rows; i=(1<<_hbits)) { _hbits++; }
     _pattern_count = std::min(std::min(_vbits, _hbits), _pattern_count);
+    if (_phase_steps>0)
+    {   //coarse Gray code: sinusoid period of 8 pixels or more
+        _pattern_count = std::max(1, std::min(std::min(_vbits, _hbits) - 2, _pattern_count));
+    }
     std::cerr << " vbits " << _vbits << " / cols="<<cols<<", mvalue="<< ((1<<_vbits)-1) << std::endl;
     std::cerr << " hbits " << _hbits << " / rows="<<rows<<", mvalue="<< ((1<<_hbits)-1) << std::endl;
     std::cerr << " pattern_count="<< _pattern_count << std::endl; 
@@ -216,11 +224,49 @@ void ProjectorWidget::make_pattern(void)
     // ..
     // YY =  (4*_pattern_count + 2) - 2 horizontal, bit N, normal
     // YY =  (4*_pattern_count + 2) - 1 horizontal, bit N, inverted
-
-    if (_current_pattern<2)
+    //
+    // single image mode: normal patterns only
+    // -----------
+    // 02 vertical, bit N-0
+    // ..
+    // XX = (_pattern_count + 2) - 1 vertical, bit N
+    // -----------
+    // YY = (2*_pattern_count + 2) - 1 horizontal, bit N
+    //
+    // columns only mode: the sequence ends after the vertical patterns
+    //
+    // phase shift: _phase_steps vertical sinusoids, then _phase_steps horizontal sinusoids (not in columns only mode)
+
+    if (_current_pattern>=get_gray_image_count())
+    {   //phase shift
+        int index = _current_pattern - get_gray_image_count();
+        bool vertical = (index<_phase_steps);
+        int period = sl::get_phase_period((vertical ? cols : rows), _pattern_count);
+        _pixmap = make_phase_pattern(rows, cols, vertical, period, (vertical ? voffset : hoffset), index%_phase_steps, _phase_steps);
+    }
+    else if (_current_pattern<2)
     {   //white or black
         _pixmap = make_pattern(rows, cols, vmask, voffset, hmask, hoffset, inverted);
     }
+    else if (_single_image)
+    {
+        int index = _current_pattern - 2;
+        if (index<_pattern_count)
+        {   //vertical
+            vmask = 1<<(_vbits - 1 - index);
+        }
+        else if (index<2*_pattern_count)
+        {   //horizontal
+            hmask = 1<<(_hbits - 1 - (index - _pattern_count));
+        }
+        else
+        {   //error
+            assert(false);
+            stop();
+            return;
+        }
+        _pixmap = make_pattern(rows, cols, vmask, voffset, hmask, hoffset, false);
+    }
     else if (_current_pattern<2*_pattern_count+2)
     {   //vertical
         int bit = _vbits - _current_pattern/2;
@@ -271,15 +317,38 @@ QPixmap ProjectorWidget::make_pattern(int rows, int cols, int vmask, int voffset
     return QPixmap::fromImage(image);
 }
 
-bool ProjectorWidget::save_info(QString const& filename, bool invert) const
+QPixmap ProjectorWidget::make_phase_pattern(int rows, int cols, bool vertical, int period, int offset, int step, int steps)
 {
-    FILE * fp = fopen(qPrintable(filename), "w");
-    if (!fp)
-    {   //failed
-        std::cerr << "Projector save_info failed, file: " << qPrintable(filename) << std::endl;
-        return false;
+    QImage image(cols, rows, QImage::Format_ARGB32);
+
+    //one period of the sinusoid, shifted by step/steps of a period
+    std::vector<uchar> lut(period);
+    for (int i=0; i<period; i++)
+    {
+        double angle = 2.0*M_PI*i/period - 2.0*M_PI*step/steps;
+        lut[i] = static_cast<uchar>(floor(127.5 + 127.5*cos(angle) + 0.5));
     }
 
+    for (int h=0; h<rows; h++)
+    {
+        uchar * row = image.scanLine(h);
+        for (int w=0; w<cols; w++)
+        {
+            uchar * px = row + (4*w);
+            int value = lut[((vertical ? w : h) + offset)%period];
+
+            px[0] = value; //B
+            px[1] = value; //G
+            px[2] = value; //R
+            px[3] = 0xff;  //A
+        }
+    }
+
+    return QPixmap::fromImage(image);
+}
+
+QSize ProjectorWidget::get_effective_size(bool invert) const
+{
     int cols = width();
     int rows = height();
 
@@ -292,20 +361,42 @@ bool ProjectorWidget::save_info(QString const& filename, bool invert) const
     int effective_width = cols;
     int effective_height = rows;
 
-    int max_vert_value = (1<<std::min(_vbits,_pattern_count));
+    //phase shift decodes every projector pixel
+    int max_vert_value = (1<<(_phase_steps>0 ? _vbits : std::min(_vbits,_pattern_count)));
     while (effective_width>max_vert_value )
     {
         effective_width >>= 1;
     }
-    int max_horz_value = (1<<std::min(_hbits,_pattern_count));
+    int max_horz_value = (1<<(_phase_steps>0 ? _hbits : std::min(_hbits,_pattern_count)));
     while (effective_height>max_horz_value)
     {
         effective_height >>= 1;
     }
 
-    fprintf(fp, "%u %u\n", effective_width, effective_height);
+    return QSize(effective_width, effective_height);
+}
+
+bool ProjectorWidget::save_info(QString const& filename, bool invert) const
+{
+    FILE * fp = fopen(qPrintable(filename), "w");
+    if (!fp)
+    {   //failed
+        std::cerr << "Projector save_info failed, file: " << qPrintable(filename) << std::endl;
+        return false;
+    }
+
+    QSize effective_size = get_effective_size(invert);
+    int effective_width = effective_size.width();
+    int effective_height = effective_size.height();
+
+    //fewer bits than the projector needs: the decoded codes are scaled to its resolution
+    int projector_width = (invert ? height() : width());
+    int projector_height = (invert ? width() : height());
+
+    fprintf(fp, "%u %u %u %u %u %u %u\n", effective_width, effective_height, (_single_image ? 1 : 2), (_columns_only ? 1 : 2), _phase_steps,
+                projector_width, projector_height);
 
-    fprintf(fp, "\n# width height\n"); //help
+    fprintf(fp, "\n# width height images_per_bit directions phase_steps projector_width projector_height\n"); //help
 
     std::cerr << "Saved projetor info: " << qPrintable(filename) << std::endl
               << " - Effective resolution: " << effective_width << "x" << effective_height << std::endl;
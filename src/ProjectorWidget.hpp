@@ -41,7 +41,16 @@ public:
     void reset(void);
     inline void set_screen(int screen) {_screen = screen;}
     inline void set_pattern_count(int count) {_pattern_count = count;}
+    inline void set_single_image(bool single) {_single_image = single;}
+    inline void set_columns_only(bool columns) {_columns_only = columns;}
+    inline void set_phase_steps(int steps) {_phase_steps = steps;}
     inline int get_current_pattern(void) const {return _current_pattern;}
+    inline int get_pattern_count(void) const {return _pattern_count;}
+    inline bool get_single_image(void) const {return _single_image;}
+    inline bool get_columns_only(void) const {return _columns_only;}
+    inline int get_phase_steps(void) const {return _phase_steps;}
+    inline int get_gray_image_count(void) const {return 2 + (_single_image ? 1 : 2)*(_columns_only ? 1 : 2)*_pattern_count;}
+    inline int get_image_count(void) const {return get_gray_image_count() + (_columns_only ? 1 : 2)*_phase_steps;}
 
     //projection cycle
     void start(void);
@@ -57,6 +66,7 @@ public:
     inline bool is_updated(void) const {return _updated;}
     inline void clear_updated(void) {_updated = false;}
 
+    QSize get_effective_size(bool invert) const;
     bool save_info(QString const& filename, bool invert) const;
 
 signals:
@@ -68,6 +78,7 @@ protected:
     void make_pattern(void);
     void update_pattern_bit_count(void);
     static QPixmap make_pattern(int rows, int cols, int vmask, int voffset, int hmask, int hoffset, int inverted);
+    static QPixmap make_phase_pattern(int rows, int cols, bool vertical, int period, int offset, int step, int steps);
 
 private:
     int _screen;
@@ -76,6 +87,9 @@ private:
     int _pattern_count;
     int _vbits;
     int _hbits;
+    bool _single_image;
+    bool _columns_only;
+    int _phase_steps;
     volatile bool _updated;
 
 };
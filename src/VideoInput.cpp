@@ -46,6 +46,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #   define V4L2_MAX_CAMERAS 8
 #endif
 
+#include <opencv2/imgproc.hpp>
+
 #include <QApplication>
 #include <QMetaType>
 #include <QTime>
@@ -63,6 +65,7 @@ VideoInput::VideoInput(QObject  * parent):
     _spinnaker_camera(nullptr),
 #endif
     _video_capture(NULL),
+    _bayer_code(0),
     _init(false),
     _stop(false)
 {
@@ -78,10 +81,26 @@ VideoInput::~VideoInput()
 #endif
 }
 
+#ifdef USE_SPINNAKER
+//OpenCV names the Bayer pattern after the second row: RGGB frames are cv::COLOR_BayerBG2BGR
+static int get_bayer_code(Spinnaker::PixelFormatEnums format)
+{
+    switch (format)
+    {
+    case Spinnaker::PixelFormat_BayerRG8: return cv::COLOR_BayerBG2BGR;
+    case Spinnaker::PixelFormat_BayerGR8: return cv::COLOR_BayerGB2BGR;
+    case Spinnaker::PixelFormat_BayerBG8: return cv::COLOR_BayerRG2BGR;
+    case Spinnaker::PixelFormat_BayerGB8: return cv::COLOR_BayerGR2BGR;
+    default: return 0;
+    }
+}
+#endif
+
 void VideoInput::run()
 {
     _init = false;
     _stop = false;
+    _bayer_code = 0;
 
     bool success = start_camera();
 
@@ -99,6 +118,7 @@ void VideoInput::run()
     timer.start();
 
 #ifdef USE_SPINNAKER
+    const bool raw_bayer = APP->config.value(CAMERA_RAW_BAYER_CONFIG, CAMERA_RAW_BAYER_DEFAULT).toBool();
     while(_spinnaker_camera && !_stop && error_count<max_error)
     {
         Spinnaker::ImagePtr pResultImage = nullptr;
@@ -116,15 +136,27 @@ void VideoInput::run()
             {
                 error_count = 0;
 
-                Spinnaker::ImagePtr convertedImage = pResultImage->Convert(Spinnaker::PixelFormat_BGR8, Spinnaker::DIRECTIONAL_FILTER);
-                
-                unsigned int xPadding = static_cast<unsigned int>(convertedImage->GetXPadding());
-                unsigned int yPadding = static_cast<unsigned int>(convertedImage->GetYPadding());
-                unsigned int rowsize = static_cast<unsigned int>(convertedImage->GetWidth());
-                unsigned int colsize = static_cast<unsigned int>(convertedImage->GetHeight());
+                int bayer_code = (raw_bayer ? get_bayer_code(pResultImage->GetPixelFormat()) : 0);
+                if (bayer_code)
+                {   //raw mosaic: the receiver converts to gray, or demosaics the frames it needs in color
+                    _bayer_code = bayer_code;
+                    emit new_image(cv::Mat(static_cast<int>(pResultImage->GetHeight()), static_cast<int>(pResultImage->GetWidth()), CV_8UC1, 
+                                           pResultImage->GetData(), pResultImage->GetStride()));
+                }
+                else
+                {
+                    _bayer_code = 0;
+
+                    Spinnaker::ImagePtr convertedImage = pResultImage->Convert(Spinnaker::PixelFormat_BGR8, Spinnaker::DIRECTIONAL_FILTER);
+                    
+                    unsigned int xPadding = static_cast<unsigned int>(convertedImage->GetXPadding());
+                    unsigned int yPadding = static_cast<unsigned int>(convertedImage->GetYPadding());
+                    unsigned int rowsize = static_cast<unsigned int>(convertedImage->GetWidth());
+                    unsigned int colsize = static_cast<unsigned int>(convertedImage->GetHeight());
 
-                //image data contains padding. When allocating Mat container size, you need to account for the X,Y image data padding. 
-                emit new_image(cv::Mat(colsize + yPadding, rowsize + xPadding, CV_8UC3, convertedImage->GetData(), convertedImage->GetStride()));
+                    //image data contains padding. When allocating Mat container size, you need to account for the X,Y image data padding. 
+                    emit new_image(cv::Mat(colsize + yPadding, rowsize + xPadding, CV_8UC3, convertedImage->GetData(), convertedImage->GetStride()));
+                }
             }
         }
         catch (Spinnaker::Exception& e)
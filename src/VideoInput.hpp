@@ -51,6 +51,9 @@ public:
     inline void set_camera_index(int index) {_camera_index = index;}
     inline int get_camera_index(void) const {return _camera_index;}
 
+    //cv::COLOR_Bayer*2BGR code when the frames are raw Bayer (CV_8UC1), 0 otherwise
+    inline int get_bayer_code(void) const {return _bayer_code;}
+
 #ifdef USE_SPINNAKER
     inline void set_camera_name(std::string name) {_camera_name = name;}
     inline std::string get_camera_name(void) const {return _camera_name;}
@@ -102,6 +105,7 @@ private:
     Spinnaker::CameraPtr _spinnaker_camera;
 #endif
     std::shared_ptr<cv::VideoCapture> _video_capture;
+    volatile int _bayer_code;
     volatile bool _init;
     volatile bool _stop;
 };
@@ -0,0 +1,395 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "frame_stack.hpp"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+#include <opencv2/highgui.hpp>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+static const char FRAME_STACK_MAGIC[8] = {'S', '3', 'D', 'S', 'T', 'A', 'C', 'K'};
+static const int FRAME_STACK_VERSION = 2;
+static const size_t FRAME_STACK_ALIGN = 4096;   //first frame on a page boundary
+static const size_t FRAME_ROW_ALIGN = 64;       //frames start on a cache line
+
+//fixed header, all fields little endian: 
+// magic[8] version frame_count width height projector_width projector_height images_per_bit directions phase_steps 
+// depth (int32, bits per frame pixel: 8 or 16) frame_offset frame_stride texture_offset (int64, texture_offset 0: no texture)
+struct FrameStackHeader
+{
+    int version;
+    int frame_count;
+    int width;
+    int height;
+    int projector_width;
+    int projector_height;
+    int images_per_bit;
+    int directions;
+    int phase_steps;
+    int depth;
+    int64_t frame_offset;
+    int64_t frame_stride;
+    int64_t texture_offset;
+};
+static const size_t FRAME_STACK_HEADER_BYTES = 8 + 10*sizeof(int32_t) + 3*sizeof(int64_t);
+
+static inline size_t align_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1)/alignment*alignment;
+}
+
+FrameStack::FrameStack() :
+    _data(NULL),
+    _file_size(0),
+#ifdef _WIN32
+    _file(INVALID_HANDLE_VALUE),
+    _mapping(NULL),
+#else
+    _file(-1),
+#endif
+    _frame_count(0),
+    _size(),
+    _depth(CV_8U),
+    _layout(),
+    _frame_offset(0),
+    _frame_stride(0),
+    _texture_offset(0)
+{
+}
+
+FrameStack::~FrameStack()
+{
+    close();
+}
+
+void FrameStack::close(void)
+{
+#ifdef _WIN32
+    if (_data)
+    {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping)
+    {
+        CloseHandle(_mapping);
+    }
+    if (_file!=INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(_file);
+    }
+    _file = INVALID_HANDLE_VALUE;
+    _mapping = NULL;
+#else
+    if (_data)
+    {
+        munmap(const_cast<unsigned char *>(_data), _file_size);
+    }
+    if (_file>=0)
+    {
+        ::close(_file);
+    }
+    _file = -1;
+#endif
+    _data = NULL;
+    _file_size = 0;
+    _frame_count = 0;
+    _size = cv::Size();
+    _depth = CV_8U;
+    _layout = Layout();
+    _frame_offset = 0;
+    _frame_stride = 0;
+    _texture_offset = 0;
+}
+
+bool FrameStack::open(const std::string & filename)
+{
+    close();
+
+    //map the whole file read only
+#ifdef _WIN32
+    _file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER file_size;
+    if (_file==INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &file_size) || file_size.QuadPart<static_cast<LONGLONG>(FRAME_STACK_HEADER_BYTES))
+    {   //error
+        close();
+        return false;
+    }
+    _file_size = static_cast<size_t>(file_size.QuadPart);
+    _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    _data = (_mapping ? static_cast<const unsigned char *>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0)) : NULL);
+#else
+    _file = ::open(filename.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if (_file<0 || fstat(_file, &file_stat)!=0 || file_stat.st_size<static_cast<off_t>(FRAME_STACK_HEADER_BYTES))
+    {   //error
+        close();
+        return false;
+    }
+    _file_size = static_cast<size_t>(file_stat.st_size);
+    void * data = mmap(NULL, _file_size, PROT_READ, MAP_SHARED, _file, 0);
+    _data = (data!=MAP_FAILED ? static_cast<const unsigned char *>(data) : NULL);
+#endif
+    if (!_data)
+    {   //error
+        std::cerr << "[FrameStack] Cannot map " << filename << std::endl;
+        close();
+        return false;
+    }
+
+    //header
+    FrameStackHeader header;
+    const unsigned char * p = _data + 8;
+    int32_t fields[10];
+    memcpy(fields, p, sizeof(fields));
+    p += sizeof(fields);
+    memcpy(&header.frame_offset, p, sizeof(int64_t));
+    memcpy(&header.frame_stride, p + sizeof(int64_t), sizeof(int64_t));
+    memcpy(&header.texture_offset, p + 2*sizeof(int64_t), sizeof(int64_t));
+    header.version = fields[0];
+    header.frame_count = fields[1];
+    header.width = fields[2];
+    header.height = fields[3];
+    header.projector_width = fields[4];
+    header.projector_height = fields[5];
+    header.images_per_bit = fields[6];
+    header.directions = fields[7];
+    header.phase_steps = fields[8];
+    header.depth = fields[9];
+
+    const size_t pixel_count = static_cast<size_t>(header.width)*static_cast<size_t>(header.height);
+    const size_t frame_bytes = pixel_count*(header.depth==16 ? 2 : 1);
+    if (memcmp(_data, FRAME_STACK_MAGIC, 8)!=0 || header.version!=FRAME_STACK_VERSION || (header.depth!=8 && header.depth!=16)
+        || header.frame_count<1 || header.width<1 || header.height<1 || header.projector_width<1 || header.projector_height<1
+        || header.frame_offset<static_cast<int64_t>(FRAME_STACK_HEADER_BYTES) || header.frame_stride<static_cast<int64_t>(frame_bytes)
+        || static_cast<size_t>(header.frame_offset)>_file_size   //frame count checked by division: stride*count may overflow
+        || static_cast<size_t>(header.frame_count)>(_file_size - static_cast<size_t>(header.frame_offset))/static_cast<size_t>(header.frame_stride)
+        || (header.texture_offset!=0 && (header.texture_offset<header.frame_offset || static_cast<size_t>(header.texture_offset) + 3*pixel_count>_file_size)))
+    {   //error
+        std::cerr << "[FrameStack] Invalid frame stack " << filename << std::endl;
+        close();
+        return false;
+    }
+
+    _frame_count = header.frame_count;
+    _size = cv::Size(header.width, header.height);
+    _depth = (header.depth==16 ? CV_16U : CV_8U);
+    _layout.projector_size = cv::Size(header.projector_width, header.projector_height);
+    _layout.images_per_bit = (header.images_per_bit==1 ? 1 : 2);
+    _layout.columns_only = (header.directions==1);
+    _layout.phase_steps = (header.phase_steps>0 && header.phase_steps<256 ? header.phase_steps : 0);
+    _frame_offset = static_cast<size_t>(header.frame_offset);
+    _frame_stride = static_cast<size_t>(header.frame_stride);
+    _texture_offset = static_cast<size_t>(header.texture_offset);
+
+    return true;
+}
+
+cv::Mat FrameStack::frame(unsigned index) const
+{
+    if (!_data || index>=_frame_count)
+    {   //out of bounds
+        return cv::Mat();
+    }
+    return cv::Mat(_size, CV_MAKETYPE(_depth, 1), const_cast<unsigned char *>(_data + _frame_offset + index*_frame_stride));
+}
+
+cv::Mat FrameStack::texture(void) const
+{
+    if (!_data || _texture_offset==0)
+    {   //no texture
+        return cv::Mat();
+    }
+    return cv::Mat(_size, CV_8UC3, const_cast<unsigned char *>(_data + _texture_offset));
+}
+
+static bool write_padding(FILE * fp, size_t count)
+{
+    static const char zeros[FRAME_STACK_ALIGN] = {0};
+    while (count>0)
+    {
+        size_t n = std::min(count, sizeof(zeros));
+        if (fwrite(zeros, 1, n, fp)!=n)
+        {
+            return false;
+        }
+        count -= n;
+    }
+    return true;
+}
+
+static bool write_rows(FILE * fp, cv::Mat const& image)
+{
+    size_t row_bytes = image.cols*image.elemSize();
+    for (int h=0; h<image.rows; h++)
+    {
+        if (fwrite(image.ptr(h), 1, row_bytes, fp)!=row_bytes)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FrameStack::write(const std::string & filename, const std::vector<std::string> & images, Layout const& layout, bool texture)
+{
+    if (images.empty())
+    {   //nothing to write
+        return false;
+    }
+
+    //the first image sets the size and depth: 16 bit images (12/16 bit cameras) are kept as they are
+    cv::Mat first = cv::imread(images.front(), cv::IMREAD_GRAYSCALE|cv::IMREAD_ANYDEPTH);
+    if (!first.data || (first.depth()!=CV_8U && first.depth()!=CV_16U))
+    {   //error
+        std::cerr << "[FrameStack] Cannot read " << images.front() << std::endl;
+        return false;
+    }
+    const cv::Size size = first.size();
+    const int depth = first.depth();
+    const size_t frame_bytes = static_cast<size_t>(size.width)*size.height*first.elemSize();
+    const int32_t frame_count = static_cast<int32_t>(images.size());
+    const int64_t frame_offset = static_cast<int64_t>(align_up(FRAME_STACK_HEADER_BYTES, FRAME_STACK_ALIGN));
+    const int64_t frame_stride = static_cast<int64_t>(align_up(frame_bytes, FRAME_ROW_ALIGN));
+    const int64_t texture_offset = (texture ? frame_offset + frame_stride*frame_count : 0);
+
+    //write to a temporary file first, a partial file is never opened as a valid stack
+    std::string tmp_filename = filename + ".tmp";
+    FILE * fp = fopen(tmp_filename.c_str(), "wb");
+    if (!fp)
+    {
+        return false;
+    }
+
+    //header
+    const int32_t fields[10] = {FRAME_STACK_VERSION, frame_count, size.width, size.height, 
+                                layout.projector_size.width, layout.projector_size.height, 
+                                static_cast<int32_t>(layout.images_per_bit), (layout.columns_only ? 1 : 2), static_cast<int32_t>(layout.phase_steps),
+                                (depth==CV_16U ? 16 : 8)};
+    bool ok = fwrite(FRAME_STACK_MAGIC, 1, 8, fp)==8
+            && fwrite(fields, sizeof(int32_t), 10, fp)==10
+            && fwrite(&frame_offset, sizeof(int64_t), 1, fp)==1
+            && fwrite(&frame_stride, sizeof(int64_t), 1, fp)==1
+            && fwrite(&texture_offset, sizeof(int64_t), 1, fp)==1
+            && write_padding(fp, static_cast<size_t>(frame_offset) - FRAME_STACK_HEADER_BYTES);
+
+    //frames
+    for (size_t i=0; i<images.size() && ok; i++)
+    {
+        cv::Mat image = (i==0 ? first : cv::imread(images[i], cv::IMREAD_GRAYSCALE|cv::IMREAD_ANYDEPTH));
+        if (image.size()!=size || image.depth()!=depth)
+        {   //error
+            std::cerr << "[FrameStack] Missing or different size or depth image " << images[i] << std::endl;
+            ok = false;
+            break;
+        }
+        ok = write_rows(fp, image) && write_padding(fp, static_cast<size_t>(frame_stride) - frame_bytes);
+    }
+
+    //texture
+    if (ok && texture)
+    {
+        cv::Mat color_image = cv::imread(images.front(), cv::IMREAD_COLOR);
+        ok = color_image.size()==size && write_rows(fp, color_image);
+    }
+
+    ok = (fclose(fp)==0) && ok;
+    if (!ok)
+    {
+        remove(tmp_filename.c_str());
+        return false;
+    }
+
+    remove(filename.c_str());
+    if (rename(tmp_filename.c_str(), filename.c_str())!=0)
+    {
+        remove(tmp_filename.c_str());
+        return false;
+    }
+
+    std::cerr << "[FrameStack] Saved " << frame_count << " frames (" << filename << ")" << std::endl;
+    return true;
+}
+
+std::string FrameStack::frame_name(const std::string & filename, unsigned index)
+{
+    return filename + "#" + std::to_string(index);
+}
+
+bool FrameStack::split_frame_name(const std::string & name, std::string & filename, unsigned & index)
+{
+    size_t pos = name.rfind('#');
+    if (pos==std::string::npos || pos+1>=name.size() || name.find_first_not_of("0123456789", pos+1)!=std::string::npos)
+    {   //not a frame name
+        return false;
+    }
+    filename = name.substr(0, pos);
+    index = static_cast<unsigned>(strtoul(name.c_str() + pos + 1, NULL, 10));
+    return true;
+}
+
+static std::mutex shared_mutex;
+static std::map<std::string, std::shared_ptr<FrameStack> > shared_stacks;
+
+std::shared_ptr<FrameStack> FrameStack::shared(const std::string & filename)
+{
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    std::map<std::string, std::shared_ptr<FrameStack> >::iterator iter = shared_stacks.find(filename);
+    if (iter!=shared_stacks.end())
+    {
+        return iter->second;
+    }
+
+    std::shared_ptr<FrameStack> stack(new FrameStack());
+    if (!stack->open(filename))
+    {   //invalid files are not remembered: they may be written later
+        return std::shared_ptr<FrameStack>();
+    }
+    shared_stacks[filename] = stack;
+    return stack;
+}
+
+void FrameStack::release_shared(void)
+{
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    shared_stacks.clear();
+}
@@ -0,0 +1,107 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __FRAME_STACK_HPP__
+#define __FRAME_STACK_HPP__
+
+#include <opencv2/core.hpp>
+
+#include <string>
+#include <vector>
+#include <memory>
+
+//file name of the frame stack of a set, next to (or instead of) the pattern images
+#define FRAME_STACK_FILENAME "frames.s3d"
+
+//all the images of a set in one file: a fixed header, then the gray frames uncompressed and contiguous
+//(8 bit, or 16 bit for 12/16 bit cameras), and optionally the 8 bit color image of the first frame (the texture). The file is memory mapped:
+//frames are cv::Mat headers on the mapped data, nothing is read or copied until the pixels are used.
+class FrameStack
+{
+public:
+    //pattern layout of the set, the same values as projector_info.txt
+    struct Layout
+    {
+        Layout() : projector_size(1024, 768), images_per_bit(2), columns_only(false), phase_steps(0) {}
+        cv::Size projector_size;
+        unsigned images_per_bit;
+        bool columns_only;
+        unsigned phase_steps;
+    };
+
+    FrameStack();
+    ~FrameStack();
+
+    bool open(const std::string & filename);
+    void close(void);
+
+    inline bool is_open(void) const {return _data!=NULL;}
+    inline unsigned frame_count(void) const {return _frame_count;}
+    inline cv::Size size(void) const {return _size;}
+    inline int depth(void) const {return _depth;}
+    inline Layout const& layout(void) const {return _layout;}
+
+    //CV_8UC1 or CV_16UC1 view on the mapped file, valid while the stack is open: do not modify
+    cv::Mat frame(unsigned index) const;
+    //CV_8UC3 view, empty if the stack has no texture
+    cv::Mat texture(void) const;
+
+    //converter: images are stored in the given order, all with the size and depth of the first one
+    static bool write(const std::string & filename, const std::vector<std::string> & images, Layout const& layout, bool texture = true);
+
+    //frame names "<stack filename>#<index>" are loaded by sl::get_gray_image() like image files
+    static std::string frame_name(const std::string & filename, unsigned index);
+    static bool split_frame_name(const std::string & name, std::string & filename, unsigned & index);
+
+    //stacks opened by name stay mapped until release_shared(), NULL if the file is not a valid stack
+    static std::shared_ptr<FrameStack> shared(const std::string & filename);
+    static void release_shared(void);
+
+private:
+    FrameStack(const FrameStack &);
+    FrameStack & operator=(const FrameStack &);
+
+    const unsigned char * _data;
+    size_t _file_size;
+#ifdef _WIN32
+    void * _file;
+    void * _mapping;
+#else
+    int _file;
+#endif
+
+    unsigned _frame_count;
+    cv::Size _size;
+    int _depth;     //CV_8U or CV_16U
+    Layout _layout;
+    size_t _frame_offset;
+    size_t _frame_stride;
+    size_t _texture_offset;
+};
+
+#endif  /* __FRAME_STACK_HPP__ */
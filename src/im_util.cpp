@@ -27,17 +27,20 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "im_util.hpp"
 
-cv::Mat im_util::rotate_image(cv::Mat const& image, size_t rotation)
+#include <opencv2/imgproc.hpp>
+
+template <typename T>
+static cv::Mat rotate_image_t(cv::Mat const& image, size_t rotation)
 {
   if (rotation==90)
   {
     cv::Mat outimg(image.cols, image.rows, image.type());
     for (int h2=0,w1=0; h2<outimg.rows; ++h2,++w1)
     {
-      cv::Vec3b * row2 = outimg.ptr<cv::Vec3b>(h2);
+      T * row2 = outimg.ptr<T>(h2);
       for (int w2=0,h1=image.rows-1; w2<outimg.cols; ++w2,--h1)
       {
-        row2[w2] = image.at<cv::Vec3b>(h1,w1);
+        row2[w2] = image.at<T>(h1,w1);
       }
     }
     return outimg;
@@ -47,8 +50,8 @@ cv::Mat im_util::rotate_image(cv::Mat const& image, size_t rotation)
     cv::Mat outimg(image.rows, image.cols, image.type());
     for (int h2=0,h1=image.rows-1; h2<outimg.rows; ++h2,--h1)
     {
-      const cv::Vec3b * row1 = image.ptr<cv::Vec3b>(h1);
-      cv::Vec3b * row2 = outimg.ptr<cv::Vec3b>(h2);
+      const T * row1 = image.ptr<T>(h1);
+      T * row2 = outimg.ptr<T>(h2);
       for (int w2=0,w1=0; w2<outimg.cols; ++w2,++w1)
       {
         row2[w2] = row1[w1];
@@ -61,13 +64,76 @@ cv::Mat im_util::rotate_image(cv::Mat const& image, size_t rotation)
     cv::Mat outimg(image.cols, image.rows, image.type());
     for (int h2=0,w1=image.cols-1; h2<outimg.rows; ++h2,--w1)
     {
-      cv::Vec3b * row2 = outimg.ptr<cv::Vec3b>(h2);
+      T * row2 = outimg.ptr<T>(h2);
       for (int w2=0,h1=0; w2<outimg.cols; ++w2,++h1)
       {
-        row2[w2] = image.at<cv::Vec3b>(h1,w1);
+        row2[w2] = image.at<T>(h1,w1);
       }
     }
     return outimg;
   }
   return image;
-}
\ No newline at end of file
+}
+cv::Mat im_util::rotate_image(cv::Mat const& image, size_t rotation)
+{
+  if (image.type()==CV_8UC1)
+  {   //gray frames (e.g. converted from raw Bayer)
+    return rotate_image_t<unsigned char>(image, rotation);
+  }
+  return rotate_image_t<cv::Vec3b>(image, rotation);
+}
+
+cv::Mat im_util::bayer_to_gray(cv::Mat const& raw, int bayer_code)
+{
+  //red site in the 2x2 cell: OpenCV names the pattern after the second row (RGGB is cv::COLOR_BayerBG2BGR)
+  int red_x = 0, red_y = 0;
+  switch (bayer_code)
+  {
+  case cv::COLOR_BayerBG2BGR: red_x = 0; red_y = 0; break;
+  case cv::COLOR_BayerGB2BGR: red_x = 1; red_y = 0; break;
+  case cv::COLOR_BayerRG2BGR: red_x = 1; red_y = 1; break;
+  case cv::COLOR_BayerGR2BGR: red_x = 0; red_y = 1; break;
+  default: return cv::Mat();
+  }
+  if (raw.type()!=CV_8UC1 || raw.rows<2 || raw.cols<2)
+  {
+    return cv::Mat();
+  }
+
+  //Y = 0.299R + 0.587G + 0.114B as cv::COLOR_BGR2GRAY, in 1/4096 units: 
+  //weights of the center, left+right, up+down, and corner sums of each site
+  const int R = 306, G = 601, B = 117;
+  const int red_site[4] = {4*R, G, G, B};
+  const int blue_site[4] = {4*B, G, G, R};
+  const int green_red_row[4] = {4*G, 2*R, 2*B, 0};
+  const int green_blue_row[4] = {4*G, 2*B, 2*R, 0};
+  const int * weights[2][2];  //[row parity][column parity]
+  weights[red_y][red_x] = red_site;
+  weights[red_y][1-red_x] = green_red_row;
+  weights[1-red_y][red_x] = green_blue_row;
+  weights[1-red_y][1-red_x] = blue_site;
+
+  //mirrored borders keep the mosaic phase
+  cv::Mat padded;
+  cv::copyMakeBorder(raw, padded, 1, 1, 1, 1, cv::BORDER_REFLECT_101);
+
+  cv::Mat gray(raw.size(), CV_8UC1);
+  cv::parallel_for_(cv::Range(0, raw.rows), [&](const cv::Range & range)
+  {
+    for (int h=range.start; h<range.end; h++)
+    {
+      const unsigned char * up = padded.ptr<unsigned char>(h) + 1;
+      const unsigned char * row = padded.ptr<unsigned char>(h+1) + 1;
+      const unsigned char * down = padded.ptr<unsigned char>(h+2) + 1;
+      unsigned char * gray_row = gray.ptr<unsigned char>(h);
+      for (int w=0; w<raw.cols; w++)
+      {
+        const int * k = weights[h&1][w&1];
+        int value = k[0]*row[w] + k[1]*(row[w-1] + row[w+1]) + k[2]*(up[w] + down[w]) 
+                    + k[3]*(up[w-1] + up[w+1] + down[w-1] + down[w+1]);
+        gray_row[w] = static_cast<unsigned char>((value + 2048)>>12);
+      }
+    }
+  });
+  return gray;
+}
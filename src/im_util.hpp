@@ -33,6 +33,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 namespace im_util
 {
 	cv::Mat rotate_image(cv::Mat const& image, size_t rotation);
+
+	//gray image straight from a raw Bayer frame (bayer_code: cv::COLOR_Bayer*2BGR), 
+	//same weights as cv::COLOR_BGR2GRAY without demosaicing to color first
+	cv::Mat bayer_to_gray(cv::Mat const& raw, int bayer_code);
 };
 
 #endif // __im_util_hpp__
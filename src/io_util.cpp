@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <iostream>
 #include <fstream>
+#include <cstring>
 #include <float.h>
 
 #if defined(_MSC_VER) && !defined(isnan)
@@ -254,3 +255,210 @@ bool io_util::write_ply(const std::string & filename, scan3d::Pointcloud const&
     std::cerr << "[write_ply] Saved " << points_index.size() << " points (" << filename << ")" << std::endl;
     return true;
 }
+
+static const char DECODE_CACHE_MAGIC[4] = {'S', 'L', 'D', 'C'};
+static const int DECODE_CACHE_VERSION = 5;
+
+static bool write_mat_rows(FILE * fp, cv::Mat const& image)
+{
+    size_t row_bytes = image.cols*image.elemSize();
+    for (int h=0; h<image.rows; h++)
+    {
+        if (fwrite(image.ptr(h), 1, row_bytes, fp)!=row_bytes)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool read_mat_rows(FILE * fp, cv::Mat & image)
+{
+    size_t row_bytes = image.cols*image.elemSize();
+    for (int h=0; h<image.rows; h++)
+    {
+        if (fread(image.ptr(h), 1, row_bytes, fp)!=row_bytes)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool io_util::write_decode_cache(const std::string & filename, const std::string & key, sl::CodeImage const& code_image, 
+                                 cv::Mat const& min_max_image, cv::Mat const& direct_light)
+{
+    if (code_image.empty() || (min_max_image.type()!=CV_8UC2 && min_max_image.type()!=CV_16UC2) || min_max_image.size()!=code_image.size()
+        || (direct_light.data && (direct_light.type()!=min_max_image.type() 
+                                    || direct_light.cols<code_image.roi().br().x || direct_light.rows<code_image.roi().br().y)))
+    {   //invalid data
+        return false;
+    }
+
+    //write to a temporary file first, a partial file is never read as a valid cache
+    std::string tmp_filename = filename + ".tmp";
+    FILE * fp = fopen(tmp_filename.c_str(), "wb");
+    if (!fp)
+    {
+        return false;
+    }
+
+    //header
+    int key_size = static_cast<int>(key.size());
+    int rows = code_image.codes.rows;
+    int cols = code_image.codes.cols;
+    int offset[2] = {code_image.offset.x, code_image.offset.y};
+    int direct_size[2] = {direct_light.cols, direct_light.rows};    //0x0: no direct light image
+    int depth = min_max_image.depth();     //of min/max and direct light images
+    int fractional = (code_image.fractional() ? 1 : 0);
+    bool has_direct_light = (direct_light.data!=NULL);
+    bool ok = fwrite(DECODE_CACHE_MAGIC, 1, 4, fp)==4
+            && fwrite(&DECODE_CACHE_VERSION, sizeof(int), 1, fp)==1
+            && fwrite(&key_size, sizeof(int), 1, fp)==1
+            && fwrite(key.data(), 1, key.size(), fp)==key.size()
+            && fwrite(&cols, sizeof(int), 1, fp)==1
+            && fwrite(&rows, sizeof(int), 1, fp)==1
+            && fwrite(offset, sizeof(int), 2, fp)==2
+            && fwrite(direct_size, sizeof(int), 2, fp)==2
+            && fwrite(&depth, sizeof(int), 1, fp)==1
+            && fwrite(&fractional, sizeof(int), 1, fp)==1;
+
+    //contents
+    ok = ok && write_mat_rows(fp, code_image.codes)
+            && write_mat_rows(fp, code_image.mask)
+            && (!fractional || write_mat_rows(fp, code_image.fraction))
+            && write_mat_rows(fp, min_max_image)
+            && (!has_direct_light || write_mat_rows(fp, direct_light));
+
+    ok = (fclose(fp)==0) && ok;
+    if (!ok)
+    {
+        remove(tmp_filename.c_str());
+        return false;
+    }
+
+    remove(filename.c_str());
+    if (rename(tmp_filename.c_str(), filename.c_str())!=0)
+    {
+        remove(tmp_filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool io_util::read_decode_cache(const std::string & filename, const std::string & key, sl::CodeImage & code_image, 
+                                cv::Mat & min_max_image, cv::Mat & direct_light)
+{
+    FILE * fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+    {   //no cache
+        return false;
+    }
+
+    //header
+    char magic[4];
+    int version = 0, key_size = 0, rows = 0, cols = 0, offset[2] = {0, 0}, direct_size[2] = {0, 0}, depth = -1, fractional = -1;
+    bool ok = fread(magic, 1, 4, fp)==4 && memcmp(magic, DECODE_CACHE_MAGIC, 4)==0
+            && fread(&version, sizeof(int), 1, fp)==1 && version==DECODE_CACHE_VERSION
+            && fread(&key_size, sizeof(int), 1, fp)==1 && key_size==static_cast<int>(key.size());
+    if (ok)
+    {
+        std::string file_key(key_size, '\0');
+        ok = fread(&file_key[0], 1, key_size, fp)==static_cast<size_t>(key_size) && file_key==key
+            && fread(&cols, sizeof(int), 1, fp)==1 && fread(&rows, sizeof(int), 1, fp)==1
+            && fread(offset, sizeof(int), 2, fp)==2 && fread(direct_size, sizeof(int), 2, fp)==2
+            && fread(&depth, sizeof(int), 1, fp)==1 && (depth==CV_8U || depth==CV_16U)
+            && fread(&fractional, sizeof(int), 1, fp)==1 && (fractional==0 || fractional==1)
+            && rows>0 && cols>0 && offset[0]>=0 && offset[1]>=0 && direct_size[0]>=0 && direct_size[1]>=0;
+    }
+
+    //contents
+    if (ok)
+    {
+        code_image.create(cv::Size(cols, rows), fractional==1);
+        code_image.offset = cv::Point(offset[0], offset[1]);
+        min_max_image.create(rows, cols, CV_MAKETYPE(depth, 2));
+        direct_light = cv::Mat();
+        bool has_direct_light = (direct_size[0]>0 && direct_size[1]>0);
+        if (has_direct_light)
+        {
+            direct_light.create(direct_size[1], direct_size[0], CV_MAKETYPE(depth, 2));
+        }
+        ok = read_mat_rows(fp, code_image.codes)
+            && read_mat_rows(fp, code_image.mask)
+            && (!code_image.fractional() || read_mat_rows(fp, code_image.fraction))
+            && read_mat_rows(fp, min_max_image)
+            && (!has_direct_light || read_mat_rows(fp, direct_light));
+    }
+
+    fclose(fp);
+
+    if (!ok)
+    {   //stale or damaged cache
+        code_image.release();
+        min_max_image = cv::Mat();
+        direct_light = cv::Mat();
+    }
+    return ok;
+}
+
+bool io_util::write_decode_stats(const std::string & filename, sl::DecodeStats const& stats)
+{
+    std::ofstream outfile;
+    outfile.open(filename.c_str(), std::ios::out);
+    if (!outfile.is_open())
+    {
+        std::cerr << "[write_decode_stats] Error: cannot open " << filename << std::endl;
+        return false;
+    }
+
+    outfile << "{\n";
+    outfile << "  \"image_size\": [" << stats.image_size.width << ", " << stats.image_size.height << "],\n";
+    outfile << "  \"roi\": [" << stats.roi.x << ", " << stats.roi.y << ", " << stats.roi.width << ", " << stats.roi.height << "],\n";
+    outfile << "  \"bits\": " << stats.bits << ",\n";
+    outfile << "  \"columns_only\": " << (stats.columns_only ? "true" : "false") << ",\n";
+    outfile << "  \"pixels\": " << static_cast<int64_t>(stats.roi.area()) << ",\n";
+    outfile << "  \"shadow_pixels\": " << stats.shadow_pixels << ",\n";
+    outfile << "  \"valid_pixels\": " << stats.valid_pixels << ",\n";
+
+    //stage times
+    outfile << "  \"timing_ms\": {\"total\": " << stats.total_ms << ", \"load\": " << stats.load_ms << ", \"load_wait\": " << stats.wait_ms
+            << ", \"direct_light\": " << stats.direct_light_ms << ", \"compare\": " << stats.compare_ms << ", \"assemble\": " << stats.assemble_ms
+            << ", \"gray_to_binary\": " << stats.convert_ms << ", \"phase\": " << stats.phase_ms << "},\n";
+    outfile << "  \"load_threads\": " << stats.load_threads << ",\n";
+
+    //bit planes in push order: vertical from the most significant bit, then horizontal
+    outfile << "  \"bit_planes\": [";
+    for (size_t i=0; i<stats.uncertain_pixels.size(); i++)
+    {
+        unsigned channel = (stats.bits>0 && i>=stats.bits ? 1 : 0);
+        unsigned bit = (stats.bits>0 ? stats.bits - 1 - static_cast<unsigned>(i%stats.bits) : 0);
+        outfile << (i>0 ? "," : "") << "\n    {\"direction\": \"" << (channel ? "horizontal" : "vertical") << "\", \"bit\": " << bit 
+                << ", \"uncertain_pixels\": " << stats.uncertain_pixels[i];
+        for (size_t j=0; j<stats.bit_stats.size(); j++)
+        {   //BitStatsDecode
+            if (stats.bit_stats[j].channel==channel && stats.bit_stats[j].bit==bit)
+            {
+                outfile << ", \"resolved\": " << stats.bit_stats[j].resolved << ", \"contrast\": " << stats.bit_stats[j].contrast;
+                break;
+            }
+        }
+        outfile << "}";
+    }
+    outfile << (stats.uncertain_pixels.empty() ? "" : "\n  ") << "],\n";
+
+    //white/black contrast
+    outfile << "  \"contrast_histogram\": [";
+    for (size_t i=0; i<stats.contrast_histogram.size(); i++)
+    {
+        outfile << (i>0 ? ", " : "") << stats.contrast_histogram[i];
+    }
+    outfile << "],\n";
+    outfile << "  \"contrast_bin_width\": " << stats.contrast_bin_width << "\n";
+    outfile << "}\n";
+
+    bool ok = outfile.good();
+    outfile.close();
+    return ok;
+}
@@ -43,6 +43,16 @@ namespace io_util
     QImage qImageFromGray(const cv::Mat & image);
 
     bool write_pgm(const cv::Mat & image, const char * basename);
+
+    //decoded set cache: the key describes the images and decode parameters, a different key is a cache miss
+    //direct_light may be empty (single image sets), it covers the whole image when only a region was decoded
+    bool write_decode_cache(const std::string & filename, const std::string & key, sl::CodeImage const& code_image, 
+                            cv::Mat const& min_max_image, cv::Mat const& direct_light);
+    bool read_decode_cache(const std::string & filename, const std::string & key, sl::CodeImage & code_image, 
+                           cv::Mat & min_max_image, cv::Mat & direct_light);
+
+    //decode report as JSON
+    bool write_decode_stats(const std::string & filename, sl::DecodeStats const& stats);
 };
 
 #endif  /* __IO_UTIL_HPP__ */
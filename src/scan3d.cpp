@@ -28,13 +28,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "scan3d.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/calib3d.hpp>
 
 #include <QApplication>
 #include <QProgressDialog>
-#include <QMap>
 
 #include "structured_light.hpp"
 
@@ -73,24 +75,76 @@ void scan3d::Pointcloud::init_normals(int rows, int cols)
     }
 }
 
+//camera image size covered by the ray table: the whole color image, or at least the decoded region
+static cv::Size camera_size(sl::CodeImage const& code_image, cv::Mat const& color_image)
+{
+    return cv::Size(std::max(color_image.cols, code_image.offset.x + code_image.codes.cols), 
+                    std::max(color_image.rows, code_image.offset.y + code_image.codes.rows));
+}
+
+//structure of arrays buffers for triangulate_batch, filled with push(), then triangulate() and read, then clear()
+class TriangulationBatch
+{
+public:
+    TriangulationBatch(size_t capacity) : 
+        _capacity(capacity), _size(0), 
+        _cam_uv(2*capacity), _proj_uv(2*capacity), _xyz(3*capacity), _dist(capacity)
+    {
+    }
+
+    inline void clear(void) {_size = 0;}
+    inline size_t size(void) const {return _size;}
+
+    inline void push(const cv::Vec2d & cam_ray, const cv::Vec2d & proj_ray)
+    {   //y coordinates go to the second half until triangulate() packs them
+        _cam_uv[_size] = cam_ray[0];
+        _cam_uv[_capacity + _size] = cam_ray[1];
+        _proj_uv[_size] = proj_ray[0];
+        _proj_uv[_capacity + _size] = proj_ray[1];
+        _size++;
+    }
+
+    void triangulate(const cv::Matx33d & Rt, const cv::Vec3d & T)
+    {
+        if (!_size)
+        {   //empty
+            return;
+        }
+        std::copy(_cam_uv.begin() + _capacity, _cam_uv.begin() + _capacity + _size, _cam_uv.begin() + _size);
+        std::copy(_proj_uv.begin() + _capacity, _proj_uv.begin() + _capacity + _size, _proj_uv.begin() + _size);
+        scan3d::triangulate_batch(&_cam_uv[0], &_proj_uv[0], _size, Rt.val, T.val, &_xyz[0], &_dist[0]);
+    }
+
+    inline cv::Point3d point(size_t i) const {return cv::Point3d(_xyz[i], _xyz[_size + i], _xyz[2*_size + i]);}
+    inline double distance(size_t i) const {return _dist[i];}
+
+private:
+    size_t _capacity;
+    size_t _size;
+    std::vector<double> _cam_uv;
+    std::vector<double> _proj_uv;
+    std::vector<double> _xyz;
+    std::vector<double> _dist;
+};
+
 void scan3d::reconstruct_model(Pointcloud & pointcloud, CalibrationData const& calib, 
-                                cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+                                sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
                                 cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget)
 {
-    reconstruct_model_patch_center(pointcloud, calib, pattern_image, min_max_image, color_image, projector_size, 
+    reconstruct_model_patch_center(pointcloud, calib, code_image, min_max_image, color_image, projector_size, 
                                     threshold, max_dist, parent_widget);
 }
 
 void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData const& calib, 
-                                cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+                                sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
                                 cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget)
 {
-    if (!pattern_image.data || pattern_image.type()!=CV_32FC2)
+    if (code_image.empty())
     {   //pattern not correctly decoded
         std::cerr << "[reconstruct_model] ERROR invalid pattern_image\n";
         return;
     }
-    if (!min_max_image.data || min_max_image.type()!=CV_8UC2)
+    if (!min_max_image.data || (min_max_image.type()!=CV_8UC2 && min_max_image.type()!=CV_16UC2) || min_max_image.size()!=code_image.size())
     {   //pattern not correctly decoded
         std::cerr << "[reconstruct_model] ERROR invalid min_max_image\n";
         return;
@@ -143,8 +197,8 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
 
     //init point cloud
     int scale_factor = 1;
-    int out_cols = pattern_image.cols/scale_factor;
-    int out_rows = pattern_image.rows/scale_factor;
+    int out_cols = code_image.codes.cols/scale_factor;
+    int out_rows = code_image.codes.rows/scale_factor;
     pointcloud.clear();
     pointcloud.init_points(out_rows, out_cols);
     pointcloud.init_color(out_rows, out_cols);
@@ -153,7 +207,7 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
     QProgressDialog * progress = NULL;
     if (parent_widget)
     {
-        progress = new QProgressDialog("Reconstruction in progress.", "Abort", 0, pattern_image.rows, parent_widget, 
+        progress = new QProgressDialog("Reconstruction in progress.", "Abort", 0, code_image.codes.rows, parent_widget, 
                                         Qt::Dialog|Qt::CustomizeWindowHint|Qt::WindowCloseButtonHint);
         progress->setWindowModality(Qt::WindowModal);
         progress->setWindowTitle("Processing");
@@ -207,13 +261,23 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
     }
     */
 
-    cv::Mat Rt = calib.R.t();
+    const cv::Matx33d Rt = cv::Matx33d(calib.R).t();
+    const cv::Vec3d T = calib.T;
+    const cv::Mat & cam_rays = calib.get_camera_rays(camera_size(code_image, color_image));
+    const cv::Mat & proj_rays = calib.get_projector_rays(projector_size);
+    const bool wide = (min_max_image.depth()==CV_16U);
+
+    //one image row per triangulation batch
+    TriangulationBatch batch(code_image.codes.cols);
+    std::vector<int> batch_columns(code_image.codes.cols);
+    double batch_ms = 0.0;
+    size_t batch_points = 0;
 
     unsigned good = 0;
     unsigned bad  = 0;
     unsigned invalid = 0;
     unsigned repeated = 0;
-    for (int h=0; h<pattern_image.rows; h+=scale_factor)
+    for (int h=0; h<code_image.codes.rows; h+=scale_factor)
     {
         if (progress && h%4==0)
         {
@@ -227,43 +291,61 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
             return;
         }
 
-        register const cv::Vec2f * curr_pattern_row = pattern_image.ptr<cv::Vec2f>(h);
-        register const cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
-        for (register int w=0; w<pattern_image.cols; w+=scale_factor)
+        register const cv::Vec2w * curr_codes_row = code_image.codes_row(h);
+        register const cv::Vec2b * fraction_row = code_image.fraction_row(h);
+        register const unsigned char * mask_row = code_image.mask_row(h);
+        register const unsigned char * min_max_row = min_max_image.ptr<unsigned char>(h);
+        const cv::Vec2d * cam_rays_row = cam_rays.ptr<cv::Vec2d>(h + code_image.offset.y) + code_image.offset.x;
+        batch.clear();
+        for (register int w=0; w<code_image.codes.cols; w+=scale_factor)
         {
-            double distance = max_dist;  //quality meassure
-            cv::Point3d p;               //reconstructed point
-            //cv::Point3d normal(0.0, 0.0, 0.0);
-
-            const cv::Vec2f & pattern = curr_pattern_row[w];
-            const cv::Vec2b & min_max = min_max_row[w];
+            const cv::Vec2w & code = curr_codes_row[w];
 
-            if (sl::INVALID(pattern) || pattern[0]<0.f || pattern[1]<0.f
-                || (min_max[1]-min_max[0])<static_cast<int>(threshold))
+            if (!sl::CodeImage::valid(mask_row, w) || sl::get_contrast(min_max_row, w, wide)<static_cast<int>(threshold))
             {   //skip
                 invalid++;
                 continue;
             }
 
-            const float col = pattern[0];
-            const float row = pattern[1];
+            const float col = code[0];
+            const float row = code[1];
 
             if (projector_size.width<=static_cast<int>(col) || projector_size.height<=static_cast<int>(row))
             {   //abort
                 continue;
             }
 
-            cv::Vec3f & cloud_point = pointcloud.points.at<cv::Vec3f>(h/scale_factor, w/scale_factor);
+            const cv::Vec3f & cloud_point = pointcloud.points.at<cv::Vec3f>(h/scale_factor, w/scale_factor);
             if (!sl::INVALID(cloud_point[0]))
             {   //point already reconstructed!
                 repeated++;
                 continue;
             }
 
-            //standard
-            cv::Point2d p1(w, h);
-            cv::Point2d p2(col, row);
-            triangulate_stereo(calib.cam_K, calib.cam_kc, calib.proj_K, calib.proj_kc, Rt, calib.T, p1, p2, p, &distance);
+            //standard: fractional codes (phase shift) interpolate the projector rays
+            batch_columns[batch.size()] = w;
+            if (fraction_row)
+            {
+                cv::Point2f proj = sl::CodeImage::code_point(curr_codes_row, fraction_row, w);
+                batch.push(cam_rays_row[w], CalibrationData::interpolate_ray(proj_rays, proj.x, proj.y));
+            }
+            else
+            {
+                batch.push(cam_rays_row[w], proj_rays.at<cv::Vec2d>(code[1], code[0]));
+            }
+        }   //for each column
+
+        std::chrono::steady_clock::time_point batch_start = std::chrono::steady_clock::now();
+        batch.triangulate(Rt, T);
+        batch_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batch_start).count();
+        batch_points += batch.size();
+
+        for (size_t i=0; i<batch.size(); i++)
+        {
+            const int w = batch_columns[i];
+            double distance = batch.distance(i);  //quality meassure
+            cv::Point3d p = batch.point(i);       //reconstructed point
+            //cv::Point3d normal(0.0, 0.0, 0.0);
 
             //save texture coordinates
             /*
@@ -285,6 +367,7 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
                 {   //object point, keep
                     good++;
 
+                    cv::Vec3f & cloud_point = pointcloud.points.at<cv::Vec3f>(h/scale_factor, w/scale_factor);
                     cloud_point[0] = p.x;
                     cloud_point[1] = p.y;
                     cloud_point[2] = p.z;
@@ -296,7 +379,7 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
 
                     if (color_image.data)
                     {
-                        const cv::Vec3b & vec = color_image.at<cv::Vec3b>(h, w);
+                        const cv::Vec3b & vec = color_image.at<cv::Vec3b>(h + code_image.offset.y, w + code_image.offset.x);
                         cv::Vec3b & cloud_color = pointcloud.colors.at<cv::Vec3b>(h/scale_factor, w/scale_factor);
                         cloud_color[0] = vec[0];
                         cloud_color[1] = vec[1];
@@ -309,31 +392,33 @@ void scan3d::reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData c
                 bad++;
                 //std::cout << " d = " << distance << std::endl;
             }
-        }   //for each column
+        }   //for each triangulated point
     }   //for each row
 
     if (progress)
     {
-        progress->setValue(pattern_image.rows);
+        progress->setValue(code_image.codes.rows);
         progress->close();
         delete progress;
         progress = NULL;
     }
 
     std::cout << "Reconstructed points[simple]: " << good << " (" << bad << " skipped, " << invalid << " invalid) " << std::endl
-                << " - repeated points: " << repeated << " (ignored) " << std::endl;
+                << " - repeated points: " << repeated << " (ignored) " << std::endl
+                << " - triangulation: " << batch_points << " points in " << batch_ms << " ms (" 
+                << (batch_ms>0.0 ? 1000.0*batch_points/batch_ms : 0.0) << " points/s)" << std::endl;
 }
 
 void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, CalibrationData const& calib, 
-                                cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+                                sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
                                 cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget)
 {
-    if (!pattern_image.data || pattern_image.type()!=CV_32FC2)
+    if (code_image.empty())
     {   //pattern not correctly decoded
         std::cerr << "[reconstruct_model] ERROR invalid pattern_image\n";
         return;
     }
-    if (!min_max_image.data || min_max_image.type()!=CV_8UC2)
+    if (!min_max_image.data || (min_max_image.type()!=CV_8UC2 && min_max_image.type()!=CV_16UC2) || min_max_image.size()!=code_image.size())
     {   //pattern not correctly decoded
         std::cerr << "[reconstruct_model] ERROR invalid min_max_image\n";
         return;
@@ -397,7 +482,7 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
     QProgressDialog * progress = NULL;
     if (parent_widget)
     {
-        progress = new QProgressDialog("Reconstruction in progress.", "Abort", 0, pattern_image.rows, parent_widget, 
+        progress = new QProgressDialog("Reconstruction in progress.", "Abort", 0, code_image.codes.rows, parent_widget, 
                                         Qt::Dialog|Qt::CustomizeWindowHint|Qt::WindowCloseButtonHint);
         progress->setWindowModality(Qt::WindowModal);
         progress->setWindowTitle("Processing");
@@ -452,21 +537,37 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
     }
     */
 
-    //candidate points
-    QMap<unsigned, cv::Point2f> proj_points;
-    QMap<unsigned, std::vector<cv::Point2f> > cam_points;
-
-    //cv::Mat proj_image = cv::Mat::zeros(out_rows, out_cols, CV_8UC3);
+    //candidate points: camera pixels bucketed by projector pixel in a flat (CSR) layout built in two passes,
+    //bucket i holds cam_points[bucket_start[i]] to cam_points[bucket_start[i+1]-1] in camera scan order
+    const bool wide = (min_max_image.depth()==CV_16U);
+    const size_t bucket_count = static_cast<size_t>(out_rows)*out_cols;
+    auto bucket_index = [&](const cv::Vec2w * codes_row, const unsigned char * mask_row, const unsigned char * min_max_row, int w) -> int64_t
+    {
+        const cv::Vec2w & code = codes_row[w];
+        if (!sl::CodeImage::valid(mask_row, w)
+            || code[0]>=projector_size.width || code[1]>=projector_size.height
+            || sl::get_contrast(min_max_row, w, wide)<static_cast<int>(threshold))
+        {   //skip
+            return -1;
+        }
+        unsigned x = static_cast<unsigned>(static_cast<float>(code[0])/scale_factor_x);
+        unsigned y = static_cast<unsigned>(static_cast<float>(code[1])/scale_factor_y);
+        return (x<static_cast<unsigned>(out_cols) && y<static_cast<unsigned>(out_rows) ? static_cast<int64_t>(y)*out_cols + x : -1);
+    };
 
     unsigned good = 0;
     unsigned bad  = 0;
     unsigned invalid = 0;
     unsigned repeated = 0;
-    for (int h=0; h<pattern_image.rows; h++)
+
+    //first pass: bucket sizes
+    std::chrono::steady_clock::time_point collect_start = std::chrono::steady_clock::now();
+    std::vector<unsigned> bucket_start(bucket_count + 1, 0);
+    for (int h=0; h<code_image.codes.rows; h++)
     {
-        if (progress && h%4==0)
+        if (progress && h%8==0)
         {
-            progress->setValue(h);
+            progress->setValue(h/2);
             progress->setLabelText(QString("Reconstruction in progress: collecting points"));
             QApplication::instance()->processEvents();
         }
@@ -476,48 +577,141 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
             return;
         }
 
-        register const cv::Vec2f * curr_pattern_row = pattern_image.ptr<cv::Vec2f>(h);
-        register const cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
-        for (register int w=0; w<pattern_image.cols; w++)
+        const cv::Vec2w * codes_row = code_image.codes_row(h);
+        const unsigned char * mask_row = code_image.mask_row(h);
+        const unsigned char * min_max_row = min_max_image.ptr<unsigned char>(h);
+        for (int w=0; w<code_image.codes.cols; w++)
         {
-            const cv::Vec2f & pattern = curr_pattern_row[w];
-            const cv::Vec2b & min_max = min_max_row[w];
-
-            if (sl::INVALID(pattern) 
-                || pattern[0]<0.f || pattern[0]>=projector_size.width || pattern[1]<0.f || pattern[1]>=projector_size.height
-                || (min_max[1]-min_max[0])<static_cast<int>(threshold))
-            {   //skip
-                continue;
+            int64_t index = bucket_index(codes_row, mask_row, min_max_row, w);
+            if (index>=0)
+            {
+                bucket_start[index + 1]++;
             }
+        }
+    }
+    size_t buckets_used = 0;
+    for (size_t i=0; i<bucket_count; i++)
+    {
+        buckets_used += (bucket_start[i + 1]>0 ? 1 : 0);
+        bucket_start[i + 1] += bucket_start[i];
+    }
 
-            //ok
-            cv::Point2f proj_point(pattern[0]/scale_factor_x, pattern[1]/scale_factor_y);
-            unsigned index = static_cast<unsigned>(proj_point.y)*out_cols + static_cast<unsigned>(proj_point.x);
-            proj_points.insert(index, proj_point);
-            cam_points[index].push_back(cv::Point2f(w, h));
+    //second pass: camera points in scan order
+    std::vector<cv::Point2f> cam_points(bucket_start[bucket_count]);
+    std::vector<unsigned> bucket_end(bucket_start.begin(), bucket_start.end() - 1);
+    for (int h=0; h<code_image.codes.rows; h++)
+    {
+        if (progress && h%8==0)
+        {
+            progress->setValue((code_image.codes.rows + h)/2);
+            QApplication::instance()->processEvents();
+        }
+        if (progress && progress->wasCanceled())
+        {   //abort
+            pointcloud.clear();
+            return;
+        }
 
-            //proj_image.at<cv::Vec3b>(static_cast<unsigned>(proj_point.y), static_cast<unsigned>(proj_point.x)) = color_image.at<cv::Vec3b>(h, w);
+        const cv::Vec2w * codes_row = code_image.codes_row(h);
+        const unsigned char * mask_row = code_image.mask_row(h);
+        const unsigned char * min_max_row = min_max_image.ptr<unsigned char>(h);
+        for (int w=0; w<code_image.codes.cols; w++)
+        {
+            int64_t index = bucket_index(codes_row, mask_row, min_max_row, w);
+            if (index>=0)
+            {
+                cam_points[bucket_end[index]++] = cv::Point2f(w + code_image.offset.x, h + code_image.offset.y);
+            }
         }
     }
-
-    //cv::imwrite("proj_image.png", proj_image);
+    bucket_end.clear();
+    double collect_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - collect_start).count();
     
     if (progress)
     {
-        progress->setValue(pattern_image.rows);
+        progress->setValue(code_image.codes.rows);
     }
 
-    cv::Mat Rt = calib.R.t();
+    const cv::Matx33d Rt = cv::Matx33d(calib.R).t();
+    const cv::Vec3d T = calib.T;
+    const cv::Mat & cam_rays = calib.get_camera_rays(camera_size(code_image, color_image));
+    const cv::Mat & proj_rays = calib.get_projector_rays(projector_size);
+    const bool fractional = code_image.fractional();
 
     if (progress)
     {
-        progress->setMaximum(proj_points.size());
+        progress->setMaximum(static_cast<int>(buckets_used));
     }
 
-    QMapIterator<unsigned, cv::Point2f> iter1(proj_points);
+    //triangulation in fixed size batches: cloud pixel and camera center of each batch point
+    const size_t batch_capacity = 4096;
+    TriangulationBatch batch(batch_capacity);
+    std::vector<cv::Point2f> batch_proj(batch_capacity);
+    std::vector<cv::Point2d> batch_cam(batch_capacity);
+    double batch_ms = 0.0;
+    size_t batch_points = 0;
+    auto triangulate_batch_points = [&]()
+    {
+        std::chrono::steady_clock::time_point batch_start = std::chrono::steady_clock::now();
+        batch.triangulate(Rt, T);
+        batch_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batch_start).count();
+        batch_points += batch.size();
+
+        for (size_t i=0; i<batch.size(); i++)
+        {
+            const cv::Point2f & proj_point = batch_proj[i];
+            const cv::Point2d & cam = batch_cam[i];
+            double distance = batch.distance(i);  //quality meassure
+            cv::Point3d p = batch.point(i);       //reconstructed point
+
+            if (distance < max_dist)
+            {   //good point
+
+                //evaluate the plane
+                double d = plane_dist+1;
+                /*if (remove_background)
+                {
+                    d = cv::Mat(plane.rowRange(0,3).t()*cv::Mat(p) + plane.at<double>(3,0)).at<double>(0,0);
+                }*/
+                if (d>plane_dist)
+                {   //object point, keep
+                    good++;
+
+                    cv::Vec3f & cloud_point = pointcloud.points.at<cv::Vec3f>(proj_point.y, proj_point.x);
+                    cloud_point[0] = p.x;
+                    cloud_point[1] = p.y;
+                    cloud_point[2] = p.z;
+
+                    if (color_image.data)
+                    {
+                        const cv::Vec3b & vec = color_image.at<cv::Vec3b>(static_cast<unsigned>(cam.y), static_cast<unsigned>(cam.x));
+                        cv::Vec3b & cloud_color = pointcloud.colors.at<cv::Vec3b>(proj_point.y, proj_point.x);
+                        cloud_color[0] = vec[0];
+                        cloud_color[1] = vec[1];
+                        cloud_color[2] = vec[2];
+                    }
+                }
+            }
+            else
+            {   //skip
+                bad++;
+                //std::cout << " d = " << distance << std::endl;
+            }
+        }
+        batch.clear();
+    };
+
+    std::chrono::steady_clock::time_point triangulate_start = std::chrono::steady_clock::now();
     unsigned n = 0;
-    while (iter1.hasNext()) 
+    for (size_t index=0; index<bucket_count; index++)
     {
+        const unsigned first = bucket_start[index];
+        const unsigned count = bucket_start[index + 1] - first;
+        if (!count)
+        {   //empty bucket
+            continue;
+        }
+
         n++;
         if (progress && n%1000==0)
         {
@@ -531,79 +725,204 @@ void scan3d::reconstruct_model_patch_center(Pointcloud & pointcloud, Calibration
             return;
         }
 
-        iter1.next();
-        unsigned index = iter1.key();
-        const cv::Point2f & proj_point = iter1.value();
-        const std::vector<cv::Point2f> & cam_point_list = cam_points.value(index);
-        const unsigned count = static_cast<int>(cam_point_list.size());
+        //projector point of the last camera pixel in the bucket
+        const cv::Point2f & last = cam_points[first + count - 1];
+        const cv::Vec2w & code = code_image.codes_row(static_cast<int>(last.y) - code_image.offset.y)[static_cast<int>(last.x) - code_image.offset.x];
+        cv::Point2f proj_point(static_cast<float>(code[0])/scale_factor_x, static_cast<float>(code[1])/scale_factor_y);
 
-        if (!count)
-        {   //empty list
-            continue;
+        //center average: camera pixels, and their projector codes when these are fractional
+        cv::Point2d sum(0.0, 0.0), proj_sum(0.0, 0.0);
+        for (unsigned i=first; i<first+count; i++)
+        {
+            sum.x += cam_points[i].x;
+            sum.y += cam_points[i].y;
+            if (fractional)
+            {
+                cv::Point2f proj = code_image.code_point(static_cast<int>(cam_points[i].y) - code_image.offset.y, 
+                                                         static_cast<int>(cam_points[i].x) - code_image.offset.x);
+                proj_sum.x += proj.x;
+                proj_sum.y += proj.y;
+            }
         }
+        cv::Point2d cam(sum.x/count, sum.y/count);
 
-        //center average
-        cv::Point2d sum(0.0, 0.0), sum2(0.0, 0.0);
-        for (std::vector<cv::Point2f>::const_iterator iter2=cam_point_list.begin(); iter2!=cam_point_list.end(); iter2++)
+        //the camera center is fractional, the projector point is a table pixel or the fractional code center
+        batch_proj[batch.size()] = proj_point;
+        batch_cam[batch.size()] = cam;
+        if (fractional)
         {
-            sum.x += iter2->x;
-            sum.y += iter2->y;
-            sum2.x += (iter2->x)*(iter2->x);
-            sum2.y += (iter2->y)*(iter2->y);
+            batch.push(CalibrationData::interpolate_ray(cam_rays, cam.x, cam.y), 
+                       CalibrationData::interpolate_ray(proj_rays, proj_sum.x/count, proj_sum.y/count));
         }
-        cv::Point2d cam(sum.x/count, sum.y/count);
-        cv::Point2d proj(proj_point.x*scale_factor_x, proj_point.y*scale_factor_y);
+        else
+        {
+            batch.push(CalibrationData::interpolate_ray(cam_rays, cam.x, cam.y), proj_rays.at<cv::Vec2d>(code[1], code[0]));
+        }
+        if (batch.size()==batch_capacity)
+        {
+            triangulate_batch_points();
+        }
+    }   //for each projector pixel
+    triangulate_batch_points();
 
-        //triangulate
-        double distance = max_dist;  //quality meassure
-        cv::Point3d p;          //reconstructed point
-        triangulate_stereo(calib.cam_K, calib.cam_kc, calib.proj_K, calib.proj_kc, Rt, calib.T, cam, proj, p, &distance);
+    double triangulate_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - triangulate_start).count();
 
-        if (distance < max_dist)
-        {   //good point
+    if (progress)
+    {
+        progress->setValue(static_cast<int>(buckets_used));
+        progress->close();
+        delete progress;
+        progress = NULL;
+    }
 
-            //evaluate the plane
-            double d = plane_dist+1;
-            /*if (remove_background)
-            {
-                d = cv::Mat(plane.rowRange(0,3).t()*cv::Mat(p) + plane.at<double>(3,0)).at<double>(0,0);
-            }*/
-            if (d>plane_dist)
-            {   //object point, keep
-                good++;
-
-                cv::Vec3f & cloud_point = pointcloud.points.at<cv::Vec3f>(proj_point.y, proj_point.x);
-                cloud_point[0] = p.x;
-                cloud_point[1] = p.y;
-                cloud_point[2] = p.z;
-
-                if (color_image.data)
-                {
-                    const cv::Vec3b & vec = color_image.at<cv::Vec3b>(static_cast<unsigned>(cam.y), static_cast<unsigned>(cam.x));
-                    cv::Vec3b & cloud_color = pointcloud.colors.at<cv::Vec3b>(proj_point.y, proj_point.x);
-                    cloud_color[0] = vec[0];
-                    cloud_color[1] = vec[1];
-                    cloud_color[2] = vec[2];
-                }
-            }
+    std::cout << "Reconstructed points [patch center]: " << good << " (" << bad << " skipped, " << invalid << " invalid) " << std::endl
+                << " - repeated points: " << repeated << " (ignored) " << std::endl
+                << " - timing: collect " << collect_ms << " ms (" << cam_points.size() << " camera points, " << buckets_used 
+                << " projector pixels), triangulate " << triangulate_ms << " ms" << std::endl
+                << " - triangulation: " << batch_points << " points in " << batch_ms << " ms (" 
+                << (batch_ms>0.0 ? 1000.0*batch_points/batch_ms : 0.0) << " points/s)" << std::endl;
+}
+
+void scan3d::reconstruct_model_columns(Pointcloud & pointcloud, CalibrationData const& calib, 
+                                sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+                                cv::Size const& projector_size, int threshold, QWidget * parent_widget)
+{
+    if (code_image.empty())
+    {   //pattern not correctly decoded
+        std::cerr << "[reconstruct_model] ERROR invalid pattern_image\n";
+        return;
+    }
+    if (!min_max_image.data || (min_max_image.type()!=CV_8UC2 && min_max_image.type()!=CV_16UC2) || min_max_image.size()!=code_image.size())
+    {   //pattern not correctly decoded
+        std::cerr << "[reconstruct_model] ERROR invalid min_max_image\n";
+        return;
+    }
+    if (color_image.data && color_image.type()!=CV_8UC3)
+    {   //not standard RGB image
+        std::cerr << "[reconstruct_model] ERROR invalid color_image\n";
+        return;
+    }
+    if (!calib.is_valid() || projector_size.width<1 || projector_size.height<2)
+    {   //invalid calibration
+        return;
+    }
+
+    cv::Mat Rt = calib.R.t();
+
+    //projector center in camera coordinates
+    cv::Point3d center = cv::Point3d(cv::Mat(-Rt*calib.T));
+
+    //column planes: through the projector center and the top and bottom pixels of each column
+    int cols = projector_size.width;
+    const cv::Mat & proj_rays = calib.get_projector_rays(projector_size);
+    const cv::Vec2d * top_rays = proj_rays.ptr<cv::Vec2d>(0);
+    const cv::Vec2d * bottom_rays = proj_rays.ptr<cv::Vec2d>(projector_size.height - 1);
+    std::vector<cv::Point3d> plane_normals(cols);
+    std::vector<double> plane_offsets(cols);
+    for (int c=0; c<cols; c++)
+    {
+        const cv::Vec2d & top = top_rays[c];
+        const cv::Vec2d & bottom = bottom_rays[c];
+        cv::Point3d v_top = cv::Point3d(cv::Mat(Rt*cv::Mat(cv::Point3d(top[0], top[1], 1.0))));
+        cv::Point3d v_bottom = cv::Point3d(cv::Mat(Rt*cv::Mat(cv::Point3d(bottom[0], bottom[1], 1.0))));
+        cv::Point3d n = v_top.cross(v_bottom);
+        n *= 1.0/cv::norm(n);
+        plane_normals[c] = n;
+        plane_offsets[c] = n.dot(center);   //plane: n.p = offset
+    }
+
+    //camera rays
+    const cv::Mat & cam_rays = calib.get_camera_rays(camera_size(code_image, color_image));
+
+    pointcloud.clear();
+    pointcloud.init_points(code_image.codes.rows, code_image.codes.cols);
+    pointcloud.init_color(code_image.codes.rows, code_image.codes.cols);
+
+    //progress
+    QProgressDialog * progress = NULL;
+    if (parent_widget)
+    {
+        progress = new QProgressDialog("Reconstruction in progress.", "Abort", 0, code_image.codes.rows, parent_widget, 
+                                        Qt::Dialog|Qt::CustomizeWindowHint|Qt::WindowCloseButtonHint);
+        progress->setWindowModality(Qt::WindowModal);
+        progress->setWindowTitle("Processing");
+        progress->setMinimumWidth(400);
+    }
+
+    const double min_cos = 1e-3;   //rays almost parallel to the plane are skipped
+    const bool wide = (min_max_image.depth()==CV_16U);
+    unsigned good = 0;
+    unsigned bad  = 0;
+    unsigned invalid = 0;
+    for (int h=0; h<code_image.codes.rows; h++)
+    {
+        if (progress && h%4==0)
+        {
+            progress->setValue(h);
+            progress->setLabelText(QString("Reconstruction in progress: %1 good points/%2 bad points").arg(good).arg(bad));
+            QApplication::instance()->processEvents();
         }
-        else
-        {   //skip
-            bad++;
-            //std::cout << " d = " << distance << std::endl;
+        if (progress && progress->wasCanceled())
+        {   //abort
+            pointcloud.clear();
+            return;
         }
-    }   //while
+
+        const cv::Vec2d * rays_row = cam_rays.ptr<cv::Vec2d>(h + code_image.offset.y) + code_image.offset.x;
+
+        const cv::Vec2w * codes_row = code_image.codes_row(h);
+        const cv::Vec2b * fraction_row = code_image.fraction_row(h);
+        const unsigned char * mask_row = code_image.mask_row(h);
+        const unsigned char * min_max_row = min_max_image.ptr<unsigned char>(h);
+        cv::Vec3f * points_row = pointcloud.points.ptr<cv::Vec3f>(h);
+        for (int w=0; w<code_image.codes.cols; w++)
+        {
+            if (!sl::CodeImage::valid(mask_row, w) || codes_row[w][0]>=cols || sl::get_contrast(min_max_row, w, wide)<threshold)
+            {   //skip
+                invalid++;
+                continue;
+            }
+
+            //column plane: fractional codes (phase shift) interpolate the planes of the two nearest columns
+            const int c = codes_row[w][0];
+            cv::Point3d n = plane_normals[c];
+            double offset = plane_offsets[c];
+            if (fraction_row && fraction_row[w][0] && c + 1<cols)
+            {
+                const double f = fraction_row[w][0]/static_cast<double>(sl::CodeImage::FRACTION_SCALE);
+                n = (1.0 - f)*plane_normals[c] + f*plane_normals[c + 1];
+                n *= 1.0/cv::norm(n);
+                offset = n.dot(center);
+            }
+
+            //intersect the ray p=lambda*v with the column plane
+            cv::Point3d v(rays_row[w][0], rays_row[w][1], 1.0);
+            double nv = n.dot(v);
+            double lambda = (std::fabs(nv)>min_cos*cv::norm(v) ? offset/nv : -1.0);
+            if (lambda<=0.0)
+            {   //behind the camera or parallel to the plane
+                bad++;
+                continue;
+            }
+
+            good++;
+            points_row[w] = cv::Vec3f(lambda*v.x, lambda*v.y, lambda*v.z);
+            if (color_image.data)
+            {
+                pointcloud.colors.at<cv::Vec3b>(h, w) = color_image.at<cv::Vec3b>(h + code_image.offset.y, w + code_image.offset.x);
+            }
+        }   //for each column
+    }   //for each row
 
     if (progress)
     {
-        progress->setValue(proj_points.size());
+        progress->setValue(code_image.codes.rows);
         progress->close();
         delete progress;
         progress = NULL;
     }
 
-    std::cout << "Reconstructed points [patch center]: " << good << " (" << bad << " skipped, " << invalid << " invalid) " << std::endl
-                << " - repeated points: " << repeated << " (ignored) " << std::endl;
+    std::cout << "Reconstructed points [columns]: " << good << " (" << bad << " skipped, " << invalid << " invalid) " << std::endl;
 }
 
 void scan3d::triangulate_stereo(const cv::Mat & K1, const cv::Mat & kc1, const cv::Mat & K2, const cv::Mat & kc2, 
@@ -621,32 +940,118 @@ void scan3d::triangulate_stereo(const cv::Mat & K1, const cv::Mat & kc1, const c
     assert(outp2.type()==CV_64FC2 && outp2.rows==1 && outp2.cols==1);
     const cv::Vec2d & outvec1 = outp1.at<cv::Vec2d>(0,0);
     const cv::Vec2d & outvec2 = outp2.at<cv::Vec2d>(0,0);
-    cv::Point3d u1(outvec1[0], outvec1[1], 1.0);
-    cv::Point3d u2(outvec2[0], outvec2[1], 1.0);
 
-    //to world coordinates
-    cv::Point3d w1 = u1;
-    cv::Point3d w2 = cv::Point3d(cv::Mat(Rt*(cv::Mat(u2) - T)));
+    triangulate_rays(cv::Point2d(outvec1[0], outvec1[1]), cv::Point2d(outvec2[0], outvec2[1]), cv::Matx33d(Rt), cv::Vec3d(T), p3d, distance);
+}
 
-    //world rays
-    cv::Point3d v1 = w1;
-    cv::Point3d v2 = cv::Point3d(cv::Mat(Rt*cv::Mat(u2)));
+void scan3d::triangulate_rays(const cv::Point2d & u1, const cv::Point2d & u2, const cv::Matx33d & Rt, const cv::Vec3d & T, 
+                                cv::Point3d & p3d, double * distance)
+{
+    double cam_uv[2] = {u1.x, u1.y};
+    double proj_uv[2] = {u2.x, u2.y};
+    double xyz[3];
+    double dist;
+    triangulate_batch(cam_uv, proj_uv, 1, Rt.val, T.val, xyz, &dist);
 
-    //compute ray-ray approximate intersection
-    p3d = approximate_ray_intersection(v1, w1, v2, w2, distance);
+    p3d = cv::Point3d(xyz[0], xyz[1], xyz[2]);
+    if (distance!=NULL)
+    {
+        *distance = dist;
+    }
+}
+
+//approximate_ray_intersection() of camera rays v1=(x1, y1, 1) through the origin and projector rays 
+//v2=Rt*(x2, y2, 1) through the projector center c=-Rt*T, branch free iterations so the loop vectorizes
+template <typename Real, bool DISTANCE>
+static void triangulate_batch_soa(const Real * cam_uv, const Real * proj_uv, size_t n, const Real * Rt, const Real * T, 
+                                    Real * xyz, Real * dist)
+{
+    const Real r00 = Rt[0], r01 = Rt[1], r02 = Rt[2];
+    const Real r10 = Rt[3], r11 = Rt[4], r12 = Rt[5];
+    const Real r20 = Rt[6], r21 = Rt[7], r22 = Rt[8];
+    const Real cx = -(r00*T[0] + r01*T[1] + r02*T[2]);
+    const Real cy = -(r10*T[0] + r11*T[1] + r12*T[2]);
+    const Real cz = -(r20*T[0] + r21*T[1] + r22*T[2]);
+    const Real half = static_cast<Real>(0.5);
+
+    const Real * __restrict x1 = cam_uv;
+    const Real * __restrict y1 = cam_uv + n;
+    const Real * __restrict x2 = proj_uv;
+    const Real * __restrict y2 = proj_uv + n;
+    Real * __restrict px = xyz;
+    Real * __restrict py = xyz + n;
+    Real * __restrict pz = xyz + 2*n;
+    Real * __restrict d = dist;
+
+    for (size_t i=0; i<n; i++)
+    {
+        const Real v1x = x1[i];
+        const Real v1y = y1[i];
+        const Real v2x = r00*x2[i] + r01*y2[i] + r02;
+        const Real v2y = r10*x2[i] + r11*y2[i] + r12;
+        const Real v2z = r20*x2[i] + r21*y2[i] + r22;
+
+        //q2-q1 with q1=v1 and q2=v2+c
+        const Real dx = v2x + cx - v1x;
+        const Real dy = v2y + cy - v1y;
+        const Real dz = v2z + cz - 1;
+
+        const Real v1tv1 = v1x*v1x + v1y*v1y + 1;
+        const Real v2tv2 = v2x*v2x + v2y*v2y + v2z*v2z;
+        const Real v1tv2 = v1x*v2x + v1y*v2y + v2z;
+        const Real Q1 = v1x*dx + v1y*dy + dz;
+        const Real Q2 = -(v2x*dx + v2y*dy + v2z*dz);
+
+        const Real detV = v1tv1*v2tv2 - v1tv2*v1tv2;
+        const Real lambda1 = (v2tv2*Q1 + v1tv2*Q2)/detV;
+        const Real lambda2 = (v1tv2*Q1 + v1tv1*Q2)/detV;
+
+        //closest points p1=(lambda1+1)*v1 and p2=(lambda2+1)*v2+c
+        const Real p1x = (lambda1 + 1)*v1x;
+        const Real p1y = (lambda1 + 1)*v1y;
+        const Real p1z = (lambda1 + 1);
+        const Real p2x = (lambda2 + 1)*v2x + cx;
+        const Real p2y = (lambda2 + 1)*v2y + cy;
+        const Real p2z = (lambda2 + 1)*v2z + cz;
+
+        px[i] = half*(p1x + p2x);
+        py[i] = half*(p1y + p2y);
+        pz[i] = half*(p1z + p2z);
+        if (DISTANCE)
+        {
+            d[i] = (p2x - p1x)*(p2x - p1x) + (p2y - p1y)*(p2y - p1y) + (p2z - p1z)*(p2z - p1z);
+        }
+    }
+
+    //square roots in their own loop: std::sqrt may set errno, which keeps the loop above from vectorizing
+    for (size_t i=0; DISTANCE && i<n; i++)
+    {
+        d[i] = std::sqrt(d[i]);
+    }
+}
+
+void scan3d::triangulate_batch(const float * cam_uv, const float * proj_uv, size_t n, const float * Rt, const float * T, 
+                                float * xyz, float * dist)
+{
+    if (dist) {triangulate_batch_soa<float, true >(cam_uv, proj_uv, n, Rt, T, xyz, dist);}
+    else      {triangulate_batch_soa<float, false>(cam_uv, proj_uv, n, Rt, T, xyz, dist);}
+}
+
+void scan3d::triangulate_batch(const double * cam_uv, const double * proj_uv, size_t n, const double * Rt, const double * T, 
+                                double * xyz, double * dist)
+{
+    if (dist) {triangulate_batch_soa<double, true >(cam_uv, proj_uv, n, Rt, T, xyz, dist);}
+    else      {triangulate_batch_soa<double, false>(cam_uv, proj_uv, n, Rt, T, xyz, dist);}
 }
 
 cv::Point3d scan3d::approximate_ray_intersection(const cv::Point3d & v1, const cv::Point3d & q1,
                                                     const cv::Point3d & v2, const cv::Point3d & q2,
                                                     double * distance, double * out_lambda1, double * out_lambda2)
 {
-    cv::Mat v1mat = cv::Mat(v1);
-    cv::Mat v2mat = cv::Mat(v2);
-    
-    double v1tv1 = cv::Mat(v1mat.t()*v1mat).at<double>(0,0);
-    double v2tv2 = cv::Mat(v2mat.t()*v2mat).at<double>(0,0);
-    double v1tv2 = cv::Mat(v1mat.t()*v2mat).at<double>(0,0);
-    double v2tv1 = cv::Mat(v2mat.t()*v1mat).at<double>(0,0);
+    double v1tv1 = v1.dot(v1);
+    double v2tv2 = v2.dot(v2);
+    double v1tv2 = v1.dot(v2);
+    double v2tv1 = v1tv2;
 
     //cv::Mat V(2, 2, CV_64FC1);
     //V.at<double>(0,0) = v1tv1;  V.at<double>(0,1) = -v1tv2;
@@ -748,15 +1153,15 @@ void scan3d::compute_normals(scan3d::Pointcloud & pointcloud)
     }
 }
 
-cv::Mat scan3d::make_projector_view(cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+cv::Mat scan3d::make_projector_view(sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
                                         cv::Size const& projector_size, int threshold)
 {
-    if (!pattern_image.data || pattern_image.type()!=CV_32FC2)
+    if (code_image.empty())
     {   //pattern not correctly decoded
         std::cerr << "[reconstruct_model] ERROR invalid pattern_image\n";
         return cv::Mat();
     }
-    if (!min_max_image.data || min_max_image.type()!=CV_8UC2)
+    if (!min_max_image.data || (min_max_image.type()!=CV_8UC2 && min_max_image.type()!=CV_16UC2) || min_max_image.size()!=code_image.size())
     {   //pattern not correctly decoded
         std::cerr << "[reconstruct_model] ERROR invalid min_max_image\n";
         return cv::Mat();
@@ -775,25 +1180,27 @@ cv::Mat scan3d::make_projector_view(cv::Mat const& pattern_image, cv::Mat const&
     cv::Mat projector_image = cv::Mat::zeros(out_rows, out_cols, CV_8UC3);
     memset(projector_image.data, 255, projector_image.total()*projector_image.channels()); //white
 
-    for (int h=0; h<pattern_image.rows; h++)
+    const bool wide = (min_max_image.depth()==CV_16U);
+    for (int h=0; h<code_image.codes.rows; h++)
     {
-        register const cv::Vec2f * curr_pattern_row = pattern_image.ptr<cv::Vec2f>(h);
-        register const cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
-        for (register int w=0; w<pattern_image.cols; w++)
+        register const cv::Vec2w * curr_codes_row = code_image.codes_row(h);
+        register const unsigned char * mask_row = code_image.mask_row(h);
+        register const unsigned char * min_max_row = min_max_image.ptr<unsigned char>(h);
+        for (register int w=0; w<code_image.codes.cols; w++)
         {
-            const cv::Vec2f & pattern = curr_pattern_row[w];
-            const cv::Vec2b & min_max = min_max_row[w];
+            const cv::Vec2w & code = curr_codes_row[w];
 
-            if (sl::INVALID(pattern) 
-                || pattern[0]<0.f || pattern[0]>=projector_size.width || pattern[1]<0.f || pattern[1]>=projector_size.height
-                || (min_max[1]-min_max[0])<static_cast<int>(threshold))
+            if (!sl::CodeImage::valid(mask_row, w)
+                || code[0]>=projector_size.width || code[1]>=projector_size.height
+                || sl::get_contrast(min_max_row, w, wide)<static_cast<int>(threshold))
             {   //skip
                 continue;
             }
 
             //ok
-            cv::Point2f proj_point(pattern[0]/scale_factor_x, pattern[1]/scale_factor_y);
-            projector_image.at<cv::Vec3b>(static_cast<unsigned>(proj_point.y), static_cast<unsigned>(proj_point.x)) = color_image.at<cv::Vec3b>(h, w);
+            cv::Point2f proj_point(static_cast<float>(code[0])/scale_factor_x, static_cast<float>(code[1])/scale_factor_y);
+            projector_image.at<cv::Vec3b>(static_cast<unsigned>(proj_point.y), static_cast<unsigned>(proj_point.x)) 
+                = color_image.at<cv::Vec3b>(h + code_image.offset.y, w + code_image.offset.x);
         }
     }
 
@@ -40,6 +40,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 #include "CalibrationData.hpp"
+#include "structured_light.hpp"
 
 namespace scan3d
 {
@@ -58,28 +59,45 @@ namespace scan3d
     };
 
     void reconstruct_model(Pointcloud & pointcloud, CalibrationData const& calib, 
-            cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+            sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
             cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget = NULL);
 
     void reconstruct_model_simple(Pointcloud & pointcloud, CalibrationData const& calib, 
-            cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+            sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
             cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget = NULL);
 
     void reconstruct_model_patch_center(Pointcloud & pointcloud, CalibrationData const& calib, 
-            cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+            sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
             cv::Size const& projector_size, int threshold, double max_dist, QWidget * parent_widget = NULL);
 
+    //columns only sets: camera ray / projector column plane intersection, the row code is not used
+    void reconstruct_model_columns(Pointcloud & pointcloud, CalibrationData const& calib, 
+            sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Mat const& color_image,
+            cv::Size const& projector_size, int threshold, QWidget * parent_widget = NULL);
+
     void triangulate_stereo(const cv::Mat & K1, const cv::Mat & kc1, const cv::Mat & K2, const cv::Mat & kc2, 
                             const cv::Mat & Rt, const cv::Mat & T, const cv::Point2d & p1, const cv::Point2d & p2, 
                             cv::Point3d & p3d, double * distance = NULL);
 
+    //same as triangulate_stereo with rays (x, y, 1) already undistorted, e.g. read from the calibration ray tables
+    void triangulate_rays(const cv::Point2d & u1, const cv::Point2d & u2, const cv::Matx33d & Rt, const cv::Vec3d & T, 
+                            cv::Point3d & p3d, double * distance = NULL);
+
+    //triangulation of n undistorted ray pairs in structure of arrays buffers: cam_uv and proj_uv hold the n x
+    //followed by the n y ray coordinates, xyz receives the n x, n y and n z point coordinates and dist (optional)
+    //the ray distances; Rt is R^T row major and T the projector translation, no allocations
+    void triangulate_batch(const float * cam_uv, const float * proj_uv, size_t n, const float * Rt, const float * T, 
+                            float * xyz, float * dist = NULL);
+    void triangulate_batch(const double * cam_uv, const double * proj_uv, size_t n, const double * Rt, const double * T, 
+                            double * xyz, double * dist = NULL);
+
     cv::Point3d approximate_ray_intersection(const cv::Point3d & v1, const cv::Point3d & q1,
                                         const cv::Point3d & v2, const cv::Point3d & q2,
                                         double * distance = NULL, double * out_lambda1 = NULL, double * out_lambda2 = NULL);
 
     void compute_normals(scan3d::Pointcloud & pointcloud);
 
-    cv::Mat make_projector_view(cv::Mat const& pattern_image, cv::Mat const& min_max_image, cv::Mat const& color_image, 
+    cv::Mat make_projector_view(sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Mat const& color_image, 
                                         cv::Size const& projector_size, int threshold);
 };
 
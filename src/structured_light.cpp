@@ -26,80 +26,1699 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "structured_light.hpp"
+#include "frame_stack.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#  define SL_USE_SSE2
+#  include <emmintrin.h>
+#endif
+
 namespace sl
 {
-    const float PIXEL_UNCERTAIN = std::numeric_limits<float>::quiet_NaN();
-    const unsigned short BIT_UNCERTAIN = 0xffff;
-};
+    const float PIXEL_UNCERTAIN = std::numeric_limits<float>::quiet_NaN();
+    const unsigned short BIT_UNCERTAIN = 0xffff;
+};
+
+//scalar reference: updates one row of pattern and min/max for the image pair (row1,row2)
+//T: frame pixel type (8 or 16 bit), INIT: first decoded pair, ROBUST: robust bit assignment (row_light required), 
+//CHANNEL: 0 vertical, 1 horizontal
+template <typename T, bool INIT, bool ROBUST, unsigned CHANNEL>
+static void decode_row_reference(const T * row1, const T * row2, const cv::Vec<T, 2> * row_light,
+                                 cv::Vec2f * pattern_row, cv::Vec<T, 2> * min_max_row, int cols, unsigned bit, unsigned m)
+{
+    const float bit_value = static_cast<float>(1<<bit);
+    for (int w=0; w<cols; w++)
+    {
+        cv::Vec2f & pattern = pattern_row[w];
+        cv::Vec<T, 2> & min_max = min_max_row[w];
+        T value1 = row1[w];
+        T value2 = row2[w];
+
+        if (INIT)
+        {
+            pattern[0] = 0.f; //vertical
+            pattern[1] = 0.f; //horizontal
+        }
+
+        //min/max
+        T vmin = (value1<value2?value1:value2);
+        T vmax = (value1>value2?value1:value2);
+        if (!INIT)
+        {
+            vmin = (min_max[0]<vmin?min_max[0]:vmin);
+            vmax = (min_max[1]>vmax?min_max[1]:vmax);
+        }
+        min_max[0] = vmin;
+        min_max[1] = vmax;
+
+        if (!ROBUST)
+        {   // [simple] pattern bit assignment
+            pattern[CHANNEL] += (value1>value2 ? bit_value : 0.f);
+        }
+        else
+        {   // [robust] pattern bit assignment
+            const cv::Vec<T, 2> & L = row_light[w];
+            unsigned short p = sl::get_robust_bit(value1, value2, L[0], L[1], m);
+            if (p==sl::BIT_UNCERTAIN)
+            {
+                pattern[CHANNEL] = sl::PIXEL_UNCERTAIN;
+            }
+            else
+            {
+                pattern[CHANNEL] += (p ? bit_value : 0.f);
+            }
+        }
+    }   //for each column
+}
+
+#ifdef SL_USE_SSE2
+//unsigned a>b for 16 bytes
+static inline __m128i sse2_cmpgt_epu8(__m128i a, __m128i b)
+{
+    const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+    return _mm_cmpgt_epi8(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+}
+
+//split 16 interleaved Vec2b into two 16 byte vectors
+static inline void sse2_load_vec2b(const cv::Vec2b * src, __m128i & c0, __m128i & c1)
+{
+    const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 8));
+    c0 = _mm_packus_epi16(_mm_and_si128(a, lo_mask), _mm_and_si128(b, lo_mask));
+    c1 = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+static inline void sse2_store_vec2b(cv::Vec2b * dst, __m128i c0, __m128i c1)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi8(c0, c1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8), _mm_unpackhi_epi8(c0, c1));
+}
+
+//bit assignment of 16 pixels: bit_mask is 0xff where the bit is set, uncertain_mask where the pixel is uncertain
+template <bool ROBUST>
+static inline void sse2_pair_bits(__m128i value1, __m128i value2, const cv::Vec2b * light, __m128i mvec, __m128i m_overflow, 
+                                  __m128i & bit_mask, __m128i & uncertain_mask)
+{
+    const __m128i ones = _mm_set1_epi8(static_cast<char>(0xff));
+    bit_mask = sse2_cmpgt_epu8(value1, value2);
+    uncertain_mask = _mm_setzero_si128();
+    if (ROBUST)
+    {
+        __m128i Ld, Lg;
+        sse2_load_vec2b(light, Ld, Lg);
+
+        __m128i low_light = _mm_or_si128(sse2_cmpgt_epu8(mvec, Ld), m_overflow);
+        __m128i direct = sse2_cmpgt_epu8(Ld, Lg);
+        __m128i zero_case = _mm_andnot_si128(_mm_or_si128(sse2_cmpgt_epu8(value1, Ld), sse2_cmpgt_epu8(Lg, value2)), ones);
+        __m128i one_case = _mm_andnot_si128(_mm_or_si128(sse2_cmpgt_epu8(Lg, value1), sse2_cmpgt_epu8(value2, Ld)), ones);
+
+        __m128i certain = _mm_andnot_si128(low_light, _mm_or_si128(direct, _mm_or_si128(zero_case, one_case)));
+        __m128i indirect_bit = _mm_andnot_si128(zero_case, one_case);
+        bit_mask = _mm_or_si128(_mm_and_si128(direct, bit_mask), _mm_andnot_si128(direct, indirect_bit));
+        bit_mask = _mm_and_si128(bit_mask, certain);
+        uncertain_mask = _mm_andnot_si128(certain, ones);
+    }
+}
+
+//vectorized version of decode_row_reference(): 16 pixels per iteration, identical output
+template <bool INIT, bool ROBUST, unsigned CHANNEL>
+static void decode_row_sse2(const unsigned char * row1, const unsigned char * row2, const cv::Vec2b * row_light,
+                            cv::Vec2f * pattern_row, cv::Vec2b * min_max_row, int cols, unsigned bit, unsigned m)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8(static_cast<char>(0xff));
+    const __m128i mvec = _mm_set1_epi8(static_cast<char>(m<255 ? m : 255));
+    const __m128i m_overflow = (m>255 ? ones : zero); //Ld<m is always true
+    const __m128 bit_value = _mm_set1_ps(static_cast<float>(1<<bit));
+    const __m128 uncertain_value = _mm_set1_ps(sl::PIXEL_UNCERTAIN);
+
+    int w = 0;
+    for (; w+16<=cols; w+=16)
+    {
+        __m128i value1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + w));
+        __m128i value2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row2 + w));
+
+        //min/max
+        __m128i vmin = _mm_min_epu8(value1, value2);
+        __m128i vmax = _mm_max_epu8(value1, value2);
+        if (!INIT)
+        {
+            __m128i old_min, old_max;
+            sse2_load_vec2b(min_max_row + w, old_min, old_max);
+            vmin = _mm_min_epu8(vmin, old_min);
+            vmax = _mm_max_epu8(vmax, old_max);
+        }
+        sse2_store_vec2b(min_max_row + w, vmin, vmax);
+
+        //bit assignment
+        __m128i bit_mask, uncertain_mask;
+        sse2_pair_bits<ROBUST>(value1, value2, row_light + w, mvec, m_overflow, bit_mask, uncertain_mask);
+
+        //expand byte masks to 32 bits, 4 pixels per vector
+        __m128i bit16[2] = {_mm_unpacklo_epi8(bit_mask, bit_mask), _mm_unpackhi_epi8(bit_mask, bit_mask)};
+        __m128i unc16[2] = {_mm_unpacklo_epi8(uncertain_mask, uncertain_mask), _mm_unpackhi_epi8(uncertain_mask, uncertain_mask)};
+        float * pattern_data = reinterpret_cast<float *>(pattern_row + w);
+        for (int k=0; k<4; k++)
+        {
+            __m128i bit32 = (k%2==0 ? _mm_unpacklo_epi16(bit16[k/2], bit16[k/2]) : _mm_unpackhi_epi16(bit16[k/2], bit16[k/2]));
+            __m128i unc32 = (k%2==0 ? _mm_unpacklo_epi16(unc16[k/2], unc16[k/2]) : _mm_unpackhi_epi16(unc16[k/2], unc16[k/2]));
+
+            //interleave with the other channel: 2 pixels per vector
+            for (int j=0; j<2; j++)
+            {
+                __m128i bit_lanes, unc_lanes;
+                if (CHANNEL==0)
+                {
+                    bit_lanes = (j==0 ? _mm_unpacklo_epi32(bit32, zero) : _mm_unpackhi_epi32(bit32, zero));
+                    unc_lanes = (j==0 ? _mm_unpacklo_epi32(unc32, zero) : _mm_unpackhi_epi32(unc32, zero));
+                }
+                else
+                {
+                    bit_lanes = (j==0 ? _mm_unpacklo_epi32(zero, bit32) : _mm_unpackhi_epi32(zero, bit32));
+                    unc_lanes = (j==0 ? _mm_unpacklo_epi32(zero, unc32) : _mm_unpackhi_epi32(zero, unc32));
+                }
+
+                float * dst = pattern_data + 8*k + 4*j;
+                __m128 pattern = (INIT ? _mm_setzero_ps() : _mm_loadu_ps(dst));
+                pattern = _mm_add_ps(pattern, _mm_and_ps(_mm_castsi128_ps(bit_lanes), bit_value));
+                __m128 unc = _mm_castsi128_ps(unc_lanes);
+                pattern = _mm_or_ps(_mm_andnot_ps(unc, pattern), _mm_and_ps(unc, uncertain_value));
+                _mm_storeu_ps(dst, pattern);
+            }
+        }
+    }   //for each 16 columns
+
+    //remaining columns
+    if (w<cols)
+    {
+        decode_row_reference<unsigned char, INIT, ROBUST, CHANNEL>(row1 + w, row2 + w, (ROBUST ? row_light + w : NULL), pattern_row + w, 
+                                                                   min_max_row + w, cols - w, bit, m);
+    }
+}
+#endif //SL_USE_SSE2
+
+template <typename T>
+using DecodeRowFunction = void (*)(const T * row1, const T * row2, const cv::Vec<T, 2> * row_light,
+                                   cv::Vec2f * pattern_row, cv::Vec<T, 2> * min_max_row, int cols, unsigned bit, unsigned m);
+
+//vectorized row kernel, NULL if there is none for the pixel type: 16 bit frames use the scalar kernels
+template <typename T>
+static DecodeRowFunction<T> simd_decode_row(unsigned /*index*/)
+{
+    return NULL;
+}
+
+#ifdef SL_USE_SSE2
+template <>
+DecodeRowFunction<unsigned char> simd_decode_row<unsigned char>(unsigned index)
+{
+    static const DecodeRowFunction<unsigned char> sse2_kernels[8] = {
+        decode_row_sse2<false, false, 0>, decode_row_sse2<false, false, 1>,
+        decode_row_sse2<false, true,  0>, decode_row_sse2<false, true,  1>,
+        decode_row_sse2<true,  false, 0>, decode_row_sse2<true,  false, 1>,
+        decode_row_sse2<true,  true,  0>, decode_row_sse2<true,  true,  1>};
+    return sse2_kernels[index];
+}
+#endif
+
+//row kernel for one image pair: the modes are resolved here once per pair, not per pixel
+template <typename T>
+static DecodeRowFunction<T> select_decode_row(unsigned channel, bool init, bool robust, bool reference)
+{
+    static const DecodeRowFunction<T> reference_kernels[8] = {
+        decode_row_reference<T, false, false, 0>, decode_row_reference<T, false, false, 1>,
+        decode_row_reference<T, false, true,  0>, decode_row_reference<T, false, true,  1>,
+        decode_row_reference<T, true,  false, 0>, decode_row_reference<T, true,  false, 1>,
+        decode_row_reference<T, true,  true,  0>, decode_row_reference<T, true,  true,  1>};
+    unsigned index = (init ? 4 : 0) + (robust ? 2 : 0) + (channel ? 1 : 0);
+
+    DecodeRowFunction<T> simd_kernel = (reference ? NULL : simd_decode_row<T>(index));
+    return (simd_kernel ? simd_kernel : reference_kernels[index]);
+}
+
+//PackedDecode, scalar reference: binarizes columns [start,end) of one row for the image pair (row1,row2),
+//bit w%8 of byte w/8 of bits_row is set where the bit is 1, the same bit of uncertain_row is set where 
+//the robust assignment is uncertain (kept from earlier pairs); min/max as in decode_row_reference()
+template <typename T, bool INIT, bool ROBUST>
+static void binarize_row_reference(const T * row1, const T * row2, const cv::Vec<T, 2> * row_light,
+                                   unsigned char * bits_row, unsigned char * uncertain_row, cv::Vec<T, 2> * min_max_row, int start, int end, unsigned m)
+{
+    for (int w=start; w<end; w++)
+    {
+        cv::Vec<T, 2> & min_max = min_max_row[w];
+        T value1 = row1[w];
+        T value2 = row2[w];
+
+        //min/max
+        T vmin = (value1<value2?value1:value2);
+        T vmax = (value1>value2?value1:value2);
+        if (!INIT)
+        {
+            vmin = (min_max[0]<vmin?min_max[0]:vmin);
+            vmax = (min_max[1]>vmax?min_max[1]:vmax);
+        }
+        min_max[0] = vmin;
+        min_max[1] = vmax;
+
+        unsigned char mask = static_cast<unsigned char>(1<<(w&7));
+        bool bit = false;
+        if (!ROBUST)
+        {   // [simple] pattern bit assignment
+            bit = value1>value2;
+        }
+        else
+        {   // [robust] pattern bit assignment
+            const cv::Vec<T, 2> & L = row_light[w];
+            unsigned short p = sl::get_robust_bit(value1, value2, L[0], L[1], m);
+            if (p==sl::BIT_UNCERTAIN)
+            {
+                uncertain_row[w>>3] |= mask;
+            }
+            else
+            {
+                bit = (p!=0);
+            }
+        }
+        bits_row[w>>3] = static_cast<unsigned char>(bit ? (bits_row[w>>3] | mask) : (bits_row[w>>3] & ~mask));
+    }   //for each column
+}
+
+#ifdef SL_USE_SSE2
+//vectorized version of binarize_row_reference(): 16 pixels per iteration from the first multiple of 8, identical output
+template <bool INIT, bool ROBUST>
+static void binarize_row_sse2(const unsigned char * row1, const unsigned char * row2, const cv::Vec2b * row_light,
+                              unsigned char * bits_row, unsigned char * uncertain_row, cv::Vec2b * min_max_row, int start, int end, unsigned m)
+{
+    const __m128i mvec = _mm_set1_epi8(static_cast<char>(m<255 ? m : 255));
+    const __m128i m_overflow = (m>255 ? _mm_set1_epi8(static_cast<char>(0xff)) : _mm_setzero_si128()); //Ld<m is always true
+
+    //head: up to the first whole byte of the planes
+    int w = std::min(end, (start + 7) & ~7);
+    if (start<w)
+    {
+        binarize_row_reference<unsigned char, INIT, ROBUST>(row1, row2, row_light, bits_row, uncertain_row, min_max_row, start, w, m);
+    }
+
+    for (; w+16<=end; w+=16)
+    {
+        __m128i value1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + w));
+        __m128i value2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row2 + w));
+
+        //min/max
+        __m128i vmin = _mm_min_epu8(value1, value2);
+        __m128i vmax = _mm_max_epu8(value1, value2);
+        if (!INIT)
+        {
+            __m128i old_min, old_max;
+            sse2_load_vec2b(min_max_row + w, old_min, old_max);
+            vmin = _mm_min_epu8(vmin, old_min);
+            vmax = _mm_max_epu8(vmax, old_max);
+        }
+        sse2_store_vec2b(min_max_row + w, vmin, vmax);
+
+        //bit assignment: one bit per pixel
+        __m128i bit_mask, uncertain_mask;
+        sse2_pair_bits<ROBUST>(value1, value2, (ROBUST ? row_light + w : NULL), mvec, m_overflow, bit_mask, uncertain_mask);
+        int bits = _mm_movemask_epi8(bit_mask);
+        bits_row[w>>3] = static_cast<unsigned char>(bits);
+        bits_row[(w>>3) + 1] = static_cast<unsigned char>(bits>>8);
+        if (ROBUST)
+        {
+            int uncertain = _mm_movemask_epi8(uncertain_mask);
+            uncertain_row[w>>3] |= static_cast<unsigned char>(uncertain);
+            uncertain_row[(w>>3) + 1] |= static_cast<unsigned char>(uncertain>>8);
+        }
+    }   //for each 16 columns
+
+    //remaining columns
+    if (w<end)
+    {
+        binarize_row_reference<unsigned char, INIT, ROBUST>(row1, row2, row_light, bits_row, uncertain_row, min_max_row, w, end, m);
+    }
+}
+#endif //SL_USE_SSE2
+
+template <typename T>
+using BinarizeRowFunction = void (*)(const T * row1, const T * row2, const cv::Vec<T, 2> * row_light,
+                                     unsigned char * bits_row, unsigned char * uncertain_row, cv::Vec<T, 2> * min_max_row, int start, int end, unsigned m);
+
+template <typename T>
+static BinarizeRowFunction<T> simd_binarize_row(unsigned /*index*/)
+{
+    return NULL;
+}
+
+#ifdef SL_USE_SSE2
+template <>
+BinarizeRowFunction<unsigned char> simd_binarize_row<unsigned char>(unsigned index)
+{
+    static const BinarizeRowFunction<unsigned char> sse2_kernels[4] = {
+        binarize_row_sse2<false, false>, binarize_row_sse2<false, true>,
+        binarize_row_sse2<true,  false>, binarize_row_sse2<true,  true>};
+    return sse2_kernels[index];
+}
+#endif
+
+template <typename T>
+static BinarizeRowFunction<T> select_binarize_row(bool init, bool robust, bool reference)
+{
+    static const BinarizeRowFunction<T> reference_kernels[4] = {
+        binarize_row_reference<T, false, false>, binarize_row_reference<T, false, true>,
+        binarize_row_reference<T, true,  false>, binarize_row_reference<T, true,  true>};
+    unsigned index = (init ? 2 : 0) + (robust ? 1 : 0);
+
+    BinarizeRowFunction<T> simd_kernel = (reference ? NULL : simd_binarize_row<T>(index));
+    return (simd_kernel ? simd_kernel : reference_kernels[index]);
+}
+
+//8x8 bit matrix transpose: bit j of byte i goes to bit i of byte j
+static inline uint64_t transpose_bits8x8(uint64_t x)
+{
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+static inline double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+namespace
+{
+    //loads gray images in the background, in order, keeping at most max_frames
+    //loaded (or loading) images that have not been taken by the consumer yet.
+    //Frame stacks of the images stay mapped until the prefetcher is destroyed
+    class ImagePrefetcher
+    {
+    public:
+        ImagePrefetcher(const std::vector<std::string> & filenames, unsigned max_frames) :
+            _filenames(filenames), _images(filenames.size()), _ready(filenames.size(), false),
+            _max_frames(max_frames), _next(0), _consumed(0), _stop(false), _load_ms(0.0), _wait_ms(0.0)
+        {
+            unsigned threads = std::min<unsigned>(max_frames, std::max(1U, std::thread::hardware_concurrency()/2));
+            for (unsigned i=0; i<threads; i++)
+            {
+                _threads.push_back(std::thread(&ImagePrefetcher::run, this));
+            }
+        }
+
+        ~ImagePrefetcher()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _cond.notify_all();
+            for (size_t i=0; i<_threads.size(); i++)
+            {
+                _threads[i].join();
+            }
+        }
+
+        //images must be taken in order; blocks until image 'index' is available
+        cv::Mat get(size_t index)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (_threads.empty())
+            {   //synchronous
+                std::shared_ptr<FrameStack> stack;
+                cv::Mat image = sl::get_gray_image(_filenames.at(index), &stack);
+                keep(stack);
+                _load_ms += elapsed_ms(start);
+                return image;
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [&]{return _ready[index];});
+            cv::Mat image = _images[index];
+            _images[index] = cv::Mat();
+            _consumed = index + 1;
+            _wait_ms += elapsed_ms(start);
+            lock.unlock();
+            _cond.notify_all();
+            return image;
+        }
+
+        inline size_t thread_count(void) const {return _threads.size();}
+        inline double load_ms(void) const {return _load_ms;} //accumulated over all loader threads
+        inline double wait_ms(void) const {return _wait_ms;} //consumer time blocked in get()
+
+        //images outside the prefetched list (white/black pair, direct light images), loaded now
+        inline cv::Mat get(const std::string & filename)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::shared_ptr<FrameStack> stack;
+            cv::Mat image = sl::get_gray_image(filename, &stack);
+            std::lock_guard<std::mutex> lock(_mutex);
+            keep(stack);
+            _load_ms += elapsed_ms(start);
+            return image;
+        }
+
+    private:
+        //frames are views of the stack mapping: hold it, the shared stacks may be released meanwhile (locked by the caller)
+        void keep(const std::shared_ptr<FrameStack> & stack)
+        {
+            if (stack && std::find(_stacks.begin(), _stacks.end(), stack)==_stacks.end())
+            {
+                _stacks.push_back(stack);
+            }
+        }
+
+        void run(void)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (;;)
+            {
+                _cond.wait(lock, [&]{return _stop || _next>=_filenames.size() || _next<_consumed+_max_frames;});
+                if (_stop || _next>=_filenames.size())
+                {
+                    return;
+                }
+                size_t index = _next++;
+                lock.unlock();
+
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::shared_ptr<FrameStack> stack;
+                cv::Mat image = sl::get_gray_image(_filenames.at(index), &stack);
+                double ms = elapsed_ms(start);
+
+                lock.lock();
+                keep(stack);
+                _images[index] = image;
+                _ready[index] = true;
+                _load_ms += ms;
+                _cond.notify_all();
+            }
+        }
+
+        const std::vector<std::string> & _filenames;
+        std::vector<cv::Mat> _images;
+        std::vector<bool> _ready;
+        size_t _max_frames;
+        size_t _next;
+        size_t _consumed;
+        bool _stop;
+        double _load_ms;
+        double _wait_ms;
+        std::vector<std::shared_ptr<FrameStack> > _stacks;
+        std::vector<std::thread> _threads;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+    };
+};
+
+//keeps the pixels of the spans whose codes are still valid, spans are split at uncertain pixels
+template <typename VALID>
+static void split_active_spans(std::vector<cv::Vec2i> & spans, VALID is_valid)
+{
+    std::vector<cv::Vec2i> active;
+    active.reserve(spans.size());
+    for (size_t i=0; i<spans.size(); i++)
+    {
+        int start = -1;
+        for (int w=spans[i][0]; w<spans[i][1]; w++)
+        {
+            bool valid = is_valid(w);
+            if (valid && start<0)
+            {
+                start = w;
+            }
+            else if (!valid && start>=0)
+            {
+                active.push_back(cv::Vec2i(start, w));
+                start = -1;
+            }
+        }
+        if (start>=0)
+        {
+            active.push_back(cv::Vec2i(start, spans[i][1]));
+        }
+    }
+    spans.swap(active);
+}
+
+static void update_active_spans(std::vector<cv::Vec2i> & spans, const cv::Vec2f * pattern_row)
+{
+    split_active_spans(spans, [pattern_row](int w) {return !sl::INVALID(pattern_row[w]);});
+}
+
+//PackedDecode: a pixel stays active while it is certain in both directions
+static void update_active_spans(std::vector<cv::Vec2i> & spans, const unsigned char * uncertain_row0, const unsigned char * uncertain_row1)
+{
+    split_active_spans(spans, [uncertain_row0, uncertain_row1](int w) {return (((uncertain_row0[w>>3] | uncertain_row1[w>>3])>>(w&7)) & 1)==0;});
+}
+
+//number of row stripes for cv::parallel_for_ such that each stripe working set fits in L2
+static double row_stripes(int rows, size_t row_bytes)
+{
+    static const size_t L2_TILE_BYTES = 256*1024;
+    size_t tile_rows = L2_TILE_BYTES/(row_bytes>0 ? row_bytes : 1);
+    if (tile_rows<1)
+    {
+        tile_rows = 1;
+    }
+    return static_cast<double>((rows + tile_rows - 1)/tile_rows);
+}
+
+//bounding box of the pixels with white/black contrast>=threshold grown by margin, empty if there is none
+template <typename T>
+static cv::Rect contrast_bounding_rect(const cv::Mat & white_image, const cv::Mat & black_image, unsigned threshold, int margin)
+{
+    const int rows = white_image.rows;
+    const int cols = white_image.cols;
+    std::vector<cv::Vec2i> row_extent(rows, cv::Vec2i(cols, -1));  //first and last column over the threshold
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range & range)
+    {
+        for (int h=range.start; h<range.end; h++)
+        {
+            const T * white_row = white_image.ptr<T>(h);
+            const T * black_row = black_image.ptr<T>(h);
+            cv::Vec2i & extent = row_extent[h];
+            for (int w=0; w<cols; w++)
+            {
+                int contrast = static_cast<int>(white_row[w]) - static_cast<int>(black_row[w]);
+                if ((contrast<0 ? -contrast : contrast)>=static_cast<int>(threshold))
+                {
+                    if (extent[0]>w) {extent[0] = w;}
+                    extent[1] = w;
+                }
+            }
+        }
+    }, row_stripes(rows, 2*cols*sizeof(T)));
+
+    int left = cols, right = -1, top = -1, bottom = -1;
+    for (int h=0; h<rows; h++)
+    {
+        if (row_extent[h][1]<0)
+        {
+            continue;
+        }
+        left = std::min(left, row_extent[h][0]);
+        right = std::max(right, row_extent[h][1]);
+        if (top<0) {top = h;}
+        bottom = h;
+    }
+    if (right<0)
+    {   //nothing lit
+        return cv::Rect();
+    }
+    return cv::Rect(cv::Point(std::max(0, left - margin), std::max(0, top - margin)), 
+                    cv::Point(std::min(cols, right + 1 + margin), std::min(rows, bottom + 1 + margin)));
+}
+
+//white/black |contrast| histogram of 256 bins of 2^shift values, the last bin also counts larger contrasts;
+//shadow pixels (contrast<m) are counted exactly, m need not be a bin edge
+template <typename T>
+static void contrast_histogram(const cv::Mat & white_image, const cv::Mat & black_image, unsigned shift, unsigned m, 
+                               std::vector<int64_t> & histogram, int64_t & shadow_pixels)
+{
+    const int rows = white_image.rows;
+    const int cols = white_image.cols;
+    histogram.assign(256, 0);
+    shadow_pixels = 0;
+    std::mutex histogram_mutex;
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range & range)
+    {
+        std::vector<int64_t> stripe_histogram(256, 0);
+        int64_t stripe_shadows = 0;
+        for (int h=range.start; h<range.end; h++)
+        {
+            const T * white_row = white_image.ptr<T>(h);
+            const T * black_row = black_image.ptr<T>(h);
+            for (int w=0; w<cols; w++)
+            {
+                int contrast = std::abs(static_cast<int>(white_row[w]) - static_cast<int>(black_row[w]));
+                stripe_histogram[std::min(255, contrast>>shift)]++;
+                stripe_shadows += (static_cast<unsigned>(contrast)<m);
+            }
+        }
+        std::lock_guard<std::mutex> lock(histogram_mutex);
+        for (int i=0; i<256; i++)
+        {
+            histogram[i] += stripe_histogram[i];
+        }
+        shadow_pixels += stripe_shadows;
+    }, row_stripes(rows, 2*cols*sizeof(T)));
+}
+
+//per pixel white/black midpoint, same type as the images
+template <typename T>
+static cv::Mat midpoint_image(const cv::Mat & white_image, const cv::Mat & black_image)
+{
+    cv::Mat threshold_image(white_image.size(), white_image.type());
+    for (int h=0; h<white_image.rows; h++)
+    {
+        const T * white_row = white_image.ptr<T>(h);
+        const T * black_row = black_image.ptr<T>(h);
+        T * threshold_row = threshold_image.ptr<T>(h);
+        for (int w=0; w<white_image.cols; w++)
+        {
+            threshold_row[w] = static_cast<T>((static_cast<unsigned>(white_row[w]) + black_row[w] + 1)/2);
+        }
+    }
+    return threshold_image;
+}
+
+//calls shadow(w) for the pixels of row h with white/black contrast<m
+template <typename T, typename SHADOW>
+static void find_shadows(const cv::Mat & white_image, const cv::Mat & black_image, int h, unsigned m, SHADOW shadow)
+{
+    const T * white_row = white_image.ptr<T>(h);
+    const T * black_row = black_image.ptr<T>(h);
+    for (int w=0; w<white_image.cols; w++)
+    {
+        int contrast = static_cast<int>(white_row[w]) - static_cast<int>(black_row[w]);
+        if ((contrast<0 ? -contrast : contrast)<static_cast<int>(m))
+        {
+            shadow(w);
+        }
+    }
+}
+
+//single image mode: min/max from the white/black pair, pixels with contrast<m are uncertain
+template <typename T>
+static void white_black_min_max(const cv::Mat & white_image, const cv::Mat & black_image, cv::Mat & pattern_image, cv::Mat & min_max_image, unsigned m)
+{
+    const size_t row_bytes = white_image.cols*(4*sizeof(T) + sizeof(cv::Vec2f));
+    cv::parallel_for_(cv::Range(0, white_image.rows), [&](const cv::Range & range)
+    {
+        for (int h=range.start; h<range.end; h++)
+        {
+            const T * white_row = white_image.ptr<T>(h);
+            const T * black_row = black_image.ptr<T>(h);
+            cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
+            cv::Vec<T, 2> * min_max_row = min_max_image.ptr<cv::Vec<T, 2> >(h);
+            for (int w=0; w<white_image.cols; w++)
+            {
+                T vmin = std::min(white_row[w], black_row[w]);
+                T vmax = std::max(white_row[w], black_row[w]);
+                min_max_row[w] = cv::Vec<T, 2>(vmin, vmax);
+                if (static_cast<unsigned>(vmax - vmin)<m)
+                {   //not enough contrast to tell the bits apart
+                    pattern_row[w] = cv::Vec2f(sl::PIXEL_UNCERTAIN, sl::PIXEL_UNCERTAIN);
+                }
+            }
+        }
+    }, row_stripes(white_image.rows, row_bytes));
+}
+
+//phase shift: adds image*sin_value and image*cos_value to the sums
+template <typename T>
+static void accumulate_phase(const cv::Mat & image, cv::Mat & phase_sin, cv::Mat & phase_cos, float sin_value, float cos_value)
+{
+    const size_t row_bytes = image.cols*(sizeof(T) + 2*sizeof(float));
+    cv::parallel_for_(cv::Range(0, image.rows), [&](const cv::Range & range)
+    {
+        for (int h=range.start; h<range.end; h++)
+        {
+            const T * row = image.ptr<T>(h);
+            float * sin_row = phase_sin.ptr<float>(h);
+            float * cos_row = phase_cos.ptr<float>(h);
+            for (int w=0; w<image.cols; w++)
+            {
+                float value = row[w];
+                sin_row[w] += value*sin_value;
+                cos_row[w] += value*cos_value;
+            }
+        }
+    }, row_stripes(image.rows, row_bytes));
+}
+
+sl::Decoder::Decoder() :
+    _image_size(),
+    _depth(CV_8U),
+    _roi(),
+    _roi_threshold(0),
+    _size(),
+    _projector_size(),
+    _bits(0),
+    _flags(SimpleDecode),
+    _m(5),
+    _pushed(0),
+    _init(true),
+    _compare_ms(0.0),
+    _direct_light(),
+    _pattern_image(),
+    _min_max_image(),
+    _pending(),
+    _direct_light_images(),
+    _light_estimator(),
+    _b(0.5f),
+    _direct_light_ms(0.0),
+    _bit_planes(),
+    _white_image(),
+    _black_image(),
+    _threshold_image(),
+    _spans(),
+    _phase_steps(0),
+    _phase_pushed(0),
+    _lit_image(),
+    _bit_stats(),
+    _contrast_histogram(),
+    _shadow_pixels(0),
+    _uncertain_counts(),
+    _assemble_ms(0.0),
+    _convert_ms(0.0),
+    _phase_ms(0.0)
+{
+}
+
+void sl::Decoder::reset(void)
+{
+    _image_size = cv::Size();
+    _depth = CV_8U;
+    _roi = cv::Rect();
+    _roi_threshold = 0;
+    _size = cv::Size();
+    _projector_size = cv::Size();
+    _bits = 0;
+    _flags = SimpleDecode;
+    _m = 5;
+    _pushed = 0;
+    _init = true;
+    _compare_ms = 0.0;
+    _direct_light = cv::Mat();
+    _pattern_image = cv::Mat();
+    _min_max_image = cv::Mat();
+    _pending.clear();
+    _direct_light_images.clear();
+    _light_estimator.reset();
+    _b = 0.5f;
+    _direct_light_ms = 0.0;
+    _bit_planes.clear();
+    _uncertain_planes[0] = cv::Mat();
+    _uncertain_planes[1] = cv::Mat();
+    _white_image = cv::Mat();
+    _black_image = cv::Mat();
+    _threshold_image = cv::Mat();
+    _spans.clear();
+    _phase_steps = 0;
+    _phase_pushed = 0;
+    for (int i=0; i<2; i++)
+    {
+        _phase_sin[i] = cv::Mat();
+        _phase_cos[i] = cv::Mat();
+    }
+    _lit_image = cv::Mat();
+    _bit_stats.clear();
+    _contrast_histogram.clear();
+    _shadow_pixels = 0;
+    _uncertain_counts.clear();
+    _assemble_ms = 0.0;
+    _convert_ms = 0.0;
+    _phase_ms = 0.0;
+}
+
+bool sl::Decoder::begin(cv::Size const& size, cv::Size const& projector_size, unsigned bits, unsigned flags, const cv::Mat & direct_light, unsigned m, 
+                        unsigned phase_steps, unsigned roi_threshold, int depth)
+{
+    reset();
+
+    if (size.width<1 || size.height<1 || bits<1 || bits>16)
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: invalid image size or bit count.\n";
+        return false;
+    }
+    if (depth!=CV_8U && depth!=CV_16U)
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: 8 or 16 bit gray images required.\n";
+        return false;
+    }
+    if ((flags & (SingleImageDecode|RobustDecode))==(SingleImageDecode|RobustDecode))
+    {   //no inverted images: Ld/Lg classification does not apply
+        std::cout << "[sl::Decoder] Single image decode: robust mode disabled.\n";
+        flags &= ~RobustDecode;
+    }
+    if ((flags & RobustDecode)==RobustDecode && direct_light.data && (direct_light.size()!=size || direct_light.depth()!=depth))
+    {   //different size
+        std::cout << " --> Direct Component image has different size: \n";
+        return false;
+    }
+    if (phase_steps>0 && (phase_steps<3 || get_phase_period(projector_size.width, bits)<4 
+                            || ((flags & ColumnsOnlyDecode)!=ColumnsOnlyDecode && get_phase_period(projector_size.height, bits)<4)))
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: phase shift needs 3 steps or more, and periods of 4 projector pixels or more.\n";
+        return false;
+    }
+
+    _image_size = size;
+    _depth = depth;
+    _roi = cv::Rect(cv::Point(), size);
+    _roi_threshold = roi_threshold;
+    _size = size;
+    _projector_size = projector_size;
+    _bits = bits;
+    _flags = flags;
+    _m = m;
+    _direct_light = direct_light;
+    _phase_steps = phase_steps;
+    if (roi_threshold==0)
+    {   //whole image, otherwise the region is known after the white/black pair
+        allocate(_roi);
+    }
+
+    return true;
+}
+
+void sl::Decoder::allocate(cv::Rect const& roi)
+{
+    _roi = roi;
+    _size = roi.size();
+    if ((_flags & PackedDecode)==PackedDecode)
+    {   //pixels uncertain in a direction stay uncertain, bits of pairs not decoded stay 0
+        const cv::Size plane_size((_size.width + 7)/8, _size.height);
+        _bit_planes.resize(pair_count() - 1);
+        for (size_t i=0; i<_bit_planes.size(); i++)
+        {
+            _bit_planes[i] = cv::Mat::zeros(plane_size, CV_8UC1);
+        }
+        _uncertain_planes[0] = cv::Mat::zeros(plane_size, CV_8UC1);
+        _uncertain_planes[1] = cv::Mat::zeros(plane_size, CV_8UC1);
+    }
+    else
+    {
+        _pattern_image = cv::Mat(_size, CV_32FC2);
+    }
+    _min_max_image = cv::Mat(_size, CV_MAKETYPE(_depth, 2));
+    if ((_flags & CompactDecode)==CompactDecode)
+    {
+        _spans.resize(_size.height);
+    }
+    for (unsigned i=0; i<phase_count(); i+=_phase_steps)
+    {
+        _phase_sin[i/_phase_steps] = cv::Mat::zeros(_size, CV_32FC1);
+        _phase_cos[i/_phase_steps] = cv::Mat::zeros(_size, CV_32FC1);
+    }
+}
+
+bool sl::Decoder::push_pair(const cv::Mat & gray_image1, const cv::Mat & gray_image2)
+{
+    if (!started() || _pushed>=pair_count())
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: unexpected image pair " << _pushed << std::endl;
+        return false;
+    }
+
+    bool single = (_flags & SingleImageDecode)==SingleImageDecode;
+    unsigned pair = _pushed++;
+    if (pair==0)
+    {   //the white/black pair is used to find shadows in simple compact mode, as reference in single image mode,
+        //and to find the region to decode
+        bool valid = (gray_image1.size()==_image_size && gray_image2.size()==_image_size 
+                      && gray_image1.type()==CV_MAKETYPE(_depth, 1) && gray_image2.type()==CV_MAKETYPE(_depth, 1));
+        if (single && !valid)
+        {   //error
+            std::cout << "[sl::Decoder] ERROR: white/black images required in single image mode.\n";
+            return false;
+        }
+        if (_roi_threshold>0)
+        {   //pixels under the threshold are discarded by the reconstruction: the margin keeps their neighbours
+            static const int ROI_MARGIN = 8;
+            cv::Rect roi;
+            if (valid)
+            {
+                roi = (_depth==CV_16U ? contrast_bounding_rect<unsigned short>(gray_image1, gray_image2, _roi_threshold, ROI_MARGIN)
+                                      : contrast_bounding_rect<unsigned char>(gray_image1, gray_image2, _roi_threshold, ROI_MARGIN));
+            }
+            if (roi.area()>0)
+            {
+                std::cout << "Decode region: " << roi.width << "x" << roi.height << " at (" << roi.x << "," << roi.y << "), "
+                          << (100.0*roi.area())/_image_size.area() << "% of the image\n";
+            }
+            else
+            {
+                std::cout << "[sl::Decoder] No lit region found, decoding the whole image.\n";
+                roi = cv::Rect(cv::Point(), _image_size);
+            }
+            allocate(roi);
+        }
+        if (valid && (single || (_flags & (CompactDecode|RobustDecode))==CompactDecode))
+        {
+            _white_image = gray_image1(_roi);
+            _black_image = gray_image2(_roi);
+        }
+        if (valid && (_flags & ReportDecode)==ReportDecode)
+        {   //white/black contrast of the decoded region: 16 bit contrasts are binned by their high byte
+            if (_depth==CV_16U)
+            {
+                contrast_histogram<unsigned short>(gray_image1(_roi), gray_image2(_roi), 8, _m, _contrast_histogram, _shadow_pixels);
+            }
+            else
+            {
+                contrast_histogram<unsigned char>(gray_image1(_roi), gray_image2(_roi), 0, _m, _contrast_histogram, _shadow_pixels);
+            }
+        }
+        if (single)
+        {   //per pixel threshold
+            _threshold_image = (_depth==CV_16U ? midpoint_image<unsigned short>(_white_image, _black_image)
+                                               : midpoint_image<unsigned char>(_white_image, _black_image));
+        }
+        return true;
+    }
+    if (single)
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: single image mode, use push_image.\n";
+        return false;
+    }
+
+    //sanity check
+    if (gray_image1.size()!=_image_size || gray_image1.type()!=CV_MAKETYPE(_depth, 1))
+    {   //different size
+        std::cout << " --> Image 1 has different size, image pair " << pair << "\n";
+        return false;
+    }
+    if (gray_image2.size()!=_image_size || gray_image2.type()!=CV_MAKETYPE(_depth, 1))
+    {   //different size
+        std::cout << " --> Image 2 has different size, image pair " << pair << "\n";
+        return false;
+    }
+
+    if ((_flags & RobustDecode)==RobustDecode && !_direct_light.data)
+    {   //wait for the direct light image
+        _pending.push_back(std::make_pair(gray_image1(_roi), gray_image2(_roi)));
+        if (_direct_light_images.empty())
+        {   //given by set_direct_light()
+            return true;
+        }
+
+        //min/max of the direct light images as they arrive, the pending pairs are decoded after the last one
+        std::chrono::steady_clock::time_point direct_light_start = std::chrono::steady_clock::now();
+        for (unsigned i=0; i<2; i++)
+        {
+            if (std::find(_direct_light_images.begin(), _direct_light_images.end(), 2*pair + i)!=_direct_light_images.end()
+                && !_light_estimator.push((i==0 ? gray_image1 : gray_image2)(_roi)))
+            {
+                return false;
+            }
+        }
+        cv::Mat direct_light;
+        if (_light_estimator.count()==_direct_light_images.size())
+        {   //pixels outside the decoded region get Ld=0: uncertain
+            direct_light = cv::Mat(_image_size, CV_MAKETYPE(_depth, 2), cv::Scalar(0, 0));
+            _light_estimator.estimate(_b).copyTo(direct_light(_roi));
+            _light_estimator.reset();
+        }
+        _direct_light_ms += elapsed_ms(direct_light_start);
+        return (!direct_light.data || set_direct_light(direct_light));
+    }
+
+    decode_pair(gray_image1(_roi), gray_image2(_roi), pair);
+    return true;
+}
+
+bool sl::Decoder::push_image(const cv::Mat & gray_image)
+{
+    if (!started() || _pushed>=pair_count() || (_flags & SingleImageDecode)!=SingleImageDecode || !_threshold_image.data)
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: unexpected image " << _pushed << std::endl;
+        return false;
+    }
+
+    unsigned pair = _pushed++;
+
+    //sanity check
+    if (gray_image.size()!=_image_size || gray_image.type()!=CV_MAKETYPE(_depth, 1))
+    {   //different size
+        std::cout << " --> Image has different size, image " << pair << "\n";
+        return false;
+    }
+
+    //the simple kernel sets the bit where the image is brighter than the white/black midpoint
+    decode_pair(gray_image(_roi), _threshold_image, pair);
+    return true;
+}
+
+bool sl::Decoder::push_phase(const cv::Mat & gray_image)
+{
+    if (!started() || _phase_pushed>=phase_count())
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: unexpected phase image " << _phase_pushed << std::endl;
+        return false;
+    }
+
+    unsigned index = _phase_pushed++;
+
+    //sanity check
+    if (gray_image.size()!=_image_size || gray_image.type()!=CV_MAKETYPE(_depth, 1))
+    {   //different size
+        std::cout << " --> Image has different size, phase image " << index << "\n";
+        return false;
+    }
+    const cv::Mat image = gray_image(_roi);
+
+    //accumulate: the phase is atan2(sum I*sin, sum I*cos) once every step was pushed
+    unsigned channel = index/_phase_steps;
+    double delta = 2.0*CV_PI*(index%_phase_steps)/_phase_steps;
+    const float sin_value = static_cast<float>(std::sin(delta));
+    const float cos_value = static_cast<float>(std::cos(delta));
+    std::chrono::steady_clock::time_point compare_start = std::chrono::steady_clock::now();
+    if (_depth==CV_16U)
+    {
+        accumulate_phase<unsigned short>(image, _phase_sin[channel], _phase_cos[channel], sin_value, cos_value);
+    }
+    else
+    {
+        accumulate_phase<unsigned char>(image, _phase_sin[channel], _phase_cos[channel], sin_value, cos_value);
+    }
+    _compare_ms += elapsed_ms(compare_start);
+
+    return true;
+}
+
+void sl::Decoder::decode_phase(void)
+{
+    bool binary = (_flags & GrayPatternDecode)!=GrayPatternDecode;
+    unsigned directions = phase_count()/_phase_steps;
+    const int projector_extent[2] = {_projector_size.width, _projector_size.height};
+
+    //wrapped phase in [0,2pi), cv::phase is vectorized
+    cv::Mat phase_image[2];
+    for (unsigned i=0; i<directions; i++)
+    {
+        cv::phase(_phase_cos[i], _phase_sin[i], phase_image[i]);
+    }
+
+    float period[2] = {0.f, 0.f}, offset[2] = {0.f, 0.f}, max_code[2] = {0.f, 0.f};
+    for (unsigned i=0; i<directions; i++)
+    {
+        period[i] = static_cast<float>(get_phase_period(projector_extent[i], _bits));
+        offset[i] = static_cast<float>(((1<<get_pattern_bits(projector_extent[i])) - projector_extent[i])/2);
+        max_code[i] = static_cast<float>(projector_extent[i] - 1);
+    }
+
+    //amplitude of the sinusoid is 2/N*sqrt(S^2+C^2): peak to peak must be m or more
+    const float min_norm = 0.25f*_m*_phase_steps;
+    const float min_norm2 = min_norm*min_norm;
+    const float to_fraction = static_cast<float>(0.5/CV_PI);
+    const size_t row_bytes = _size.width*(sizeof(cv::Vec2f) + 3*directions*sizeof(float));
+    cv::parallel_for_(cv::Range(0, _size.height), [&](const cv::Range & range)
+    {
+        for (int h=range.start; h<range.end; h++)
+        {
+            cv::Vec2f * pattern_row = _pattern_image.ptr<cv::Vec2f>(h);
+            for (unsigned i=0; i<directions; i++)
+            {
+                const float * sin_row = _phase_sin[i].ptr<float>(h);
+                const float * cos_row = _phase_cos[i].ptr<float>(h);
+                const float * phase_row = phase_image[i].ptr<float>(h);
+                for (int w=0; w<_size.width; w++)
+                {
+                    float & code = pattern_row[w][i];
+                    if (sl::INVALID(code))
+                    {
+                        continue;
+                    }
+                    if (sin_row[w]*sin_row[w] + cos_row[w]*cos_row[w]<min_norm2)
+                    {   //no modulation
+                        code = sl::PIXEL_UNCERTAIN;
+                        continue;
+                    }
+
+                    //unwrap: the period closest to the center of the coarse stripe
+                    int p = static_cast<int>(code);
+                    float stripe = static_cast<float>(binary ? p : sl::grayToBinary(p, 0));
+                    float fraction = phase_row[w]*to_fraction;
+                    float n = std::floor(0.5f*(stripe + 0.5f) - fraction + 0.5f);
+                    float value = (n + fraction)*period[i] - offset[i];
+
+                    if (value<0.f) {value = 0.f;}
+                    else if (value>max_code[i]) {value = max_code[i];}
+                    code = value;
+                }
+            }
+        }
+    }, row_stripes(_size.height, row_bytes));
+}
+
+bool sl::Decoder::set_direct_light(const cv::Mat & direct_light)
+{
+    if (!started() || direct_light.size()!=_image_size || direct_light.type()!=CV_MAKETYPE(_depth, 2))
+    {   //different size
+        std::cout << " --> Direct Component image has different size: \n";
+        return false;
+    }
+
+    _direct_light = direct_light;
+
+    //decode the pairs received so far, they are in projection order
+    unsigned pair = _pushed - static_cast<unsigned>(_pending.size());
+    for (size_t i=0; i<_pending.size(); i++, pair++)
+    {
+        decode_pair(_pending[i].first, _pending[i].second, pair);
+    }
+    _pending.clear();
+
+    return true;
+}
+
+bool sl::Decoder::estimate_direct_light(const std::vector<unsigned> & images, float b)
+{
+    if (!started() || (_flags & RobustDecode)!=RobustDecode || _direct_light.data || _pushed>1 || images.empty())
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: the direct light is estimated in robust mode, before the first pattern pair.\n";
+        return false;
+    }
+    for (size_t i=0; i<images.size(); i++)
+    {
+        if (images[i]<2 || images[i]>=2*pair_count())
+        {   //error
+            std::cout << "[sl::Decoder] ERROR: invalid direct light image " << images[i] << std::endl;
+            return false;
+        }
+    }
+
+    _direct_light_images = images;
+    _light_estimator.reset();
+    _b = b;
+    return true;
+}
+
+bool sl::Decoder::set_direct_light_images(const std::vector<cv::Mat> & images, float b)
+{
+    if (!started() || (_flags & RobustDecode)!=RobustDecode || _direct_light.data || _pushed!=1 || images.empty())
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: the direct light images are given in robust mode, after the white/black pair.\n";
+        return false;
+    }
+
+    //min/max over the decoded region
+    std::chrono::steady_clock::time_point direct_light_start = std::chrono::steady_clock::now();
+    DirectLightEstimator estimator;
+    for (size_t i=0; i<images.size(); i++)
+    {
+        if (images[i].size()!=_image_size || images[i].type()!=CV_MAKETYPE(_depth, 1) || !estimator.push(images[i](_roi)))
+        {   //error
+            std::cout << "[sl::Decoder] ERROR: invalid direct light image " << i << std::endl;
+            return false;
+        }
+    }
+
+    //pixels outside the decoded region get Ld=0: uncertain
+    cv::Mat direct_light(_image_size, CV_MAKETYPE(_depth, 2), cv::Scalar(0, 0));
+    estimator.estimate(b).copyTo(direct_light(_roi));
+    _direct_light_ms += elapsed_ms(direct_light_start);
+    return set_direct_light(direct_light);
+}
+
+void sl::Decoder::decode_pair(const cv::Mat & gray_image1, const cv::Mat & gray_image2, unsigned pair)
+{
+    if (_depth==CV_16U)
+    {
+        decode_pair_depth<unsigned short>(gray_image1, gray_image2, pair);
+    }
+    else
+    {
+        decode_pair_depth<unsigned char>(gray_image1, gray_image2, pair);
+    }
+}
+
+template <typename T>
+void sl::Decoder::decode_pair_depth(const cv::Mat & gray_image1, const cv::Mat & gray_image2, unsigned pair)
+{
+    bool robust    = (_flags & RobustDecode)==RobustDecode;
+    bool reference = (_flags & ReferenceDecode)==ReferenceDecode;
+
+    unsigned channel = (pair<=_bits ? 0 : 1);       //vertical bits first
+    unsigned bit = _bits - (pair - 1 - channel*_bits) - 1;  //current bit: from (_bits-1) to 0
+    DecodeRowFunction<T> decode_row = select_decode_row<T>(channel, _init, robust, reference);
+    bool packed = !_bit_planes.empty();
+    BinarizeRowFunction<T> binarize_row = select_binarize_row<T>(_init, robust, reference);
+    bool compact = !_spans.empty();
+    bool init = _init;
+    const cv::Mat direct_light = (robust ? _direct_light(_roi) : cv::Mat());
+
+    //bit statistics: the first pair marks the lit pixels
+    bool stats = (_flags & BitStatsDecode)==BitStatsDecode;
+    if (stats && pair==1)
+    {
+        _lit_image.create(_size, CV_8UC1);
+    }
+    std::mutex stats_mutex;
+    int64_t lit_count = 0, resolved_count = 0, contrast_sum = 0;
+
+    //compare: rows are independent, process them in parallel stripes
+    std::chrono::steady_clock::time_point compare_start = std::chrono::steady_clock::now();
+    const size_t row_bytes = _size.width*(2*sizeof(T) + (packed ? 0 : sizeof(cv::Vec2f)) + 2*sizeof(cv::Vec<T, 2>));
+    cv::parallel_for_(cv::Range(0, _size.height), [&](const cv::Range & range)
+    {
+        for (int h=range.start; h<range.end; h++)
+        {
+            const T * row1 = gray_image1.ptr<T>(h);
+            const T * row2 = gray_image2.ptr<T>(h);
+            const cv::Vec<T, 2> * row_light = (robust ? direct_light.ptr<cv::Vec<T, 2> >(h) : NULL);
+            cv::Vec2f * pattern_row = (packed ? NULL : _pattern_image.ptr<cv::Vec2f>(h));
+            cv::Vec<T, 2> * min_max_row = _min_max_image.ptr<cv::Vec<T, 2> >(h);
+            unsigned char * bits_row = (packed ? _bit_planes[pair - 1].ptr<unsigned char>(h) : NULL);
+            unsigned char * uncertain_row = (packed ? _uncertain_planes[channel].ptr<unsigned char>(h) : NULL);
+
+            if (stats)
+            {   //count on the whole row
+                unsigned char * lit_row = _lit_image.ptr<unsigned char>(h);
+                int64_t lit = 0, resolved = 0, contrast = 0;
+                for (int w=0; w<_size.width; w++)
+                {
+                    int diff = std::abs(static_cast<int>(row1[w]) - static_cast<int>(row2[w]));
+                    if (pair==1)
+                    {
+                        lit_row[w] = (diff>=static_cast<int>(_m) ? 1 : 0);
+                    }
+                    if (lit_row[w])
+                    {
+                        lit++;
+                        resolved += (diff>=static_cast<int>(_m) ? 1 : 0);
+                        contrast += diff;
+                    }
+                }
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                lit_count += lit;
+                resolved_count += resolved;
+                contrast_sum += contrast;
+            }
+
+            if (!compact || init)
+            {   //whole row, every pixel is initialized on the first pair
+                if (packed)
+                {
+                    binarize_row(row1, row2, row_light, bits_row, uncertain_row, min_max_row, 0, _size.width, _m);
+                }
+                else
+                {
+                    decode_row(row1, row2, row_light, pattern_row, min_max_row, _size.width, bit, _m);
+                }
+                if (compact)
+                {
+                    init_active_spans(h);
+                }
+                continue;
+            }
+
+            //active pixels only
+            std::vector<cv::Vec2i> & spans = _spans[h];
+            for (size_t i=0; i<spans.size(); i++)
+            {
+                int start = spans[i][0];
+                if (packed)
+                {
+                    binarize_row(row1, row2, row_light, bits_row, uncertain_row, min_max_row, start, spans[i][1], _m);
+                }
+                else
+                {
+                    decode_row(row1 + start, row2 + start, (row_light ? row_light + start : NULL), pattern_row + start, min_max_row + start, 
+                               spans[i][1] - start, bit, _m);
+                }
+            }
+            if (robust)
+            {   //uncertain bits end the span
+                if (packed)
+                {
+                    update_active_spans(spans, _uncertain_planes[0].ptr<unsigned char>(h), _uncertain_planes[1].ptr<unsigned char>(h));
+                }
+                else
+                {
+                    update_active_spans(spans, pattern_row);
+                }
+            }
+        }   //for each row
+    }, row_stripes(_size.height, row_bytes));
+    _compare_ms += elapsed_ms(compare_start);
+
+    if ((_flags & ReportDecode)==ReportDecode)
+    {   //pixels left without a valid code
+        _uncertain_counts.push_back(count_uncertain());
+    }
+
+    if (stats)
+    {
+        BitStats bit_stats;
+        bit_stats.channel = channel;
+        bit_stats.bit = bit;
+        bit_stats.resolved = (lit_count>0 ? static_cast<double>(resolved_count)/lit_count : 0.0);
+        bit_stats.contrast = (lit_count>0 ? static_cast<double>(contrast_sum)/lit_count : 0.0);
+        _bit_stats.push_back(bit_stats);
+        std::cout << "Bit stats: " << (channel ? "horizontal" : "vertical") << " bit " << bit 
+                  << ", resolved " << bit_stats.resolved << ", contrast " << bit_stats.contrast << std::endl;
+    }
+
+    _init = false;
+}
+
+void sl::Decoder::init_active_spans(int h)
+{
+    bool packed = !_bit_planes.empty();
+    cv::Vec2f * pattern_row = (packed ? NULL : _pattern_image.ptr<cv::Vec2f>(h));
+    unsigned char * uncertain_row0 = (packed ? _uncertain_planes[0].ptr<unsigned char>(h) : NULL);
+    unsigned char * uncertain_row1 = (packed ? _uncertain_planes[1].ptr<unsigned char>(h) : NULL);
+    if (_white_image.data)
+    {   //shadows: not enough contrast between the white and black patterns
+        auto shadow = [&](int w)
+        {
+            if (packed)
+            {
+                uncertain_row0[w>>3] |= static_cast<unsigned char>(1<<(w&7));
+                uncertain_row1[w>>3] |= static_cast<unsigned char>(1<<(w&7));
+            }
+            else
+            {
+                pattern_row[w] = cv::Vec2f(PIXEL_UNCERTAIN, PIXEL_UNCERTAIN);
+            }
+        };
+        if (_depth==CV_16U)
+        {
+            find_shadows<unsigned short>(_white_image, _black_image, h, _m, shadow);
+        }
+        else
+        {
+            find_shadows<unsigned char>(_white_image, _black_image, h, _m, shadow);
+        }
+    }
+
+    std::vector<cv::Vec2i> & spans = _spans[h];
+    spans.assign(1, cv::Vec2i(0, _size.width));
+    if (packed)
+    {
+        update_active_spans(spans, uncertain_row0, uncertain_row1);
+    }
+    else
+    {
+        update_active_spans(spans, pattern_row);
+    }
+}
+
+int64_t sl::Decoder::count_uncertain(void) const
+{
+    bool packed = !_bit_planes.empty();
+    std::mutex count_mutex;
+    int64_t count = 0;
+    cv::parallel_for_(cv::Range(0, _size.height), [&](const cv::Range & range)
+    {
+        int64_t uncertain = 0;
+        for (int h=range.start; h<range.end; h++)
+        {
+            if (packed)
+            {   //one bit per pixel, bits past the last column are never set
+                const unsigned char * uncertain_row0 = _uncertain_planes[0].ptr<unsigned char>(h);
+                const unsigned char * uncertain_row1 = _uncertain_planes[1].ptr<unsigned char>(h);
+                for (int i=0; i<_uncertain_planes[0].cols; i++)
+                {
+                    for (unsigned char bits=(uncertain_row0[i] | uncertain_row1[i]); bits; bits&=bits-1) {uncertain++;}
+                }
+                continue;
+            }
+            const cv::Vec2f * pattern_row = _pattern_image.ptr<cv::Vec2f>(h);
+            for (int w=0; w<_size.width; w++)
+            {
+                uncertain += (INVALID(pattern_row[w]) ? 1 : 0);
+            }
+        }
+        std::lock_guard<std::mutex> lock(count_mutex);
+        count += uncertain;
+    }, row_stripes(_size.height, (packed ? 2*_uncertain_planes[0].cols : _size.width*sizeof(cv::Vec2f))));
+    return count;
+}
+
+void sl::Decoder::assemble_codes(void)
+{
+    //pair 1+k is the bit (_bits-1-k) of the vertical code, pair 1+_bits+k the same bit of the horizontal code
+    const unsigned directions = ((_flags & ColumnsOnlyDecode) ? 1 : 2);
+    const int bytes = (_size.width + 7)/8;
+    _pattern_image.create(_size, CV_32FC2);
+
+    const size_t row_bytes = bytes*(_bit_planes.size() + 2) + _size.width*sizeof(cv::Vec2f);
+    cv::parallel_for_(cv::Range(0, _size.height), [&](const cv::Range & range)
+    {
+        std::vector<const unsigned char *> bits_rows(_bit_planes.size());
+        for (int h=range.start; h<range.end; h++)
+        {
+            for (size_t i=0; i<_bit_planes.size(); i++)
+            {
+                bits_rows[i] = _bit_planes[i].ptr<unsigned char>(h);
+            }
+            cv::Vec2f * pattern_row = _pattern_image.ptr<cv::Vec2f>(h);
+            for (int g=0; g<bytes; g++)
+            {   //8 pixels at a time: up to 16 planes to 8 codes with two bit transposes
+                const int count = std::min(8, _size.width - 8*g);
+                for (unsigned c=0; c<2; c++)
+                {
+                    if (c>=directions)
+                    {   //columns only: the row code is always 0
+                        for (int j=0; j<count; j++)
+                        {
+                            pattern_row[8*g + j][c] = 0.f;
+                        }
+                        continue;
+                    }
+
+                    uint64_t low = 0, high = 0;     //byte b: pixels of the plane of code bit b (low), bit 8+b (high)
+                    for (unsigned b=0; b<_bits; b++)
+                    {
+                        uint64_t plane_byte = bits_rows[c*_bits + _bits - 1 - b][g];
+                        if (b<8) {low |= plane_byte<<(8*b);}
+                        else     {high |= plane_byte<<(8*(b - 8));}
+                    }
+                    low = transpose_bits8x8(low);   //byte j: code bits 0-7 of pixel j
+                    high = transpose_bits8x8(high); //byte j: code bits 8-15 of pixel j
+
+                    unsigned char uncertain = _uncertain_planes[c].ptr<unsigned char>(h)[g];
+                    for (int j=0; j<count; j++)
+                    {
+                        unsigned code = static_cast<unsigned>(((low>>(8*j)) & 0xff) | (((high>>(8*j)) & 0xff)<<8));
+                        pattern_row[8*g + j][c] = (((uncertain>>j) & 1) ? PIXEL_UNCERTAIN : static_cast<float>(code));
+                    }
+                }
+            }
+        }   //for each row
+    }, row_stripes(_size.height, row_bytes));
+
+    //the planes are no longer needed
+    _bit_planes.clear();
+    _uncertain_planes[0] = cv::Mat();
+    _uncertain_planes[1] = cv::Mat();
+}
+
+bool sl::Decoder::finish(cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Point * roi_offset, DecodeStats * stats)
+{
+    pattern_image = cv::Mat();
+    min_max_image = cv::Mat();
+    if (roi_offset)
+    {
+        *roi_offset = cv::Point();
+    }
+
+    if (!started())
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: decoder not started.\n";
+        return false;
+    }
+    if (!_pending.empty())
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: robust decode without direct light image.\n";
+        reset();
+        return false;
+    }
+    if (_pushed<pair_count() || _init || _phase_pushed<phase_count())
+    {   //error
+        std::cout << "[sl::Decoder] ERROR: incomplete image set, " << _pushed << " of " << pair_count() << " image pairs, "
+                  << _phase_pushed << " of " << phase_count() << " phase images.\n";
+        reset();
+        return false;
+    }
+
+    if (!_spans.empty())
+    {
+        size_t active = 0;
+        for (size_t h=0; h<_spans.size(); h++)
+        {
+            for (size_t i=0; i<_spans[h].size(); i++)
+            {
+                active += _spans[h][i][1] - _spans[h][i][0];
+            }
+        }
+        std::cout << "Compact decode: " << active << " of " << _size.area() << " pixels active on the last pair\n";
+    }
 
-bool sl::decode_pattern(const std::vector<std::string> & images, cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Size const& projector_size, unsigned flags, const cv::Mat & direct_light, unsigned m)
+    if (!_bit_planes.empty())
+    {   //packed bits to codes
+        std::chrono::steady_clock::time_point assemble_start = std::chrono::steady_clock::now();
+        assemble_codes();
+        _assemble_ms += elapsed_ms(assemble_start);
+    }
+
+    if ((_flags & SingleImageDecode)==SingleImageDecode)
+    {   //single image mode: the bits were compared against the midpoint, 
+        //contrast and min/max come from the white/black pair instead
+        if (_depth==CV_16U)
+        {
+            white_black_min_max<unsigned short>(_white_image, _black_image, _pattern_image, _min_max_image, _m);
+        }
+        else
+        {
+            white_black_min_max<unsigned char>(_white_image, _black_image, _pattern_image, _min_max_image, _m);
+        }
+    }
+
+    bool binary = (_flags & GrayPatternDecode)!=GrayPatternDecode;
+    std::chrono::steady_clock::time_point convert_start = std::chrono::steady_clock::now();
+    if (_phase_steps>0)
+    {   //coarse code and phase to fractional projector coordinates
+        decode_phase();
+        _phase_ms += elapsed_ms(convert_start);
+    }
+    else if (!binary)
+    {   //not binary... it must be gray code
+        const int pattern_offset[2] = {((1<<_bits)-_projector_size.width)/2, ((1<<_bits)-_projector_size.height)/2};
+        convert_pattern(_pattern_image, _projector_size, pattern_offset, binary);
+        _convert_ms += elapsed_ms(convert_start);
+    }
+
+    if (stats)
+    {
+        *stats = DecodeStats();
+        stats->image_size = _image_size;
+        stats->roi = _roi;
+        stats->bits = _bits;
+        stats->columns_only = (_flags & ColumnsOnlyDecode)==ColumnsOnlyDecode;
+        stats->contrast_histogram = _contrast_histogram;
+        stats->contrast_bin_width = (_depth==CV_16U ? 256 : 1);
+        stats->shadow_pixels = _shadow_pixels;
+        stats->uncertain_pixels = _uncertain_counts;
+        stats->bit_stats = _bit_stats;
+        stats->compare_ms = _compare_ms;
+        stats->direct_light_ms = _direct_light_ms;
+        stats->assemble_ms = _assemble_ms;
+        stats->convert_ms = _convert_ms;
+        stats->phase_ms = _phase_ms;
+
+        std::mutex count_mutex;
+        cv::parallel_for_(cv::Range(0, _size.height), [&](const cv::Range & range)
+        {
+            int64_t valid = 0;
+            for (int h=range.start; h<range.end; h++)
+            {
+                const cv::Vec2f * pattern_row = _pattern_image.ptr<cv::Vec2f>(h);
+                for (int w=0; w<_size.width; w++)
+                {
+                    valid += (INVALID(pattern_row[w]) ? 0 : 1);
+                }
+            }
+            std::lock_guard<std::mutex> lock(count_mutex);
+            stats->valid_pixels += valid;
+        }, row_stripes(_size.height, _size.width*sizeof(cv::Vec2f)));
+    }
+
+    pattern_image = _pattern_image;
+    min_max_image = _min_max_image;
+    if (roi_offset)
+    {
+        *roi_offset = _roi.tl();
+    }
+    else if (_size!=_image_size)
+    {   //the caller expects the whole image: pixels outside the region are uncertain
+        pattern_image = cv::Mat(_image_size, CV_32FC2, cv::Scalar(PIXEL_UNCERTAIN, PIXEL_UNCERTAIN));
+        min_max_image = cv::Mat::zeros(_image_size, _min_max_image.type());
+        _pattern_image.copyTo(pattern_image(_roi));
+        _min_max_image.copyTo(min_max_image(_roi));
+    }
+    reset();
+
+    return true;
+}
+
+bool sl::decode_pattern(const std::vector<std::string> & images, cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Size const& projector_size, unsigned flags, cv::Mat & direct_light, float b, unsigned m, 
+                        unsigned prefetch, unsigned phase_steps, unsigned roi_threshold, cv::Point * roi_offset, DecodeStats * stats)
 {
     bool binary   = (flags & GrayPatternDecode)!=GrayPatternDecode;
     bool robust   = (flags & RobustDecode)==RobustDecode;
+    bool reference = (flags & ReferenceDecode)==ReferenceDecode;
+    bool single   = (flags & SingleImageDecode)==SingleImageDecode;
+    bool columns  = (flags & ColumnsOnlyDecode)==ColumnsOnlyDecode;
 
     std::cout << " --- decode_pattern START ---\n";
 
     //delete previous data
     pattern_image = cv::Mat();
     min_max_image = cv::Mat();
-    bool init = true;
 
     std::cout << "Decode: " << (binary?"Binary ":"Gray ")
                             << (robust?"Robust ":"") 
+                            << (reference?"Reference ":"")
+                            << (single?"Single image ":"")
+                            << (columns?"Columns only ":"")
+                            << (phase_steps>0?"Phase shift ":"")
+                            << (roi_threshold>0?"ROI ":"")
                             << std::endl;
 
     int total_images = static_cast<int>(images.size());
-    int total_patterns = total_images/2 - 1;
-    int total_bits = total_patterns/2;
-    if (2+4*total_bits!=total_images)
+    int images_per_bit = (single ? 1 : 2)*(columns ? 1 : 2);
+    int phase_images = (columns ? 1 : 2)*static_cast<int>(phase_steps);
+    int total_bits = (total_images - 2 - phase_images)/images_per_bit;
+    if (total_bits<1 || 2+images_per_bit*total_bits+phase_images!=total_images)
     {   //error
         std::cout << "[sl::decode_pattern] ERROR: cannot detect pattern and bit count from image set.\n";
         return false;
     }
-
-    const unsigned bit_count[] = {0, static_cast<unsigned>(total_bits), static_cast<unsigned>(total_bits)};  //pattern bits
-    const unsigned set_size[]  = {1, static_cast<unsigned>(total_bits), static_cast<unsigned>(total_bits)};  //number of image pairs
-    const unsigned COUNT = 2*(set_size[0]+set_size[1]+set_size[2]); //total image count
-    const int pattern_offset[2] = {((1<<total_bits)-projector_size.width)/2, ((1<<total_bits)-projector_size.height)/2};
-
-    if (images.size()<COUNT)
-    {   //error
-        std::cout << "Image list size does not match set size, please supply exactly " << COUNT << " image names.\n";
-        return false;
-    }
-
-    //load every image pair and compute the maximum, minimum, and bit code
-    unsigned set = 0;
-    unsigned current = 0;
-    for (unsigned t=0; t<COUNT; t+=2, current++)
-    {
-        if (current==set_size[set])
-        {
-            set++;
-            current = 0;
+    std::vector<unsigned> direct_light_images;
+    if (robust && !single && !direct_light.data)
+    {   //estimated from the high frequency images, loaded first
+        direct_light_images = get_direct_light_images(total_images, columns);
+        if (direct_light_images.empty())
+        {   //error
+            std::cout << "[sl::decode_pattern] ERROR: too few images to estimate the direct light.\n";
+            return false;
         }
+    }
 
-        if (set==0)
-        {   //skip
-            continue;
-        }
+    const unsigned COUNT = static_cast<unsigned>(total_images - phase_images); //white/black and bit images, phase images last
+    if (stats)
+    {   //counts are collected by the decoder
+        flags |= ReportDecode;
+    }
 
-        unsigned bit = bit_count[set] - current - 1; //current bit: from 0 to (bit_count[set]-1)
-        unsigned channel = set - 1;
+    //the white/black pair is only needed as reference in single image mode: 
+    //otherwise load from the first pattern image on
+    const unsigned FIRST = (single ? 0 : 2);
+    std::vector<std::string> pattern_images(images.begin() + FIRST, images.end());
+    ImagePrefetcher loader(pattern_images, prefetch);
+    std::chrono::steady_clock::time_point decode_start = std::chrono::steady_clock::now();
 
+    //load every image pair and feed the decoder
+    Decoder decoder;
+    for (unsigned t=FIRST; t<COUNT; t+=(single && t>=2 ? 1 : 2))
+    {
         //load images
-        const cv::Mat & gray_image1 = get_gray_image(images.at(t+0));
+        const cv::Mat gray_image1 = loader.get(t+0-FIRST);
         if (gray_image1.rows<1)
         {
             std::cout << "Failed to load " << images.at(t+0) << std::endl;
             return false;
         }
-        const cv::Mat & gray_image2 = get_gray_image(images.at(t+1));
+        if (single && t>=2)
+        {   //one image per bit
+            if (!decoder.push_image(gray_image1))
+            {   //error
+                std::cout << "[sl::decode_pattern] ERROR: cannot decode " << images.at(t) << std::endl;
+                return false;
+            }
+            continue;
+        }
+        const cv::Mat gray_image2 = loader.get(t+1-FIRST);
         if (gray_image2.rows<1)
         {
             std::cout << "Failed to load " << images.at(t+1) << std::endl;
@@ -107,105 +1726,101 @@ bool sl::decode_pattern(const std::vector<std::string> & images, cv::Mat & patte
         }
 
         //initialize data structures
-        if (init)
+        if (!decoder.started())
         {
             //sanity check
-            if (gray_image1.size()!=gray_image2.size())
+            if (gray_image1.size()!=gray_image2.size() || gray_image1.type()!=gray_image2.type())
             {   //different size
                 std::cout << " --> Initial images have different size: \n";
                 return false;
             }
-            if (robust && gray_image1.size()!=direct_light.size())
-            {   //different size
-                std::cout << " --> Direct Component image has different size: \n";
+            //8 or 16 bit: the set is decoded at the depth of its images
+            if (!decoder.begin(gray_image1.size(), projector_size, total_bits, flags, direct_light, m, phase_steps, roi_threshold, gray_image1.depth()))
+            {
                 return false;
             }
-            pattern_image = cv::Mat(gray_image1.size(), CV_32FC2);
-            min_max_image = cv::Mat(gray_image1.size(), CV_8UC2);
-        }
-
-        //sanity check
-        if (gray_image1.size()!=pattern_image.size())
-        {   //different size
-            std::cout << " --> Image 1 has different size, image pair " << t << " (skipped!)\n";
-            continue;
-        }
-        if (gray_image2.size()!=pattern_image.size())
-        {   //different size
-            std::cout << " --> Image 2 has different size, image pair " << t << " (skipped!)\n";
-            continue;
-        }
-
-        //compare
-        for (int h=0; h<pattern_image.rows; h++)
-        {
-            const unsigned char * row1 = gray_image1.ptr<unsigned char>(h);
-            const unsigned char * row2 = gray_image2.ptr<unsigned char>(h);
-            const cv::Vec2b * row_light = (robust ? direct_light.ptr<cv::Vec2b>(h) : NULL);
-            cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
-            cv::Vec2b * min_max_row = min_max_image.ptr<cv::Vec2b>(h);
-
-            for (int w=0; w<pattern_image.cols; w++)
-            {
-                cv::Vec2f & pattern = pattern_row[w];
-                cv::Vec2b & min_max = min_max_row[w];
-                unsigned char value1 = row1[w];
-                unsigned char value2 = row2[w];
-
-                if (init)
-                {
-                    pattern[0] = 0.f; //vertical
-                    pattern[1] = 0.f; //horizontal
-                }
-
-                //min/max
-                if (init || value1<min_max[0] || value2<min_max[0])
+            if (single)
+            {   //white/black pair is the reference
+                if (!decoder.push_pair(gray_image1, gray_image2))
                 {
-                    min_max[0] = (value1<value2?value1:value2);
+                    return false;
                 }
-                if (init || value1>min_max[1] || value2>min_max[1])
+                continue;
+            }
+            bool ok = false;
+            if ((flags & (CompactDecode|RobustDecode))==CompactDecode || roi_threshold>0 || (flags & ReportDecode)==ReportDecode)
+            {   //white/black pair is used to skip shadows, to find the region to decode or for the contrast histogram
+                ok = decoder.push_pair(loader.get(images.at(0)), loader.get(images.at(1)));
+            }
+            else
+            {   //white/black pair is not used
+                ok = decoder.push_pair(cv::Mat(), cv::Mat());
+            }
+            if (!ok)
+            {   //error
+                std::cout << "[sl::decode_pattern] ERROR: cannot decode " << images.at(0) << " and " << images.at(1) << std::endl;
+                return false;
+            }
+            if (!direct_light_images.empty())
+            {   //direct light before the pattern pairs: none is kept waiting for it
+                std::vector<cv::Mat> light_images;
+                for (size_t i=0; i<direct_light_images.size(); i++)
                 {
-                    min_max[1] = (value1>value2?value1:value2);
-                }
-                
-                if (!robust)
-                {   // [simple] pattern bit assignment
-                    if (value1>value2)
-                    {   //set bit n to 1
-                        pattern[channel] += (1<<bit);
-                    }
+                    light_images.push_back(loader.get(images.at(direct_light_images[i])));
                 }
-                else
-                {   // [robust] pattern bit assignment
-                    if (row_light && (init || pattern[channel]!=PIXEL_UNCERTAIN))
-                    {
-                        const cv::Vec2b & L = row_light[w];
-                        unsigned short p = get_robust_bit(value1, value2, L[0], L[1], m);
-                        if (p==BIT_UNCERTAIN)
-                        {
-                            pattern[channel] = PIXEL_UNCERTAIN;
-                        }
-                        else
-                        {
-                            pattern[channel] += (p<<bit);
-                        }
-                    }
+                if (!decoder.set_direct_light_images(light_images, b))
+                {   //error
+                    std::cout << "[sl::decode_pattern] ERROR: cannot estimate the direct light.\n";
+                    return false;
                 }
+            }
+        }
 
-            }   //for each column
-        }   //for each row
+        if (!decoder.push_pair(gray_image1, gray_image2))
+        {   //error: different size or depth, or too many images
+            std::cout << "[sl::decode_pattern] ERROR: cannot decode " << images.at(t) << " and " << images.at(t+1) << std::endl;
+            return false;
+        }
+    }   //for all image pairs
+
+    for (unsigned t=COUNT; t<static_cast<unsigned>(total_images); t++)
+    {
+        const cv::Mat gray_image = loader.get(t-FIRST);
+        if (gray_image.rows<1)
+        {
+            std::cout << "Failed to load " << images.at(t) << std::endl;
+            return false;
+        }
+        if (!decoder.push_phase(gray_image))
+        {   //error
+            std::cout << "[sl::decode_pattern] ERROR: cannot decode " << images.at(t) << std::endl;
+            return false;
+        }
+    }   //for all phase images
 
-        init = false;
-    }   //for all image pairs
+    double total_ms = elapsed_ms(decode_start);
+    double compare_ms = decoder.compare_ms();
+    std::cout << "Decode timing: total " << total_ms << " ms, compare " << compare_ms << " ms, "
+              << "load " << loader.load_ms() << " ms (" << loader.thread_count() << " loader threads), "
+              << "waiting for images " << loader.wait_ms() << " ms, "
+              << "overlapped " << std::max(0.0, loader.load_ms() + compare_ms - total_ms) << " ms\n";
 
-    if (!binary)
-    {   //not binary... it must be gray code
-        convert_pattern(pattern_image, projector_size, pattern_offset, binary);
+    if (!direct_light_images.empty())
+    {   //estimated before decoding
+        direct_light = decoder.direct_light();
+    }
+    bool rv = decoder.finish(pattern_image, min_max_image, roi_offset, stats);
+    if (rv && stats)
+    {
+        stats->total_ms = elapsed_ms(decode_start);
+        stats->load_ms = loader.load_ms();
+        stats->wait_ms = loader.wait_ms();
+        stats->load_threads = static_cast<unsigned>(loader.thread_count());
     }
 
     std::cout << " --- decode_pattern END ---\n";
 
-    return true;
+    return rv;
 }
 
 unsigned short sl::get_robust_bit(unsigned value1, unsigned value2, unsigned Ld, unsigned Lg, unsigned m)
@@ -229,6 +1844,39 @@ unsigned short sl::get_robust_bit(unsigned value1, unsigned value2, unsigned Ld,
     return BIT_UNCERTAIN;
 }
 
+//converts one row of codes: BINARY binary to gray, otherwise gray to binary clamped to the projector size
+template <bool BINARY>
+static void convert_row_kernel(cv::Vec2f * pattern_row, int cols, cv::Size const& projector_size, const int offset[2])
+{
+    const int max_code[2] = {projector_size.width - 1, projector_size.height - 1};
+    for (int w=0; w<cols; w++)
+    {
+        cv::Vec2f & pattern = pattern_row[w];
+        for (int i=0; i<2; i++)
+        {
+            if (sl::INVALID(pattern[i]))
+            {
+                continue;
+            }
+
+            int p = static_cast<int>(pattern[i]);
+            if (BINARY)
+            {
+                pattern[i] = sl::binaryToGray(p, offset[i]) + (pattern[i] - p);
+            }
+            else
+            {
+                int code = sl::grayToBinary(p, offset[i]);
+
+                if (code<0) {code = 0;}
+                else if (code>max_code[i]) {code = max_code[i];}
+
+                pattern[i] = code + (pattern[i] - p);
+            }
+        }
+    }
+}
+
 void sl::convert_pattern(cv::Mat & pattern_image, cv::Size const& projector_size, const int offset[2], bool binary)
 {
     if (pattern_image.rows==0)
@@ -249,129 +1897,290 @@ void sl::convert_pattern(cv::Mat & pattern_image, cv::Size const& projector_size
         std::cout << "Converting gray code to binary\n";
     }
 
-    for (int h=0; h<pattern_image.rows; h++)
+    void (*convert_row)(cv::Vec2f *, int, cv::Size const&, const int *) = (binary ? convert_row_kernel<true> : convert_row_kernel<false>);
+    cv::parallel_for_(cv::Range(0, pattern_image.rows), [&](const cv::Range & range)
     {
-        cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
-        for (int w=0; w<pattern_image.cols; w++)
+        for (int h=range.start; h<range.end; h++)
         {
-            cv::Vec2f & pattern = pattern_row[w];
-            if (binary)
-            {
-                if (!INVALID(pattern[0]))
-                {
-                    int p = static_cast<int>(pattern[0]);
-                    pattern[0] = binaryToGray(p, offset[0]) + (pattern[0] - p);
-                }
-                if (!INVALID(pattern[1]))
-                {
-                    int p = static_cast<int>(pattern[1]);
-                    pattern[1] = binaryToGray(p, offset[1]) + (pattern[1] - p);
-                }
-            }
-            else
-            {
-                if (!INVALID(pattern[0]))
-                {
-                    int p = static_cast<int>(pattern[0]);
-                    int code = grayToBinary(p, offset[0]);
-
-                    if (code<0) {code = 0;}
-                    else if (code>=projector_size.width) {code = projector_size.width - 1;}
+            convert_row(pattern_image.ptr<cv::Vec2f>(h), pattern_image.cols, projector_size, offset);
+        }
+    }, row_stripes(pattern_image.rows, pattern_image.cols*sizeof(cv::Vec2f)));
+}
 
-                    pattern[0] = code + (pattern[0] - p);
-                }
-                if (!INVALID(pattern[1]))
-                {
-                    int p = static_cast<int>(pattern[1]);
-                    int code = grayToBinary(p, offset[1]);
+bool sl::scale_pattern(cv::Mat & pattern_image, cv::Size const& pattern_size, cv::Size const& projector_size, bool columns_only)
+{
+    if (pattern_image.rows==0 || pattern_image.type()!=CV_32FC2)
+    {   //no pattern image
+        return false;
+    }
 
-                    if (code<0) {code = 0;}
-                    else if (code>=projector_size.height) {code = projector_size.height - 1;}
+    //per direction: scale 2^k, and the Gray code offsets of the reduced (decoder) and of the full (projector) patterns
+    const int pattern[2] = {pattern_size.width, pattern_size.height};
+    const int projector[2] = {projector_size.width, projector_size.height};
+    const int directions = (columns_only ? 1 : 2); //the row code is always 0
+    float scale[2] = {1.f, 1.f}, shift[2] = {0.f, 0.f}, max_code[2] = {0.f, 0.f};
+    for (int i=0; i<directions; i++)
+    {
+        unsigned k = 0;
+        while (k<16 && (projector[i]>>k)>pattern[i]) { k++; }
+        if (pattern[i]<1 || (projector[i]>>k)!=pattern[i])
+        {
+            std::cout << "[sl::scale_pattern] ERROR: pattern size " << pattern_size.width << "x" << pattern_size.height 
+                      << " is not a reduced projector size " << projector_size.width << "x" << projector_size.height << std::endl;
+            return false;
+        }
+        const unsigned bits = get_pattern_bits(pattern[i]);
+        const int pattern_offset = ((1<<bits) - pattern[i])/2;
+        const int projector_offset = ((1<<(bits + k)) - projector[i])/2;
+        scale[i] = static_cast<float>(1<<k);
+        shift[i] = scale[i]*pattern_offset - projector_offset + 0.5f*(scale[i] - 1.f);
+        max_code[i] = static_cast<float>(projector[i] - 1);
+    }
+    if (scale[0]==1.f && scale[1]==1.f)
+    {   //full resolution set
+        return true;
+    }
 
-                    pattern[1] = code + (pattern[1] - p);
+    cv::parallel_for_(cv::Range(0, pattern_image.rows), [&](const cv::Range & range)
+    {
+        for (int h=range.start; h<range.end; h++)
+        {
+            cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
+            for (int w=0; w<pattern_image.cols; w++)
+            {
+                cv::Vec2f & code = pattern_row[w];
+                for (int i=0; i<directions; i++)
+                {
+                    if (!INVALID(code[i]))
+                    {
+                        code[i] = std::min(max_code[i], std::max(0.f, scale[i]*code[i] + shift[i]));
+                    }
                 }
             }
         }
+    }, row_stripes(pattern_image.rows, pattern_image.cols*sizeof(cv::Vec2f)));
+    return true;
+}
+
+//running min/max of one row
+template <typename T>
+static void min_max_row(const T * row, T * min_row, T * max_row, int cols)
+{
+    for (int w=0; w<cols; w++)
+    {
+        if (min_row[w]>row[w]) min_row[w] = row[w];
+        if (max_row[w]<row[w]) max_row[w] = row[w];
     }
 }
 
-cv::Mat sl::estimate_direct_light(const std::vector<cv::Mat> & images, float b)
+static void min_max_row(const unsigned char * row, unsigned char * min_row, unsigned char * max_row, int cols)
 {
-    static const unsigned COUNT = 10; // max number of images
+    int w = 0;
+#ifdef SL_USE_SSE2
+    for (; w+16<=cols; w+=16)
+    {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + w));
+        __m128i * min_ptr = reinterpret_cast<__m128i *>(min_row + w);
+        __m128i * max_ptr = reinterpret_cast<__m128i *>(max_row + w);
+        _mm_storeu_si128(min_ptr, _mm_min_epu8(_mm_loadu_si128(min_ptr), value));
+        _mm_storeu_si128(max_ptr, _mm_max_epu8(_mm_loadu_si128(max_ptr), value));
+    }
+#endif
+    for (; w<cols; w++)
+    {
+        if (min_row[w]>row[w]) min_row[w] = row[w];
+        if (max_row[w]<row[w]) max_row[w] = row[w];
+    }
+}
 
-    unsigned count = static_cast<int>(images.size());
-    if (count<1)
-    {   //no images
-        return cv::Mat();
+sl::DirectLightEstimator::DirectLightEstimator() :
+    _count(0),
+    _min_image(),
+    _max_image()
+{
+}
+
+void sl::DirectLightEstimator::reset(void)
+{
+    _count = 0;
+    _min_image = cv::Mat();
+    _max_image = cv::Mat();
+}
+
+bool sl::DirectLightEstimator::push(const cv::Mat & gray_image)
+{
+    if ((gray_image.type()!=CV_8UC1 && gray_image.type()!=CV_16UC1) || gray_image.rows<1 
+        || (_count>0 && (gray_image.size()!=_min_image.size() || gray_image.type()!=_min_image.type())))
+    {   //error
+        std::cout << "[sl::DirectLightEstimator] ERROR: gray images of the same size and depth required\n";
+        return false;
     }
-    
-    std::cout << " --- estimate_direct_light START ---\n";
 
-    if (count>COUNT)
-    {
-        count = COUNT;
-        std::cout << "WARNING: Using only " << COUNT << " of " << count << std::endl;
+    if (_count++==0)
+    {   //first image
+        gray_image.copyTo(_min_image);
+        gray_image.copyTo(_max_image);
+        return true;
     }
 
-    for (unsigned i=0; i<count; i++)
+    bool wide = (gray_image.depth()==CV_16U);
+    cv::parallel_for_(cv::Range(0, gray_image.rows), [&](const cv::Range & range)
     {
-        if (images.at(i).type()!=CV_8UC1)
-        {   //error
-            std::cout << "Gray images required\n";
-            return cv::Mat();
+        for (int h=range.start; h<range.end; h++)
+        {
+            if (wide)
+            {
+                min_max_row(gray_image.ptr<unsigned short>(h), _min_image.ptr<unsigned short>(h), _max_image.ptr<unsigned short>(h), gray_image.cols);
+            }
+            else
+            {
+                min_max_row(gray_image.ptr<unsigned char>(h), _min_image.ptr<unsigned char>(h), _max_image.ptr<unsigned char>(h), gray_image.cols);
+            }
         }
+    }, row_stripes(gray_image.rows, 3*gray_image.cols*gray_image.elemSize()));
+
+    return true;
+}
+
+//Ld and Lg of one row from the running min/max, Ld_table[Lmax-Lmin] is Ld for 8 bit frames (NULL for 16 bit)
+template <typename T>
+static void direct_light_row(const T * min_row, const T * max_row, cv::Vec<T, 2> * row_light, int cols, float b, const int * Ld_table)
+{
+    double b1 = 1.0/(1.0 - b);
+    double b2 = 2.0/(1.0 - b*1.0*b);
+    for (int w=0; w<cols; w++)
+    {
+        unsigned Lmax = max_row[w];
+        unsigned Lmin = min_row[w];
+
+        int Ld = (Ld_table ? Ld_table[Lmax - Lmin] : static_cast<int>(b1*(Lmax - Lmin) + 0.5));
+        int Lg = static_cast<int>(b2*(Lmin - b*Lmax) + 0.5);
+        row_light[w][0] = static_cast<T>(Lg>0 ? static_cast<unsigned>(Ld) : Lmax);
+        row_light[w][1] = static_cast<T>(Lg>0 ? static_cast<unsigned>(Lg) : 0);
+    }
+}
+
+cv::Mat sl::DirectLightEstimator::estimate(float b) const
+{
+    if (_count<1)
+    {   //no images
+        return cv::Mat();
     }
 
-    cv::Size size = images.at(0).size();
+    cv::Size size = _min_image.size();
+    bool wide = (_min_image.depth()==CV_16U);
 
     //initialize direct light image
-    cv::Mat direct_light(size, CV_8UC2);
+    cv::Mat direct_light(size, CV_MAKETYPE(_min_image.depth(), 2));
 
     double b1 = 1.0/(1.0 - b);
-    double b2 = 2.0/(1.0 - b*1.0*b);
 
-    for (unsigned h=0; static_cast<int>(h)<size.height; h++)
+    //Ld only depends on Lmax-Lmin
+    int Ld_table[256];
+    for (unsigned i=0; i<256; i++)
     {
-        unsigned char const* row[COUNT];
-        for (unsigned i=0; i<count; i++)
-        {
-            row[i] = images.at(i).ptr<unsigned char>(h);
-        }
-        cv::Vec2b * row_light = direct_light.ptr<cv::Vec2b>(h);
+        Ld_table[i] = static_cast<int>(b1*i + 0.5);
+    }
 
-        for (unsigned w=0; static_cast<int>(w)<size.width; w++)
+    cv::parallel_for_(cv::Range(0, size.height), [&](const cv::Range & range)
+    {
+        for (int h=range.start; h<range.end; h++)
         {
-            unsigned Lmax = row[0][w];
-            unsigned Lmin = row[0][w];
-            for (unsigned i=0; i<count; i++)
+            if (wide)
+            {
+                direct_light_row(_min_image.ptr<unsigned short>(h), _max_image.ptr<unsigned short>(h), direct_light.ptr<cv::Vec2w>(h), 
+                                 size.width, b, NULL);
+            }
+            else
             {
-                if (Lmax<row[i][w]) Lmax = row[i][w];
-                if (Lmin>row[i][w]) Lmin = row[i][w];
+                direct_light_row(_min_image.ptr<unsigned char>(h), _max_image.ptr<unsigned char>(h), direct_light.ptr<cv::Vec2b>(h), 
+                                 size.width, b, Ld_table);
             }
+        }
+    }, row_stripes(size.height, size.width*4*_min_image.elemSize()));
+
+    return direct_light;
+}
 
-            int Ld = static_cast<int>(b1*(Lmax - Lmin) + 0.5);
-            int Lg = static_cast<int>(b2*(Lmin - b*Lmax) + 0.5);
-            row_light[w][0] = (Lg>0 ? static_cast<unsigned>(Ld) : Lmax);
-            row_light[w][1] = (Lg>0 ? static_cast<unsigned>(Lg) : 0);
+cv::Mat sl::estimate_direct_light(const std::vector<cv::Mat> & images, float b)
+{
+    if (images.empty())
+    {   //no images
+        return cv::Mat();
+    }
+    
+    std::cout << " --- estimate_direct_light START ---\n";
 
-            //std::cout << "Ld=" << (int)row_light[w][0] << " iTotal=" <<(int) row_light[w][1] << std::endl;
+    DirectLightEstimator estimator;
+    for (size_t i=0; i<images.size(); i++)
+    {
+        if (!estimator.push(images[i]))
+        {   //error
+            return cv::Mat();
         }
     }
+    cv::Mat direct_light = estimator.estimate(b);
 
     std::cout << " --- estimate_direct_light END ---\n";
 
     return direct_light;
 }
 
-cv::Mat sl::get_gray_image(const std::string & filename)
+std::vector<unsigned> sl::get_direct_light_images(int total_images, bool columns_only)
 {
-    //load image
-    cv::Mat rgb_image = cv::imread(filename);
-    if (rgb_image.rows>0 && rgb_image.cols>0)
+    std::vector<unsigned> direct_component_images;
+
+    int total_patterns = total_images/2 - 1;
+    const int direct_light_count = 4;
+    const int direct_light_offset = 4;
+
+    if (columns_only)
+    {   //vertical patterns only: 8 images, ending at the same pattern (10..17 for 10 bits)
+        int first = total_images - 2*direct_light_count - direct_light_offset;
+        if (first<2)
+        {   //too few images
+            return direct_component_images;
+        }
+        for (int i=0; i<2*direct_light_count; i++)
+        {
+            direct_component_images.push_back(first + i);
+        }
+        return direct_component_images;
+    }
+    if (total_patterns<direct_light_count+direct_light_offset)
+    {   //too few images
+        return direct_component_images;
+    }
+
+    //image indices, starting at 0 (14..17 and 34..37 for 10 bits)
+    for (int i=0; i<direct_light_count; i++)
+    {
+        int index = total_images - total_patterns - direct_light_count - direct_light_offset + i;
+        direct_component_images.push_back(index);
+        direct_component_images.push_back(index + total_patterns);
+    }
+    return direct_component_images;
+}
+
+cv::Mat sl::get_gray_image(const std::string & filename, std::shared_ptr<FrameStack> * stack)
+{
+    std::string stack_filename;
+    unsigned frame = 0;
+    if (FrameStack::split_frame_name(filename, stack_filename, frame))
+    {   //frame stack: the mapped frame, no copy
+        std::shared_ptr<FrameStack> frame_stack = FrameStack::shared(stack_filename);
+        if (stack)
+        {
+            *stack = frame_stack;
+        }
+        return (frame_stack ? frame_stack->frame(frame) : cv::Mat());
+    }
+
+    //load image as gray scale: the decoder converts while reading, no color buffer is created;
+    //16 bit images (12/16 bit cameras) keep their depth
+    cv::Mat gray_image = cv::imread(filename, cv::IMREAD_GRAYSCALE|cv::IMREAD_ANYDEPTH);
+    if (gray_image.rows>0 && gray_image.cols>0)
     {
-        //gray scale
-        cv::Mat gray_image;
-        cvtColor(rgb_image, gray_image, cv::COLOR_BGR2GRAY);
         return gray_image;
     }
     return cv::Mat();
@@ -401,9 +2210,222 @@ static unsigned util_grayToBinary(unsigned num, unsigned numBits)
 
 int sl::binaryToGray(int value) {return util_binaryToGray(value);}
 
+unsigned sl::get_usable_bits(const std::vector<BitStats> & stats, double min_resolved)
+{
+    unsigned usable[2] = {0, 0};
+    bool stopped[2] = {false, false};
+    bool found[2] = {false, false};
+    for (size_t i=0; i<stats.size(); i++)
+    {   //pairs are in projection order: coarse to fine
+        unsigned channel = stats[i].channel;
+        found[channel] = true;
+        if (stopped[channel] || stats[i].resolved<min_resolved)
+        {
+            stopped[channel] = true;
+            continue;
+        }
+        usable[channel]++;
+    }
+    if (found[0] && found[1])
+    {
+        return std::min(usable[0], usable[1]);
+    }
+    return (found[0] ? usable[0] : usable[1]);
+}
+
+sl::DecodeStats::DecodeStats() :
+    image_size(),
+    roi(),
+    bits(0),
+    columns_only(false),
+    shadow_pixels(0),
+    valid_pixels(0),
+    contrast_histogram(),
+    contrast_bin_width(1),
+    uncertain_pixels(),
+    bit_stats(),
+    total_ms(0.0),
+    load_ms(0.0),
+    wait_ms(0.0),
+    direct_light_ms(0.0),
+    compare_ms(0.0),
+    assemble_ms(0.0),
+    convert_ms(0.0),
+    phase_ms(0.0),
+    load_threads(0)
+{
+}
+
+unsigned sl::get_pattern_bits(int projector_size)
+{   //same search as the projector
+    unsigned bits = 1;
+    for (int i=(1<<bits); i<projector_size; i=(1<<bits)) { bits++; }
+    return bits;
+}
+
+int sl::get_phase_period(int projector_size, unsigned coarse_bits)
+{
+    unsigned bits = get_pattern_bits(projector_size);
+    return (coarse_bits<bits ? (2<<(bits - coarse_bits)) : 0);
+}
+
 inline int sl::binaryToGray(int value, unsigned offset) {return util_binaryToGray(value + offset);}
 inline int sl::grayToBinary(int value, unsigned offset) {return (util_grayToBinary(value, 32) - offset);}
 
+sl::CodeImage::CodeImage() :
+    codes(),
+    mask(),
+    fraction(),
+    offset()
+{
+}
+
+//integer code and fraction of a valid pattern value in [0,65536)
+static inline void split_code(float value, unsigned short & code, unsigned char & fraction)
+{
+    int c = static_cast<int>(value);
+    int f = static_cast<int>((value - c)*sl::CodeImage::FRACTION_SCALE + 0.5f);
+    if (f>=sl::CodeImage::FRACTION_SCALE)
+    {   //rounded up to the next code
+        f = (c<65535 ? 0 : sl::CodeImage::FRACTION_SCALE - 1);
+        c = (c<65535 ? c + 1 : c);
+    }
+    code = static_cast<unsigned short>(c);
+    fraction = static_cast<unsigned char>(f);
+}
+
+sl::CodeImage::CodeImage(const cv::Mat & pattern_image, cv::Point const& offset) :
+    codes(),
+    mask(),
+    fraction(),
+    offset(offset)
+{
+    if (pattern_image.rows==0 || pattern_image.type()!=CV_32FC2)
+    {   //invalid pattern image
+        return;
+    }
+
+    //the fraction is dropped afterwards if every code is an integer
+    create(pattern_image.size(), true);
+    std::atomic<bool> fractional(false);
+    cv::parallel_for_(cv::Range(0, pattern_image.rows), [&](const cv::Range & range)
+    {
+        bool any_fraction = false;
+        for (int h=range.start; h<range.end; h++)
+        {
+            const cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
+            cv::Vec2w * codes_row = codes.ptr<cv::Vec2w>(h);
+            cv::Vec2b * fraction_row = fraction.ptr<cv::Vec2b>(h);
+            unsigned char * mask_row = mask.ptr<unsigned char>(h);
+            memset(mask_row, 0, mask.cols);
+            for (int w=0; w<pattern_image.cols; w++)
+            {
+                const cv::Vec2f & pattern = pattern_row[w];
+                if (INVALID(pattern) || pattern[0]<0.f || pattern[1]<0.f || pattern[0]>=65536.f || pattern[1]>=65536.f)
+                {   //invalid: code is never read
+                    codes_row[w] = cv::Vec2w(0, 0);
+                    fraction_row[w] = cv::Vec2b(0, 0);
+                    continue;
+                }
+                split_code(pattern[0], codes_row[w][0], fraction_row[w][0]);
+                split_code(pattern[1], codes_row[w][1], fraction_row[w][1]);
+                any_fraction = any_fraction || fraction_row[w][0] || fraction_row[w][1];
+                mask_row[w>>3] |= static_cast<unsigned char>(1<<(w&7));
+            }
+        }
+        if (any_fraction)
+        {
+            fractional = true;
+        }
+    }, row_stripes(pattern_image.rows, pattern_image.cols*(sizeof(cv::Vec2f) + sizeof(cv::Vec2w) + sizeof(cv::Vec2b))));
+    if (!fractional)
+    {
+        fraction = cv::Mat();
+    }
+}
+
+void sl::CodeImage::create(cv::Size const& size, bool fractional)
+{
+    codes.create(size, CV_16UC2);
+    mask = cv::Mat::zeros(size.height, (size.width + 7)/8, CV_8UC1);
+    if (fractional)
+    {
+        fraction.create(size, CV_8UC2);
+    }
+    else
+    {
+        fraction = cv::Mat();
+    }
+}
+
+void sl::CodeImage::release(void)
+{
+    codes = cv::Mat();
+    mask = cv::Mat();
+    fraction = cv::Mat();
+    offset = cv::Point();
+}
+
+cv::Mat sl::CodeImage::to_pattern(void) const
+{
+    if (empty())
+    {
+        return cv::Mat();
+    }
+
+    cv::Mat pattern_image(size(), CV_32FC2);
+    for (int h=0; h<pattern_image.rows; h++)
+    {
+        const cv::Vec2w * codes_row = this->codes_row(h);
+        const cv::Vec2b * fraction_row = this->fraction_row(h);
+        const unsigned char * mask_row = this->mask_row(h);
+        cv::Vec2f * pattern_row = pattern_image.ptr<cv::Vec2f>(h);
+        for (int w=0; w<pattern_image.cols; w++)
+        {
+            cv::Point2f code = code_point(codes_row, fraction_row, w);
+            pattern_row[w] = (valid(mask_row, w) ? cv::Vec2f(code.x, code.y) : cv::Vec2f(PIXEL_UNCERTAIN, PIXEL_UNCERTAIN));
+        }
+    }
+    return pattern_image;
+}
+
+//display color of t in [0,255]: black -> red -> red,green -> green -> blue
+static cv::Vec3b pattern_color(float t)
+{
+    float n = 4.f;
+    float dt = 255.f/n;
+    float c1 = 0.f, c2 = 0.f, c3 = 0.f;
+    if (t<=1.f*dt)
+    {   //black -> red
+        float c = n*(t-0.f*dt);
+        c1 = c;     //0-255
+        c2 = 0.f;   //0
+        c3 = 0.f;   //0
+    }
+    else if (t<=2.f*dt)
+    {   //red -> red,green
+        float c = n*(t-1.f*dt);
+        c1 = 255.f; //255
+        c2 = c;     //0-255
+        c3 = 0.f;   //0
+    }
+    else if (t<=3.f*dt)
+    {   //red,green -> green
+        float c = n*(t-2.f*dt);
+        c1 = 255.f-c;   //255-0
+        c2 = 255.f;     //255
+        c3 = 0.f;       //0
+    }
+    else if (t<=4.f*dt)
+    {   //green -> blue
+        float c = n*(t-3.f*dt);
+        c1 = 0.f;       //0
+        c2 = 255.f-c;   //255-0
+        c3 = c;         //0-255
+    }
+    return cv::Vec3b(static_cast<uchar>(c3), static_cast<uchar>(c2), static_cast<uchar>(c1));
+}
+
 cv::Mat sl::colorize_pattern(const cv::Mat & pattern_image, unsigned set, float max_value)
 {
     if (pattern_image.rows==0)
@@ -421,53 +2443,99 @@ cv::Mat sl::colorize_pattern(const cv::Mat & pattern_image, unsigned set, float
 
     cv::Mat image(pattern_image.size(), CV_8UC3);
 
-    float max_t = max_value;
-    float n = 4.f;
-    float dt = 255.f/n;
-    for (int h=0; h<pattern_image.rows; h++)
+    //codes are fractional: colors of 1024 levels between 0 and max_value
+    static const int LUT_SIZE = 1024;
+    cv::Vec3b lut[LUT_SIZE];
+    for (int i=0; i<LUT_SIZE; i++)
     {
-        const cv::Vec2f * row1 = pattern_image.ptr<cv::Vec2f>(h);
-        cv::Vec3b * row2 = image.ptr<cv::Vec3b>(h);
-        for (int w=0; w<pattern_image.cols; w++)
+        lut[i] = pattern_color(i*255.f/(LUT_SIZE - 1));
+    }
+    const float to_index = (max_value>0.f ? (LUT_SIZE - 1)/max_value : 0.f);
+    const cv::Vec3b grey(128, 128, 128);
+
+    cv::parallel_for_(cv::Range(0, pattern_image.rows), [&](const cv::Range & range)
+    {
+        for (int h=range.start; h<range.end; h++)
         {
-            if (row1[w][set]>max_value || INVALID(row1[w][set]))
-            {   //invalid value: use grey
-                row2[w] = cv::Vec3b(128, 128, 128);
-                continue;
+            const cv::Vec2f * row1 = pattern_image.ptr<cv::Vec2f>(h);
+            cv::Vec3b * row2 = image.ptr<cv::Vec3b>(h);
+            for (int w=0; w<pattern_image.cols; w++)
+            {
+                float value = row1[w][set];
+                //invalid value: use grey (NaN fails both comparisons)
+                row2[w] = (value>=0.f && value<=max_value ? lut[static_cast<int>(value*to_index + 0.5f)] : grey);
             }
-            //display
-            float t = row1[w][set]*255.f/max_t;
-            float c1 = 0.f, c2 = 0.f, c3 = 0.f;
-            if (t<=1.f*dt)
-            {   //black -> red
-                float c = n*(t-0.f*dt);
-                c1 = c;     //0-255
-                c2 = 0.f;   //0
-                c3 = 0.f;   //0
-            }
-            else if (t<=2.f*dt)
-            {   //red -> red,green
-                float c = n*(t-1.f*dt);
-                c1 = 255.f; //255
-                c2 = c;     //0-255
-                c3 = 0.f;   //0
-            }
-            else if (t<=3.f*dt)
-            {   //red,green -> green
-                float c = n*(t-2.f*dt);
-                c1 = 255.f-c;   //255-0
-                c2 = 255.f;     //255
-                c3 = 0.f;       //0
-            }
-            else if (t<=4.f*dt)
-            {   //green -> blue
-                float c = n*(t-3.f*dt);
-                c1 = 0.f;       //0
-                c2 = 255.f-c;   //255-0
-                c3 = c;         //0-255
-            }
-            row2[w] = cv::Vec3b(static_cast<uchar>(c3), static_cast<uchar>(c2), static_cast<uchar>(c1));
         }
-    }
+    }, row_stripes(pattern_image.rows, pattern_image.cols*(sizeof(cv::Vec2f) + sizeof(cv::Vec3b))));
+
     return image;
 }
+
+bool sl::colorize_codes(const CodeImage & code_image, const cv::Mat & min_max_image, int threshold, cv::Size const& image_size, 
+                        cv::Size const& max_value, cv::Mat & col_image, cv::Mat & row_image)
+{
+    col_image = cv::Mat();
+    row_image = cv::Mat();
+    if (code_image.empty() || min_max_image.size()!=code_image.size() 
+        || (min_max_image.type()!=CV_8UC2 && min_max_image.type()!=CV_16UC2) || image_size.area()<1)
+    {   //invalid decoded set
+        return false;
+    }
+
+    //codes are integers: one color per code value
+    const int max_code[2] = {std::max(0, std::min(max_value.width, 65535)), std::max(0, std::min(max_value.height, 65535))};
+    std::vector<cv::Vec3b> lut[2];
+    for (int i=0; i<2; i++)
+    {
+        lut[i].resize(max_code[i] + 1);
+        for (int code=0; code<=max_code[i]; code++)
+        {
+            lut[i][code] = pattern_color(max_code[i]>0 ? code*255.f/max_code[i] : 0.f);
+        }
+    }
+
+    col_image.create(image_size, CV_8UC3);
+    row_image.create(image_size, CV_8UC3);
+    const cv::Vec3b grey(128, 128, 128);
+    const cv::Rect roi = code_image.roi() & cv::Rect(cv::Point(), image_size);
+    const cv::Point offset = code_image.offset;
+    const bool wide = (min_max_image.depth()==CV_16U);
+
+    cv::parallel_for_(cv::Range(0, image_size.height), [&](const cv::Range & range)
+    {
+        for (int h=range.start; h<range.end; h++)
+        {
+            cv::Vec3b * col_row = col_image.ptr<cv::Vec3b>(h);
+            cv::Vec3b * row_row = row_image.ptr<cv::Vec3b>(h);
+            if (h<roi.y || h>=roi.br().y)
+            {   //not decoded
+                std::fill(col_row, col_row + image_size.width, grey);
+                std::fill(row_row, row_row + image_size.width, grey);
+                continue;
+            }
+            std::fill(col_row, col_row + roi.x, grey);
+            std::fill(row_row, row_row + roi.x, grey);
+            std::fill(col_row + roi.br().x, col_row + image_size.width, grey);
+            std::fill(row_row + roi.br().x, row_row + image_size.width, grey);
+
+            //threshold and color in the same pass
+            const cv::Vec2w * codes_row = code_image.codes_row(h - offset.y);
+            const unsigned char * mask_row = code_image.mask_row(h - offset.y);
+            const unsigned char * min_max_row = min_max_image.ptr<unsigned char>(h - offset.y);
+            for (int w=roi.x - offset.x; w<roi.br().x - offset.x; w++)
+            {
+                if (!CodeImage::valid(mask_row, w) || get_contrast(min_max_row, w, wide)<threshold)
+                {   //invalid
+                    col_row[w + offset.x] = grey;
+                    row_row[w + offset.x] = grey;
+                    continue;
+                }
+                const cv::Vec2w & code = codes_row[w];
+                col_row[w + offset.x] = (code[0]<=max_code[0] ? lut[0][code[0]] : grey);
+                row_row[w + offset.x] = (code[1]<=max_code[1] ? lut[1][code[1]] : grey);
+            }
+        }
+    }, row_stripes(image_size.height, image_size.width*(2*sizeof(cv::Vec3b)) + code_image.codes.cols*(sizeof(cv::Vec2w) + min_max_image.elemSize())));
+
+    return true;
+}
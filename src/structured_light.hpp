@@ -30,6 +30,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <opencv2/core.hpp>
 
+#include <memory>
+
 #ifndef _MSC_VER
 #  ifndef _isnan
 #    include <math.h>
@@ -37,20 +39,55 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #  endif
 #endif
 
+class FrameStack;
+
 namespace sl
 {
-    enum DecodeFlags {SimpleDecode = 0x00, GrayPatternDecode = 0x01, RobustDecode = 0x02};
+    enum DecodeFlags {SimpleDecode = 0x00, GrayPatternDecode = 0x01, RobustDecode = 0x02, ReferenceDecode = 0x04 /* scalar kernel, no SIMD */,
+                      CompactDecode = 0x08 /* skip pixels that can no longer get a valid code */,
+                      SingleImageDecode = 0x10 /* one image per bit, thresholded at the white/black midpoint */,
+                      ColumnsOnlyDecode = 0x20 /* vertical patterns only: the row code is always 0 */,
+                      BitStatsDecode = 0x40 /* measure how many pixels resolve each bit */,
+                      PackedDecode = 0x80 /* pairs are binarized to 1 bit/pixel planes, codes are assembled by Decoder::finish() */,
+                      ReportDecode = 0x100 /* collect the DecodeStats counts: contrast histogram, uncertain pixels per bit */};
+
+    struct DecodeStats;
 
     extern const float PIXEL_UNCERTAIN;
     extern const unsigned short BIT_UNCERTAIN;
 
+    //robust mode: when direct_light is empty it is estimated (with b) from the get_direct_light_images() frames, 
+    //loaded before the pattern pairs so that every pair is decoded as it is loaded, and returned.
+    //8 bit sets give CV_8UC2 min_max_image and direct_light, 16 bit sets (12/16 bit cameras) CV_16UC2: m, roi_threshold
+    //and the reconstruction threshold are in image intensity units
     bool decode_pattern(const std::vector<std::string> & images, cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Size const& projector_size,
-                        unsigned flags = SimpleDecode, const cv::Mat & direct_light = cv::Mat(), unsigned m = 5);
+                        unsigned flags, cv::Mat & direct_light, float b = 0.5f, unsigned m = 5, unsigned prefetch = 0, 
+                        unsigned phase_steps = 0, unsigned roi_threshold = 0, cv::Point * roi_offset = NULL, DecodeStats * stats = NULL);
     unsigned short get_robust_bit(unsigned value1, unsigned value2, unsigned Ld, unsigned Lg, unsigned m);
     void convert_pattern(cv::Mat & pattern_image, cv::Size const& projector_size, const int offset[2], bool binary);
+    //binary codes of a set projected with fewer bits (pattern_size is projector_size halved k times, see ProjectorWidget::get_effective_size) 
+    //moved to the projector_size grid: the coarse Gray bits select a block of 2^k projector pixels, codes get the block center.
+    //Returns false when pattern_size is not a reduced projector_size
+    bool scale_pattern(cv::Mat & pattern_image, cv::Size const& pattern_size, cv::Size const& projector_size, bool columns_only = false);
     cv::Mat estimate_direct_light(const std::vector<cv::Mat> & images, float b);
+    //indices of the high frequency images used to estimate the direct light, empty when the set is too short
+    std::vector<unsigned> get_direct_light_images(int total_images, bool columns_only = false);
+
+    //frame stack frames (FrameStack::frame_name) are views of the mapped file: stack, when given, is set to the stack
+    //of the frame and keeps it mapped while the frame is used, FrameStack::release_shared() only drops the shared reference
+    cv::Mat get_gray_image(const std::string & filename, std::shared_ptr<FrameStack> * stack = NULL);
+
+    //max-min of pixel w of a min/max image row: CV_8UC2, or CV_16UC2 when wide
+    static inline int get_contrast(const unsigned char * min_max_row, int w, bool wide)
+    {
+        if (wide)
+        {
+            const unsigned short * min_max = reinterpret_cast<const unsigned short *>(min_max_row) + 2*w;
+            return static_cast<int>(min_max[1]) - static_cast<int>(min_max[0]);
+        }
+        return static_cast<int>(min_max_row[2*w + 1]) - static_cast<int>(min_max_row[2*w]);
+    }
 
-    cv::Mat get_gray_image(const std::string & filename);
     static inline bool INVALID(float value) {return _isnan(value)>0;}
     static inline bool INVALID(const cv::Vec2f & pt) {return _isnan(pt[0]) || _isnan(pt[1]);}
     static inline bool INVALID(const cv::Vec3f & pt) {return _isnan(pt[0]) || _isnan(pt[1]) || _isnan(pt[2]);}
@@ -60,6 +97,223 @@ namespace sl
     inline int grayToBinary(int value, unsigned offset);
 
     cv::Mat colorize_pattern(const cv::Mat & pattern_image, unsigned set, float max_value);
+
+    //Gray code + phase shift: the coarse Gray bits select a stripe of 2^(projector bits - coarse bits) pixels, 
+    //the sinusoid period is twice the stripe width
+    unsigned get_pattern_bits(int projector_size);
+    int get_phase_period(int projector_size, unsigned coarse_bits);
+
+    //per bit pair statistics over the pixels lit by the projector (where the most significant bit resolves)
+    struct BitStats
+    {
+        unsigned channel;   //0: vertical, 1: horizontal
+        unsigned bit;       //from bits-1 (coarse) to 0 (fine)
+        double resolved;    //fraction of lit pixels with |value1-value2|>=m
+        double contrast;    //mean |value1-value2| of lit pixels
+    };
+    //leading bits of every direction with resolved>=min_resolved
+    unsigned get_usable_bits(const std::vector<BitStats> & stats, double min_resolved);
+
+    //decode report of one set: pixel counts are over the decoded region, times in milliseconds
+    struct DecodeStats
+    {
+        DecodeStats();
+
+        cv::Size image_size;
+        cv::Rect roi;
+        unsigned bits;
+        bool columns_only;
+        int64_t shadow_pixels;      //white/black contrast<m
+        int64_t valid_pixels;       //valid code in every direction
+        std::vector<int64_t> contrast_histogram;    //white/black |contrast|, 256 bins of contrast_bin_width, the last one is open
+        unsigned contrast_bin_width;                //1, or 256 for 16 bit sets
+        std::vector<int64_t> uncertain_pixels;      //per pair in push order: pixels without a valid code after that pair
+        std::vector<BitStats> bit_stats;            //BitStatsDecode only
+
+        //stages: image loading (file read and gray conversion, summed over the loader threads), time the decoder
+        //waited for images, direct/global light estimation, pair comparison, packed code assembly, gray to binary, phase
+        double total_ms;
+        double load_ms;
+        double wait_ms;
+        double direct_light_ms;
+        double compare_ms;
+        double assemble_ms;
+        double convert_ms;
+        double phase_ms;
+        unsigned load_threads;
+    };
+
+    //direct/global light separation: running per pixel min/max of any number of high frequency images (CV_8UC1 or CV_16UC1),
+    //estimate() returns Ld and Lg (CV_8UC2 or CV_16UC2)
+    class DirectLightEstimator
+    {
+    public:
+        DirectLightEstimator();
+
+        void reset(void);
+        bool push(const cv::Mat & gray_image);
+        cv::Mat estimate(float b) const;
+
+        inline unsigned count(void) const {return _count;}
+
+    private:
+        unsigned _count;
+        cv::Mat _min_image;
+        cv::Mat _max_image;
+    };
+
+    //decoded pattern as integer projector column/row codes (CV_16UC2) plus a validity
+    //bitmask (CV_8UC1, bit w%8 of byte w/8 is set when both codes of pixel w are valid).
+    //Fractional codes (phase shift) keep the fraction in 1/FRACTION_SCALE projector pixels (CV_8UC2),
+    //fraction is empty when every code is an integer
+    class CodeImage
+    {
+    public:
+        static const int FRACTION_SCALE = 256;
+
+        CodeImage();
+        explicit CodeImage(const cv::Mat & pattern_image, cv::Point const& offset = cv::Point());
+
+        void create(cv::Size const& size, bool fractional = false);
+        void release(void);
+
+        inline bool empty(void) const {return codes.empty();}
+        inline cv::Size size(void) const {return codes.size();}
+        inline cv::Rect roi(void) const {return cv::Rect(offset, codes.size());}
+
+        inline const cv::Vec2w * codes_row(int h) const {return codes.ptr<cv::Vec2w>(h);}
+        inline const unsigned char * mask_row(int h) const {return mask.ptr<unsigned char>(h);}
+        inline const cv::Vec2b * fraction_row(int h) const {return (fraction.empty() ? NULL : fraction.ptr<cv::Vec2b>(h));}
+        static inline bool valid(const unsigned char * mask_row, int w) {return ((mask_row[w>>3]>>(w&7)) & 1)!=0;}
+        inline bool valid(int h, int w) const {return valid(mask_row(h), w);}
+        inline bool fractional(void) const {return !fraction.empty();}
+
+        //projector column/row of pixel w: the code plus its fraction (fraction_row may be NULL)
+        static inline cv::Point2f code_point(const cv::Vec2w * codes_row, const cv::Vec2b * fraction_row, int w)
+        {
+            const cv::Vec2w & code = codes_row[w];
+            if (!fraction_row)
+            {
+                return cv::Point2f(code[0], code[1]);
+            }
+            const float step = 1.f/FRACTION_SCALE;
+            return cv::Point2f(code[0] + step*fraction_row[w][0], code[1] + step*fraction_row[w][1]);
+        }
+        inline cv::Point2f code_point(int h, int w) const {return code_point(codes_row(h), fraction_row(h), w);}
+
+        //CV_32FC2 pattern image, invalid pixels set to PIXEL_UNCERTAIN
+        cv::Mat to_pattern(void) const;
+
+        cv::Mat codes;
+        cv::Mat mask;
+        cv::Mat fraction;
+        cv::Point offset;   //camera pixel of codes(0,0), not zero when only a region of interest was decoded
+    };
+
+    //column and row images (CV_8UC3, image_size) of a decoded set in one pass: codes are colorized from 0 to max_value, 
+    //invalid codes, pixels with contrast<threshold and pixels outside the decoded region are grey
+    bool colorize_codes(const CodeImage & code_image, const cv::Mat & min_max_image, int threshold, cv::Size const& image_size, 
+                        cv::Size const& max_value, cv::Mat & col_image, cv::Mat & row_image);
+
+    //incremental decoder: image pairs are pushed in projection order (white/black pair first,
+    //then vertical and horizontal bits, most significant first) as soon as they are captured.
+    //In robust mode without a direct light image the pairs are kept until set_direct_light(), or until the images
+    //given to estimate_direct_light() have been pushed. When the images can be read ahead, set_direct_light_images()
+    //after the white/black pair estimates it at once and no pair is kept.
+    //In single image mode the white/black pair is followed by one image per bit (push_image).
+    //With phase_steps>0 the Gray bits are coarse and the phase shifted images are pushed with push_phase(),
+    //vertical first: codes get the fractional projector column/row.
+    //With roi_threshold>0 only the bounding box of the pixels with white/black contrast>=roi_threshold is decoded,
+    //finish() returns its offset (or pads the result to the image size when no offset is requested).
+    //PackedDecode keeps 1 bit per pixel and pair instead of the float codes until finish().
+    //Images are CV_8UC1, or CV_16UC1 with depth=CV_16U: min/max and direct light images have the same depth.
+    class Decoder
+    {
+    public:
+        Decoder();
+
+        bool begin(cv::Size const& size, cv::Size const& projector_size, unsigned bits, unsigned flags = SimpleDecode, 
+                   const cv::Mat & direct_light = cv::Mat(), unsigned m = 5, unsigned phase_steps = 0, unsigned roi_threshold = 0,
+                   int depth = CV_8U);
+        bool push_pair(const cv::Mat & gray_image1, const cv::Mat & gray_image2);
+        bool push_image(const cv::Mat & gray_image);
+        bool push_phase(const cv::Mat & gray_image);
+        bool set_direct_light(const cv::Mat & direct_light);
+        bool estimate_direct_light(const std::vector<unsigned> & images, float b);
+        bool set_direct_light_images(const std::vector<cv::Mat> & images, float b);
+        bool finish(cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Point * roi_offset = NULL, DecodeStats * stats = NULL);
+        void reset(void);
+
+        inline bool started(void) const {return _size.width>0;}
+        inline unsigned pair_count(void) const {return 1 + ((_flags & ColumnsOnlyDecode) ? 1 : 2)*_bits;}
+        inline unsigned phase_count(void) const {return ((_flags & ColumnsOnlyDecode) ? 1 : 2)*_phase_steps;}
+        inline unsigned pushed(void) const {return _pushed;}
+        inline double compare_ms(void) const {return _compare_ms;}
+        inline const cv::Mat & direct_light(void) const {return _direct_light;}
+        inline const std::vector<BitStats> & bit_stats(void) const {return _bit_stats;}
+
+    private:
+        void decode_pair(const cv::Mat & gray_image1, const cv::Mat & gray_image2, unsigned pair);
+        template <typename T> void decode_pair_depth(const cv::Mat & gray_image1, const cv::Mat & gray_image2, unsigned pair);
+        void init_active_spans(int h);
+        void assemble_codes(void);
+        int64_t count_uncertain(void) const;
+        void decode_phase(void);
+        void allocate(cv::Rect const& roi);
+
+        cv::Size _image_size;
+        int _depth;         //CV_8U or CV_16U
+        cv::Rect _roi;      //decoded region, the whole image unless roi_threshold>0
+        unsigned _roi_threshold;
+        cv::Size _size;     //region size: every buffer below is this size
+        cv::Size _projector_size;
+        unsigned _bits;
+        unsigned _flags;
+        unsigned _m;
+        unsigned _pushed;
+        bool _init;
+        double _compare_ms;
+        cv::Mat _direct_light;
+        cv::Mat _pattern_image;
+        cv::Mat _min_max_image;
+        std::vector<std::pair<cv::Mat, cv::Mat> > _pending;
+
+        //direct light estimated from pushed images: their indices in projection order (white/black pair is 0 and 1)
+        std::vector<unsigned> _direct_light_images;
+        DirectLightEstimator _light_estimator;
+        float _b;
+        double _direct_light_ms;
+
+        //PackedDecode: one bit plane per decoded pair (CV_8UC1, bit w%8 of byte w/8 is pixel w) and 
+        //the uncertain pixels of each direction; _pattern_image is only allocated by finish()
+        std::vector<cv::Mat> _bit_planes;
+        cv::Mat _uncertain_planes[2];
+
+        //CompactDecode and SingleImageDecode: white/black pair (not kept in robust mode), 
+        //white/black midpoint (SingleImageDecode) and active pixel spans [start,end) of each row (CompactDecode)
+        cv::Mat _white_image;
+        cv::Mat _black_image;
+        cv::Mat _threshold_image;
+        std::vector<std::vector<cv::Vec2i> > _spans;
+
+        //phase shift: sums of image*sin and image*cos of the phase steps, per direction
+        unsigned _phase_steps;
+        unsigned _phase_pushed;
+        cv::Mat _phase_sin[2];
+        cv::Mat _phase_cos[2];
+
+        //BitStatsDecode: lit pixels (first pair resolved) and the stats of every pair
+        cv::Mat _lit_image;
+        std::vector<BitStats> _bit_stats;
+
+        //ReportDecode: counts and stage times for DecodeStats
+        std::vector<int64_t> _contrast_histogram;
+        int64_t _shadow_pixels;
+        std::vector<int64_t> _uncertain_counts;
+        double _assemble_ms;
+        double _convert_ms;
+        double _phase_ms;
+    };
 };
 
 #endif //__STRUCTURED_LIGHT_HPP__
@@ -0,0 +1,220 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//CalibrationData ray tables: exact cv::undistortPoints rays at integer pixels, bilinear rays between them
+//within a small fraction of a pixel, clamping at the borders, and rebuilding when the size or intrinsics change
+
+#include "CalibrationData.hpp"
+#include "test_util.hpp"
+
+#include <opencv2/calib3d.hpp>
+
+//intrinsics of a 640x480 camera with a noticeable barrel distortion and of a 1024x768 projector
+static CalibrationData test_calibration(void)
+{
+    CalibrationData calib;
+    calib.cam_K = cv::Mat::zeros(3, 3, CV_64FC1);
+    calib.cam_K.at<double>(0,0) = 700.0; calib.cam_K.at<double>(0,2) = 320.0;
+    calib.cam_K.at<double>(1,1) = 705.0; calib.cam_K.at<double>(1,2) = 240.0;
+    calib.cam_K.at<double>(2,2) = 1.0;
+    calib.cam_kc = cv::Mat::zeros(1, 5, CV_64FC1);
+    calib.cam_kc.at<double>(0,0) = -0.2; calib.cam_kc.at<double>(0,1) = 0.05;
+    calib.cam_kc.at<double>(0,2) = 0.001; calib.cam_kc.at<double>(0,3) = -0.001;
+    calib.proj_K = cv::Mat::zeros(3, 3, CV_64FC1);
+    calib.proj_K.at<double>(0,0) = 2000.0; calib.proj_K.at<double>(0,2) = 512.0;
+    calib.proj_K.at<double>(1,1) = 2000.0; calib.proj_K.at<double>(1,2) = 700.0;
+    calib.proj_K.at<double>(2,2) = 1.0;
+    calib.proj_kc = cv::Mat::zeros(1, 5, CV_64FC1);
+    calib.proj_kc.at<double>(0,0) = 0.05; calib.proj_kc.at<double>(0,1) = -0.1;
+    return calib;
+}
+
+static cv::Point2d undistort(const cv::Mat & K, const cv::Mat & kc, double x, double y)
+{
+    cv::Mat inp(1, 1, CV_64FC2), outp;
+    inp.at<cv::Vec2d>(0, 0) = cv::Vec2d(x, y);
+    cv::undistortPoints(inp, outp, K, kc);
+    const cv::Vec2d & ray = outp.at<cv::Vec2d>(0, 0);
+    return cv::Point2d(ray[0], ray[1]);
+}
+
+//largest difference of a ray to the undistortPoints ray, in pixels of the focal length
+static double ray_error(const cv::Point2d & ray, const cv::Point2d & expected, const cv::Mat & K)
+{
+    return std::max(std::abs(ray.x - expected.x)*K.at<double>(0,0), std::abs(ray.y - expected.y)*K.at<double>(1,1));
+}
+
+static bool table_matches(const cv::Mat & rays, const cv::Mat & K, const cv::Mat & kc)
+{
+    bool same = true;
+    for (int h=0; h<rays.rows && same; h+=7)
+    {
+        for (int w=0; w<rays.cols && same; w+=5)
+        {
+            const cv::Vec2d & ray = rays.at<cv::Vec2d>(h, w);
+            same = ray_error(cv::Point2d(ray[0], ray[1]), undistort(K, kc, w, h), K)<1e-9;
+        }
+    }
+    return same;
+}
+
+static void test_integer_pixels(void)
+{
+    CalibrationData calib = test_calibration();
+    const cv::Size camera_size(640, 480), projector_size(1024, 768);
+
+    const cv::Mat & cam_rays = calib.get_camera_rays(camera_size);
+    CHECK(cam_rays.size()==camera_size && cam_rays.type()==CV_64FC2);
+    CHECK(table_matches(cam_rays, calib.cam_K, calib.cam_kc));
+    const cv::Mat & proj_rays = calib.get_projector_rays(projector_size);
+    CHECK(proj_rays.size()==projector_size && proj_rays.type()==CV_64FC2);
+    CHECK(table_matches(proj_rays, calib.proj_K, calib.proj_kc));
+
+    //corners, and integer positions read back the table entries
+    const int corners[4][2] = {{0, 0}, {camera_size.width - 1, 0}, {0, camera_size.height - 1}, {camera_size.width - 1, camera_size.height - 1}};
+    for (int i=0; i<4; i++)
+    {
+        const int w = corners[i][0], h = corners[i][1];
+        const cv::Vec2d & ray = cam_rays.at<cv::Vec2d>(h, w);
+        CHECK(ray_error(cv::Point2d(ray[0], ray[1]), undistort(calib.cam_K, calib.cam_kc, w, h), calib.cam_K)<1e-9);
+        CHECK(CalibrationData::interpolate_ray(cam_rays, w, h)==cv::Point2d(ray[0], ray[1]));
+    }
+}
+
+//bilinear error at random fractional positions, with OpenCV 1.8e-4 px for the camera and 4e-6 px for the projector
+static void test_fractional_pixels(void)
+{
+    CalibrationData calib = test_calibration();
+    const cv::Size camera_size(640, 480), projector_size(1024, 768);
+    std::mt19937 rng(24);
+
+    struct {const cv::Mat * rays; const cv::Mat * K; const cv::Mat * kc; const char * name;} tables[2] = {
+        {&calib.get_camera_rays(camera_size), &calib.cam_K, &calib.cam_kc, "camera"},
+        {&calib.get_projector_rays(projector_size), &calib.proj_K, &calib.proj_kc, "projector"}};
+    for (int t=0; t<2; t++)
+    {
+        const cv::Mat & rays = *tables[t].rays;
+        std::uniform_real_distribution<double> x(0.0, rays.cols - 1.0), y(0.0, rays.rows - 1.0);
+        double max_error = 0.0;
+        for (int i=0; i<20000; i++)
+        {
+            const double px = x(rng), py = y(rng);
+            cv::Point2d expected = undistort(*tables[t].K, *tables[t].kc, px, py);
+            max_error = std::max(max_error, ray_error(CalibrationData::interpolate_ray(rays, px, py), expected, *tables[t].K));
+        }
+        std::cout << "[calibration_rays_test] " << tables[t].name << " bilinear error " << max_error << " px\n";
+        CHECK(max_error<1e-3);
+    }
+}
+
+//positions outside the table read the nearest border ray
+static void test_border_clamping(void)
+{
+    CalibrationData calib = test_calibration();
+    const cv::Mat & rays = calib.get_camera_rays(cv::Size(640, 480));
+    const int last_x = rays.cols - 1, last_y = rays.rows - 1;
+    const cv::Vec2d & first = rays.at<cv::Vec2d>(0, 0);
+    const cv::Vec2d & last = rays.at<cv::Vec2d>(last_y, last_x);
+
+    CHECK(CalibrationData::interpolate_ray(rays, -5.0, -3.5)==cv::Point2d(first[0], first[1]));
+    CHECK(CalibrationData::interpolate_ray(rays, last_x + 10.0, last_y + 0.5)==cv::Point2d(last[0], last[1]));
+    CHECK(CalibrationData::interpolate_ray(rays, last_x, last_y)==cv::Point2d(last[0], last[1]));
+    CHECK(CalibrationData::interpolate_ray(rays, -1.0, 100.25)==CalibrationData::interpolate_ray(rays, 0.0, 100.25));
+    CHECK(CalibrationData::interpolate_ray(rays, 200.75, last_y + 3.0)==CalibrationData::interpolate_ray(rays, 200.75, last_y));
+
+    //the last column and row interpolate along the border only
+    const cv::Vec2d & a = rays.at<cv::Vec2d>(10, last_x);
+    const cv::Vec2d & b = rays.at<cv::Vec2d>(11, last_x);
+    cv::Point2d ray = CalibrationData::interpolate_ray(rays, last_x, 10.5);
+    CHECK(std::abs(ray.x - 0.5*(a[0] + b[0]))<1e-15 && std::abs(ray.y - 0.5*(a[1] + b[1]))<1e-15);
+}
+
+//a sentinel written in a table survives calls that must not rebuild it
+static void mark(const cv::Mat & rays)
+{
+    const_cast<cv::Mat &>(rays).at<cv::Vec2d>(0, 0) = cv::Vec2d(100.0, 100.0);
+}
+
+static bool marked(const cv::Mat & rays)
+{
+    return rays.at<cv::Vec2d>(0, 0)==cv::Vec2d(100.0, 100.0);
+}
+
+static void test_rebuild(void)
+{
+    CalibrationData calib = test_calibration();
+    const cv::Size camera_size(640, 480), projector_size(1024, 768);
+
+    const cv::Mat & rays = calib.get_camera_rays(camera_size);
+    mark(rays);
+    CHECK(marked(calib.get_camera_rays(camera_size)));
+
+    //equal values in new matrices, and the projector table, leave the camera table alone
+    calib.cam_K = calib.cam_K.clone();
+    calib.cam_kc = calib.cam_kc.clone();
+    calib.get_projector_rays(projector_size);
+    CHECK(marked(calib.get_camera_rays(camera_size)));
+
+    //intrinsics changed in place
+    calib.cam_kc.at<double>(0,0) = -0.3;
+    CHECK(!marked(calib.get_camera_rays(camera_size)));
+    CHECK(table_matches(calib.get_camera_rays(camera_size), calib.cam_K, calib.cam_kc));
+    mark(calib.get_camera_rays(camera_size));
+    calib.cam_K.at<double>(0,2) = 330.0;
+    CHECK(!marked(calib.get_camera_rays(camera_size)));
+    CHECK(table_matches(calib.get_camera_rays(camera_size), calib.cam_K, calib.cam_kc));
+
+    //new size
+    mark(calib.get_camera_rays(camera_size));
+    const cv::Mat & small_rays = calib.get_camera_rays(cv::Size(320, 240));
+    CHECK(small_rays.size()==cv::Size(320, 240) && !marked(small_rays));
+    CHECK(table_matches(small_rays, calib.cam_K, calib.cam_kc));
+
+    //projector table keeps its own intrinsics
+    mark(calib.get_projector_rays(projector_size));
+    calib.proj_kc.at<double>(0,1) = 0.0;
+    CHECK(!marked(calib.get_projector_rays(projector_size)));
+    CHECK(table_matches(calib.get_projector_rays(projector_size), calib.proj_K, calib.proj_kc));
+
+    //clear() drops the tables
+    CalibrationData cleared = test_calibration();
+    cleared.get_camera_rays(cv::Size(320, 240));
+    mark(cleared.get_camera_rays(cv::Size(320, 240)));
+    cleared.clear();
+    cleared.cam_K = calib.cam_K.clone();
+    cleared.cam_kc = calib.cam_kc.clone();
+    CHECK(!marked(cleared.get_camera_rays(cv::Size(320, 240))));
+}
+
+int main(int /*argc*/, char ** /*argv*/)
+{
+    test_integer_pixels();
+    test_fractional_pixels();
+    test_border_clamping();
+    test_rebuild();
+    return test_result("calibration_rays_test");
+}
@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//sl::CodeImage: integer codes, validity mask and the fraction of phase shift codes
+
+#include "structured_light.hpp"
+#include "test_util.hpp"
+
+static void test_integer_codes(void)
+{
+    cv::Mat pattern_image(3, 20, CV_32FC2);
+    for (int h=0; h<pattern_image.rows; h++)
+    {
+        for (int w=0; w<pattern_image.cols; w++)
+        {
+            pattern_image.at<cv::Vec2f>(h, w) = (w%5==3 ? cv::Vec2f(sl::PIXEL_UNCERTAIN, 1.f) : cv::Vec2f(w*100.f, h + 65533.f*(w==19)));
+        }
+    }
+    sl::CodeImage code_image(pattern_image, cv::Point(4, 2));
+    CHECK(code_image.size()==pattern_image.size());
+    CHECK(code_image.roi()==cv::Rect(4, 2, 20, 3));
+    CHECK(!code_image.fractional());
+    CHECK(code_image.fraction_row(0)==NULL);
+    for (int h=0; h<pattern_image.rows; h++)
+    {
+        for (int w=0; w<pattern_image.cols; w++)
+        {
+            CHECK(code_image.valid(h, w)==(w%5!=3));
+            if (code_image.valid(h, w))
+            {
+                const cv::Vec2f & pattern = pattern_image.at<cv::Vec2f>(h, w);
+                CHECK(code_image.codes_row(h)[w]==cv::Vec2w(static_cast<unsigned short>(pattern[0]), static_cast<unsigned short>(pattern[1])));
+                CHECK(code_image.code_point(h, w)==cv::Point2f(pattern[0], pattern[1]));
+            }
+        }
+    }
+
+    //invalid pixels come back with both codes uncertain
+    cv::Mat expected = pattern_image.clone();
+    for (int h=0; h<expected.rows; h++)
+    {
+        for (int w=3; w<expected.cols; w+=5)
+        {
+            expected.at<cv::Vec2f>(h, w) = cv::Vec2f(sl::PIXEL_UNCERTAIN, sl::PIXEL_UNCERTAIN);
+        }
+    }
+    CHECK(same_bits(code_image.to_pattern(), expected));
+}
+
+static void test_fractional_codes(void)
+{
+    const float step = 1.f/sl::CodeImage::FRACTION_SCALE;
+    cv::Mat pattern_image(2, 40, CV_32FC2);
+    for (int w=0; w<pattern_image.cols; w++)
+    {
+        pattern_image.at<cv::Vec2f>(0, w) = cv::Vec2f(w*10.37f, 700.f - w*3.71f);
+        pattern_image.at<cv::Vec2f>(1, w) = cv::Vec2f(w + 1.f - 0.25f*step, 65535.5f);  //rounded up to the next code, largest code
+    }
+    pattern_image.at<cv::Vec2f>(1, 7) = cv::Vec2f(-1.f, 3.f);   //invalid
+
+    sl::CodeImage code_image(pattern_image);
+    CHECK(code_image.fractional());
+    CHECK(code_image.fraction.type()==CV_8UC2 && code_image.fraction.size()==pattern_image.size());
+    for (int h=0; h<pattern_image.rows; h++)
+    {
+        for (int w=0; w<pattern_image.cols; w++)
+        {
+            CHECK(code_image.valid(h, w)==(h!=1 || w!=7));
+            if (!code_image.valid(h, w))
+            {
+                continue;
+            }
+            const cv::Vec2f & pattern = pattern_image.at<cv::Vec2f>(h, w);
+            cv::Point2f code = code_image.code_point(h, w);
+            CHECK(std::fabs(code.x - pattern[0])<=0.5f*step + 1e-3f);
+            CHECK(std::fabs(code.y - pattern[1])<=0.5f*step + 1e-3f);
+            if (h==1)
+            {
+                CHECK(code_image.codes_row(h)[w][0]==w + 1 && code_image.fraction_row(h)[w][0]==0);
+                CHECK(code_image.codes_row(h)[w][1]==65535 && code_image.fraction_row(h)[w][1]==sl::CodeImage::FRACTION_SCALE/2);
+            }
+        }
+    }
+
+    //to_pattern keeps the fraction
+    cv::Mat round_trip = code_image.to_pattern();
+    for (int w=0; w<pattern_image.cols; w++)
+    {
+        cv::Point2f code = code_image.code_point(0, w);
+        CHECK(round_trip.at<cv::Vec2f>(0, w)==cv::Vec2f(code.x, code.y));
+    }
+    CHECK(sl::INVALID(round_trip.at<cv::Vec2f>(1, 7)));
+
+    //integer create() drops the fraction
+    code_image.create(cv::Size(8, 2));
+    CHECK(!code_image.fractional());
+    code_image.create(cv::Size(8, 2), true);
+    CHECK(code_image.fractional() && code_image.fraction.size()==cv::Size(8, 2));
+    code_image.release();
+    CHECK(code_image.empty() && !code_image.fractional());
+}
+
+int main(int /*argc*/, char ** /*argv*/)
+{
+    test_integer_codes();
+    test_fractional_codes();
+    return test_result("code_image_test");
+}
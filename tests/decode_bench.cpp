@@ -0,0 +1,212 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//timing harness (not run by ctest): decode_bench [width height [frames [repeat]]]
+//load: captured frames read as color and converted with cvtColor, or read with IMREAD_GRAYSCALE (sl::get_gray_image)
+//decode: one set decoded from memory in every mode, with the specialized kernels and with ReferenceDecode
+
+#include "structured_light.hpp"
+#include "test_util.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+
+//mean time of one call in milliseconds
+static double time_ms(const std::function<void(void)> & function, unsigned repeat)
+{
+    function(); //warm up
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<repeat; i++)
+    {
+        function();
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()/repeat;
+}
+
+//camera-like color frame: stripes of the given period with noise
+static cv::Mat stripe_frame(cv::Size const& size, int period, std::mt19937 & rng)
+{
+    std::uniform_int_distribution<int> noise(-12, 12);
+    cv::Mat image(size, CV_8UC3);
+    for (int h=0; h<size.height; h++)
+    {
+        cv::Vec3b * row = image.ptr<cv::Vec3b>(h);
+        for (int w=0; w<size.width; w++)
+        {
+            int value = ((w/period)%2 ? 200 : 40);
+            for (int c=0; c<3; c++)
+            {
+                row[w][c] = cv::saturate_cast<unsigned char>(value + noise(rng) + 4*c);
+            }
+        }
+    }
+    return image;
+}
+
+static void bench_load(cv::Size const& size, unsigned frames, unsigned repeat)
+{
+    const char * formats[] = {"png", "bmp", "jpg"};
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "decode_bench";
+    std::filesystem::create_directories(dir);
+
+    std::mt19937 rng(1234);
+    std::cout << "load: " << frames << " frames " << size.width << "x" << size.height << ", mean of " << repeat << " runs\n";
+    for (const char * format : formats)
+    {
+        std::vector<std::string> files;
+        for (unsigned i=0; i<frames; i++)
+        {
+            files.push_back((dir / ("frame_" + std::to_string(i) + "." + format)).string());
+            cv::imwrite(files.back(), stripe_frame(size, 1<<(i%8 + 1), rng));
+        }
+
+        double color_ms = time_ms([&]()
+        {
+            for (const std::string & file : files)
+            {
+                cv::Mat gray_image;
+                cv::cvtColor(cv::imread(file), gray_image, cv::COLOR_BGR2GRAY);
+            }
+        }, repeat);
+        double gray_ms = time_ms([&]()
+        {
+            for (const std::string & file : files)
+            {
+                sl::get_gray_image(file);
+            }
+        }, repeat);
+        printf(" %s: color+cvtColor %8.2f ms/frame, IMREAD_GRAYSCALE %8.2f ms/frame (x%.2f)\n", 
+               format, color_ms/frames, gray_ms/frames, color_ms/gray_ms);
+
+        for (const std::string & file : files)
+        {
+            std::filesystem::remove(file);
+        }
+    }
+}
+
+//projected Gray code pairs seen by the camera: the projector covers the central 80% of the image, 
+//the border is in shadow; every image has noise
+static std::vector<cv::Mat> gray_code_set(cv::Size const& size, unsigned bits, std::mt19937 & rng)
+{
+    std::uniform_int_distribution<int> noise(-8, 8);
+    const cv::Rect lit(size.width/10, size.height/10, size.width - size.width/5, size.height - size.height/5);
+    std::vector<cv::Mat> images;
+    for (unsigned pair=0; pair<1 + 2*bits; pair++)
+    {
+        const unsigned channel = (pair<=bits ? 0 : 1);
+        const unsigned bit = (pair==0 ? 0 : bits - (pair - 1 - channel*bits) - 1);
+        cv::Mat image1(size, CV_8UC1), image2(size, CV_8UC1);
+        for (int h=0; h<size.height; h++)
+        {
+            unsigned char * row1 = image1.ptr<unsigned char>(h);
+            unsigned char * row2 = image2.ptr<unsigned char>(h);
+            for (int w=0; w<size.width; w++)
+            {
+                int value1 = 30, value2 = 30;
+                if (lit.contains(cv::Point(w, h)))
+                {
+                    const int code = (channel ? (h - lit.y)*(1<<bits)/lit.height : (w - lit.x)*(1<<bits)/lit.width);
+                    const bool on = (pair==0 || ((sl::binaryToGray(code)>>bit) & 1));
+                    value1 = (on ? 200 : 50);
+                    value2 = (on ? 50 : 200);
+                }
+                row1[w] = cv::saturate_cast<unsigned char>(value1 + noise(rng));
+                row2[w] = cv::saturate_cast<unsigned char>(value2 + noise(rng));
+            }
+        }
+        images.push_back(image1);
+        images.push_back(image2);
+    }
+    return images;
+}
+
+static void bench_decode(cv::Size const& size, unsigned repeat)
+{
+    struct Mode {const char * name; unsigned flags;};
+    const Mode modes[] = {{"simple", sl::SimpleDecode},
+                          {"simple gray", sl::SimpleDecode | sl::GrayPatternDecode},
+                          {"robust", sl::RobustDecode},
+                          {"robust gray", sl::RobustDecode | sl::GrayPatternDecode},
+                          {"compact", sl::CompactDecode},
+                          {"packed", sl::PackedDecode},
+                          {"packed robust", sl::PackedDecode | sl::RobustDecode},
+                          {"columns only", sl::ColumnsOnlyDecode}};
+    const unsigned bits = 10;   //1024x1024 projector
+    const unsigned m = 5;
+
+    std::mt19937 rng(1234);
+    std::vector<cv::Mat> images = gray_code_set(size, bits, rng);
+    cv::Mat direct_light = random_direct_light(size, CV_8U, 60, rng);
+
+    std::cout << "decode: " << images.size() << " images " << size.width << "x" << size.height << ", " << cv::getNumThreads() 
+              << " threads, mean of " << repeat << " runs\n";
+    for (const Mode & mode : modes)
+    {
+        const bool columns_only = (mode.flags & sl::ColumnsOnlyDecode)!=0;
+        std::vector<cv::Mat> set(images.begin(), images.end() - (columns_only ? 2*bits : 0));
+        const cv::Mat light = ((mode.flags & sl::RobustDecode) ? direct_light : cv::Mat());
+        cv::Mat pattern_image, min_max_image;
+        double kernel_ms = time_ms([&]() {decode_set(set, bits, mode.flags, light, m, pattern_image, min_max_image);}, repeat);
+        double reference_ms = time_ms([&]() {decode_set(set, bits, mode.flags | sl::ReferenceDecode, light, m, pattern_image, min_max_image);}, repeat);
+        printf(" %-14s %8.2f ms, reference %8.2f ms (x%.2f)\n", mode.name, kernel_ms, reference_ms, reference_ms/kernel_ms);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    cv::Size size(1280, 960);
+    unsigned frames = 8, repeat = 5;
+    if (argc>=3)
+    {
+        size = cv::Size(atoi(argv[1]), atoi(argv[2]));
+    }
+    if (argc>=4)
+    {
+        frames = static_cast<unsigned>(atoi(argv[3]));
+    }
+    if (argc>=5)
+    {
+        repeat = static_cast<unsigned>(atoi(argv[4]));
+    }
+    if (size.width<1 || size.height<1 || frames<1 || repeat<1)
+    {
+        std::cerr << "usage: decode_bench [width height [frames [repeat]]]\n";
+        return 1;
+    }
+
+    bench_load(size, frames, repeat);
+    bench_decode(size, repeat);
+    return 0;
+}
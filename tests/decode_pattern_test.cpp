@@ -0,0 +1,134 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//sl::decode_pattern on image files: the same result as the decoder fed from memory, 
+//and a failed decode (not a partial one) when a frame cannot be decoded
+
+#include "structured_light.hpp"
+#include "test_util.hpp"
+
+#include <filesystem>
+#include <opencv2/highgui.hpp>
+
+static std::vector<std::string> write_set(const std::filesystem::path & dir, const std::string & prefix, const std::vector<cv::Mat> & images)
+{
+    std::vector<std::string> filenames;
+    for (size_t i=0; i<images.size(); i++)
+    {
+        filenames.push_back((dir / (prefix + "_" + std::to_string(i) + ".png")).string());
+        CHECK(cv::imwrite(filenames.back(), images[i]));
+    }
+    return filenames;
+}
+
+static void test_decode_files(const std::filesystem::path & dir)
+{
+    std::mt19937 rng(31);
+    const cv::Size size(40, 6);
+    const unsigned bits = 6;
+    const unsigned m = 5;
+    const cv::Size projector_size(1<<bits, 1<<bits);
+    for (unsigned flags : {static_cast<unsigned>(sl::SimpleDecode), static_cast<unsigned>(sl::RobustDecode), 
+                           static_cast<unsigned>(sl::SimpleDecode | sl::ColumnsOnlyDecode)})
+    {
+        const unsigned pairs = 1 + ((flags & sl::ColumnsOnlyDecode) ? 1 : 2)*bits;
+        std::vector<cv::Mat> images = random_set(size, pairs, CV_8U, 255, m, rng);
+        cv::Mat direct_light = ((flags & sl::RobustDecode) ? random_direct_light(size, CV_8U, 255, rng) : cv::Mat());
+        std::vector<std::string> filenames = write_set(dir, "set", images);
+
+        cv::Mat pattern_image, min_max_image, expected_pattern, expected_min_max;
+        cv::Mat light = direct_light.clone();
+        CHECK(sl::decode_pattern(filenames, pattern_image, min_max_image, projector_size, flags, light, 0.5f, m));
+        CHECK(decode_set(images, bits, flags, direct_light, m, expected_pattern, expected_min_max));
+        CHECK(same_bits(pattern_image, expected_pattern) && same_bits(min_max_image, expected_min_max));
+
+        if (flags & sl::RobustDecode)
+        {   //direct light estimated from the set, loaded before the pattern pairs (with and without prefetching)
+            std::vector<cv::Mat> light_frames;
+            for (unsigned index : sl::get_direct_light_images(static_cast<int>(images.size())))
+            {
+                light_frames.push_back(images[index]);
+            }
+            cv::Mat expected_light = sl::estimate_direct_light(light_frames, 0.5f);
+            CHECK(decode_set(images, bits, flags, expected_light, m, expected_pattern, expected_min_max));
+            for (unsigned prefetch : {0u, 3u})
+            {
+                light = cv::Mat();
+                CHECK(sl::decode_pattern(filenames, pattern_image, min_max_image, projector_size, flags, light, 0.5f, m, prefetch));
+                CHECK(same_bits(light, expected_light));
+                CHECK(same_bits(pattern_image, expected_pattern) && same_bits(min_max_image, expected_min_max));
+            }
+        }
+
+        //one frame of another size or depth: the decode fails
+        for (int bad : {0, 1})
+        {
+            std::vector<cv::Mat> bad_images(images);
+            bad_images[2*pairs - 3] = (bad==0 ? cv::Mat(size.height + 1, size.width, CV_8UC1, cv::Scalar(9)) 
+                                              : cv::Mat(size, CV_16UC1, cv::Scalar(1000)));
+            light = direct_light.clone();
+            CHECK(!sl::decode_pattern(write_set(dir, "bad", bad_images), pattern_image, min_max_image, projector_size, 
+                                      flags, light, 0.5f, m));
+        }
+    }
+
+    //single image mode and phase images
+    const unsigned phase_steps = 4;
+    std::vector<cv::Mat> images = random_set(size, 1 + 2*bits, CV_8U, 255, m, rng);
+    for (unsigned i=0; i<2*phase_steps; i++)
+    {
+        images.push_back(random_image(size, CV_8U, 255, rng));
+    }
+    const cv::Size phase_projector(1024, 768);
+    cv::Mat pattern_image, min_max_image, direct_light;
+    CHECK(sl::decode_pattern(write_set(dir, "phase", images), pattern_image, min_max_image, phase_projector, sl::SimpleDecode, direct_light, 
+                             0.5f, m, 0, phase_steps));
+    images.back() = cv::Mat(size.height, size.width + 3, CV_8UC1, cv::Scalar(7));
+    CHECK(!sl::decode_pattern(write_set(dir, "phase_bad", images), pattern_image, min_max_image, phase_projector, sl::SimpleDecode, direct_light,
+                              0.5f, m, 0, phase_steps));
+
+    images = random_set(size, 1, CV_8U, 255, m, rng);
+    for (unsigned i=0; i<2*bits; i++)
+    {
+        images.push_back(random_image(size, CV_8U, 255, rng));
+    }
+    CHECK(sl::decode_pattern(write_set(dir, "single", images), pattern_image, min_max_image, projector_size, sl::SingleImageDecode, direct_light));
+    images[5] = cv::Mat(size, CV_16UC1, cv::Scalar(1000));
+    CHECK(!sl::decode_pattern(write_set(dir, "single_bad", images), pattern_image, min_max_image, projector_size, sl::SingleImageDecode, direct_light));
+}
+
+int main(int /*argc*/, char ** /*argv*/)
+{
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "decode_pattern_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    test_decode_files(dir);
+
+    std::filesystem::remove_all(dir);
+    return test_result("decode_pattern_test");
+}
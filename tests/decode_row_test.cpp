@@ -0,0 +1,241 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//decode kernels: the SIMD rows must give the same codes and min/max as the scalar reference (ReferenceDecode)
+//on random image sets, for every mode and for widths below, at and above one SIMD block.
+//PackedDecode (binarized bit planes, codes assembled with 8x8 bit transposes) must match the float decode.
+//16 bit frames (12/16 bit cameras) use the templated kernels: 8 bit values widened to 16 bit decode the same
+
+#include "structured_light.hpp"
+#include "test_util.hpp"
+
+//simple mode codes computed directly: bit b of a code is set when image1>image2 on its pair
+static bool check_simple_codes(const std::vector<cv::Mat> & images, unsigned bits, bool columns_only, const cv::Mat & pattern_image)
+{
+    for (int h=0; h<pattern_image.rows; h++)
+    {
+        for (int w=0; w<pattern_image.cols; w++)
+        {
+            float code[2] = {0.f, 0.f};
+            for (unsigned i=1; 2*i<images.size(); i++)
+            {
+                unsigned channel = (i<=bits ? 0 : 1);
+                unsigned bit = bits - (i - 1 - channel*bits) - 1;
+                if (images[2*i].at<unsigned char>(h, w)>images[2*i + 1].at<unsigned char>(h, w))
+                {
+                    code[channel] += static_cast<float>(1<<bit);
+                }
+            }
+            const cv::Vec2f & pattern = pattern_image.at<cv::Vec2f>(h, w);
+            if (pattern[0]!=code[0] || pattern[1]!=(columns_only ? 0.f : code[1]))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void test_decode_rows(void)
+{
+    std::mt19937 rng(1234);
+    const int widths[] = {1, 7, 15, 16, 17, 31, 32, 33, 100, 257};
+    const unsigned ms[] = {0, 5, 40, 300};
+    const unsigned modes[] = {sl::SimpleDecode, sl::RobustDecode};
+    const unsigned variants[] = {0, sl::ColumnsOnlyDecode, sl::CompactDecode};
+    const unsigned bits = 3;
+
+    for (int width : widths)
+    {
+        cv::Size size(width, 3);
+        for (unsigned mode : modes)
+        {
+            for (unsigned variant : variants)
+            {
+                for (unsigned m : ms)
+                {
+                    if (mode==sl::SimpleDecode && m!=ms[1])
+                    {   //m only matters to the robust bits
+                        continue;
+                    }
+                    const unsigned flags = mode | variant;
+                    const unsigned pairs = 1 + ((flags & sl::ColumnsOnlyDecode) ? 1 : 2)*bits;
+                    std::vector<cv::Mat> images = random_set(size, pairs, CV_8U, 255, m, rng);
+                    cv::Mat direct_light = (mode==sl::RobustDecode ? random_direct_light(size, CV_8U, 255, rng) : cv::Mat());
+
+                    cv::Mat pattern_image, min_max_image, reference_pattern, reference_min_max;
+                    CHECK(decode_set(images, bits, flags, direct_light, m, pattern_image, min_max_image));
+                    CHECK(decode_set(images, bits, flags | sl::ReferenceDecode, direct_light, m, reference_pattern, reference_min_max));
+                    if (!same_bits(pattern_image, reference_pattern) || !same_bits(min_max_image, reference_min_max))
+                    {
+                        std::cerr << "[decode_row_test] width " << width << " flags " << flags << " m " << m << std::endl;
+                        CHECK(same_bits(pattern_image, reference_pattern));
+                        CHECK(same_bits(min_max_image, reference_min_max));
+                    }
+                    if (flags==sl::SimpleDecode || flags==(sl::SimpleDecode | sl::ColumnsOnlyDecode))
+                    {
+                        CHECK(check_simple_codes(images, bits, (flags & sl::ColumnsOnlyDecode)!=0, reference_pattern));
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void test_packed_codes(void)
+{
+    std::mt19937 rng(4321);
+    const int widths[] = {1, 7, 8, 9, 15, 16, 17, 33, 100};
+    const unsigned bit_counts[] = {3, 8, 9, 12};    //codes in the low transpose only, and in both
+    const unsigned modes[] = {sl::SimpleDecode, sl::RobustDecode};
+    const unsigned variants[] = {0, sl::ColumnsOnlyDecode, sl::CompactDecode};
+    const unsigned m = 5;
+
+    for (int width : widths)
+    {
+        cv::Size size(width, 2);
+        for (unsigned bits : bit_counts)
+        {
+            for (unsigned mode : modes)
+            {
+                for (unsigned variant : variants)
+                {
+                    const unsigned flags = mode | variant;
+                    const unsigned pairs = 1 + ((flags & sl::ColumnsOnlyDecode) ? 1 : 2)*bits;
+                    std::vector<cv::Mat> images = random_set(size, pairs, CV_8U, 255, m, rng);
+                    cv::Mat direct_light = (mode==sl::RobustDecode ? random_direct_light(size, CV_8U, 255, rng) : cv::Mat());
+
+                    //float codes, packed codes with the SIMD and the scalar binarize kernels
+                    cv::Mat pattern_image, min_max_image, packed_pattern, packed_min_max, reference_pattern, reference_min_max;
+                    CHECK(decode_set(images, bits, flags, direct_light, m, pattern_image, min_max_image));
+                    CHECK(decode_set(images, bits, flags | sl::PackedDecode, direct_light, m, packed_pattern, packed_min_max));
+                    CHECK(decode_set(images, bits, flags | sl::PackedDecode | sl::ReferenceDecode, direct_light, m, 
+                                     reference_pattern, reference_min_max));
+                    if (!same_bits(pattern_image, packed_pattern) || !same_bits(min_max_image, packed_min_max)
+                        || !same_bits(packed_pattern, reference_pattern) || !same_bits(packed_min_max, reference_min_max))
+                    {
+                        std::cerr << "[decode_row_test] packed, width " << width << " bits " << bits << " flags " << flags << std::endl;
+                        CHECK(same_bits(pattern_image, packed_pattern));
+                        CHECK(same_bits(min_max_image, packed_min_max));
+                        CHECK(same_bits(packed_pattern, reference_pattern));
+                        CHECK(same_bits(packed_min_max, reference_min_max));
+                    }
+                }
+            }
+        }
+    }
+}
+
+//8 bit image (1 or 2 channels) widened to 16 bit, same values
+static cv::Mat widen(const cv::Mat & image)
+{
+    if (image.empty())
+    {
+        return cv::Mat();
+    }
+    cv::Mat wide(image.size(), CV_MAKETYPE(CV_16U, image.channels()));
+    for (int h=0; h<image.rows; h++)
+    {
+        const unsigned char * row = image.ptr<unsigned char>(h);
+        unsigned short * wide_row = wide.ptr<unsigned short>(h);
+        for (int i=0; i<image.cols*image.channels(); i++)
+        {
+            wide_row[i] = row[i];
+        }
+    }
+    return wide;
+}
+
+static void test_wide_frames(void)
+{
+    std::mt19937 rng(5678);
+    const int widths[] = {1, 7, 16, 17, 33, 100};
+    const unsigned ms[] = {0, 5, 40, 300};
+    const unsigned modes[] = {sl::SimpleDecode, sl::RobustDecode};
+    const unsigned variants[] = {0, sl::ColumnsOnlyDecode, sl::CompactDecode, sl::PackedDecode};
+    const unsigned bits = 9;
+
+    for (int width : widths)
+    {
+        cv::Size size(width, 3);
+        for (unsigned mode : modes)
+        {
+            for (unsigned variant : variants)
+            {
+                for (unsigned m : ms)
+                {
+                    const unsigned flags = mode | variant;
+                    const unsigned pairs = 1 + ((flags & sl::ColumnsOnlyDecode) ? 1 : 2)*bits;
+
+                    //8 bit values in 16 bit frames: the codes and the widened min/max of the 8 bit decode
+                    std::vector<cv::Mat> images = random_set(size, pairs, CV_8U, 255, m, rng);
+                    cv::Mat direct_light = (mode==sl::RobustDecode ? random_direct_light(size, CV_8U, 255, rng) : cv::Mat());
+                    std::vector<cv::Mat> wide_images;
+                    for (size_t i=0; i<images.size(); i++)
+                    {
+                        wide_images.push_back(widen(images[i]));
+                    }
+                    cv::Mat pattern_image, min_max_image, wide_pattern, wide_min_max, reference_pattern, reference_min_max;
+                    CHECK(decode_set(images, bits, flags, direct_light, m, pattern_image, min_max_image));
+                    CHECK(decode_set(wide_images, bits, flags, widen(direct_light), m, wide_pattern, wide_min_max));
+                    CHECK(decode_set(wide_images, bits, flags | sl::ReferenceDecode, widen(direct_light), m, reference_pattern, reference_min_max));
+                    if (!same_bits(pattern_image, wide_pattern) || !same_bits(widen(min_max_image), wide_min_max)
+                        || !same_bits(wide_pattern, reference_pattern) || !same_bits(wide_min_max, reference_min_max))
+                    {
+                        std::cerr << "[decode_row_test] 16 bit, width " << width << " flags " << flags << " m " << m << std::endl;
+                        CHECK(same_bits(pattern_image, wide_pattern));
+                        CHECK(same_bits(widen(min_max_image), wide_min_max));
+                        CHECK(same_bits(wide_pattern, reference_pattern));
+                        CHECK(same_bits(wide_min_max, reference_min_max));
+                    }
+
+                    //12 bit values: the kernels against the reference, m in 12 bit units
+                    const unsigned wide_m = 16*m;
+                    images = random_set(size, pairs, CV_16U, 4095, wide_m, rng);
+                    direct_light = (mode==sl::RobustDecode ? random_direct_light(size, CV_16U, 4095, rng) : cv::Mat());
+                    CHECK(decode_set(images, bits, flags, direct_light, wide_m, wide_pattern, wide_min_max));
+                    CHECK(decode_set(images, bits, flags | sl::ReferenceDecode, direct_light, wide_m, reference_pattern, reference_min_max));
+                    CHECK(wide_min_max.type()==CV_16UC2);
+                    if (!same_bits(wide_pattern, reference_pattern) || !same_bits(wide_min_max, reference_min_max))
+                    {
+                        std::cerr << "[decode_row_test] 12 bit, width " << width << " flags " << flags << " m " << wide_m << std::endl;
+                        CHECK(same_bits(wide_pattern, reference_pattern));
+                        CHECK(same_bits(wide_min_max, reference_min_max));
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main(int /*argc*/, char ** /*argv*/)
+{
+    test_decode_rows();
+    test_packed_codes();
+    test_wide_frames();
+    return test_result("decode_row_test");
+}
@@ -0,0 +1,440 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//io_util::write_decode_stats: the report must be valid JSON holding every DecodeStats field
+
+#include "io_util.hpp"
+#include "structured_light.hpp"
+#include "test_util.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+//minimal JSON reader, enough to check the report
+struct JsonValue
+{
+    enum Type {Null, Bool, Number, String, Array, Object};
+    JsonValue() : type(Null), boolean(false), number(0.0) {}
+
+    const JsonValue * member(const std::string & key) const
+    {
+        for (size_t i=0; i<members.size(); i++)
+        {
+            if (members[i].first==key)
+            {
+                return &members[i].second;
+            }
+        }
+        return NULL;
+    }
+
+    Type type;
+    bool boolean;
+    double number;
+    std::string string;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue> > members;
+};
+
+class JsonReader
+{
+public:
+    JsonReader(const std::string & text) : _p(text.c_str()), _end(text.c_str() + text.size()) {}
+
+    bool read(JsonValue & value)
+    {
+        if (!read_value(value))
+        {
+            return false;
+        }
+        skip_space();
+        return _p==_end;
+    }
+
+private:
+    void skip_space(void) {while (_p<_end && (*_p==' ' || *_p=='\n' || *_p=='\r' || *_p=='\t')) {_p++;}}
+
+    bool read_literal(const char * literal)
+    {
+        size_t length = strlen(literal);
+        if (static_cast<size_t>(_end - _p)<length || strncmp(_p, literal, length)!=0)
+        {
+            return false;
+        }
+        _p += length;
+        return true;
+    }
+
+    bool read_string(std::string & string)
+    {
+        if (*_p!='"')
+        {
+            return false;
+        }
+        for (_p++; _p<_end && *_p!='"'; _p++)
+        {
+            if (*_p=='\\' || static_cast<unsigned char>(*_p)<0x20)
+            {   //the report never needs escapes
+                return false;
+            }
+            string.push_back(*_p);
+        }
+        if (_p==_end)
+        {
+            return false;
+        }
+        _p++;
+        return true;
+    }
+
+    bool read_number(double & number)
+    {   //JSON numbers start with '-' or a digit: rejects nan, inf
+        if (*_p!='-' && !isdigit(static_cast<unsigned char>(*_p)))
+        {
+            return false;
+        }
+        char * next = NULL;
+        number = strtod(_p, &next);
+        if (next==_p || next>_end || !std::isfinite(number))
+        {
+            return false;
+        }
+        _p = next;
+        return true;
+    }
+
+    bool read_value(JsonValue & value)
+    {
+        skip_space();
+        if (_p==_end)
+        {
+            return false;
+        }
+        if (*_p=='{')
+        {
+            value.type = JsonValue::Object;
+            _p++;
+            skip_space();
+            if (_p<_end && *_p=='}')
+            {
+                _p++;
+                return true;
+            }
+            for (;;)
+            {
+                std::string key;
+                JsonValue member;
+                skip_space();
+                if (_p==_end || !read_string(key) || value.member(key))
+                {   //duplicate keys are an error here
+                    return false;
+                }
+                skip_space();
+                if (_p==_end || *_p++!=':' || !read_value(member))
+                {
+                    return false;
+                }
+                value.members.push_back(std::make_pair(key, member));
+                skip_space();
+                if (_p==_end)
+                {
+                    return false;
+                }
+                if (*_p=='}')
+                {
+                    _p++;
+                    return true;
+                }
+                if (*_p++!=',')
+                {
+                    return false;
+                }
+            }
+        }
+        if (*_p=='[')
+        {
+            value.type = JsonValue::Array;
+            _p++;
+            skip_space();
+            if (_p<_end && *_p==']')
+            {
+                _p++;
+                return true;
+            }
+            for (;;)
+            {
+                JsonValue item;
+                if (!read_value(item))
+                {
+                    return false;
+                }
+                value.items.push_back(item);
+                skip_space();
+                if (_p==_end)
+                {
+                    return false;
+                }
+                if (*_p==']')
+                {
+                    _p++;
+                    return true;
+                }
+                if (*_p++!=',')
+                {
+                    return false;
+                }
+            }
+        }
+        if (*_p=='"')
+        {
+            value.type = JsonValue::String;
+            return read_string(value.string);
+        }
+        if (*_p=='t' || *_p=='f')
+        {
+            value.type = JsonValue::Bool;
+            value.boolean = (*_p=='t');
+            return read_literal(value.boolean ? "true" : "false");
+        }
+        if (*_p=='n')
+        {
+            return read_literal("null");
+        }
+        value.type = JsonValue::Number;
+        return read_number(value.number);
+    }
+
+    const char * _p;
+    const char * _end;
+};
+
+static bool read_report(const std::string & filename, JsonValue & report)
+{
+    std::ifstream file(filename.c_str());
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return !text.empty() && JsonReader(text).read(report) && report.type==JsonValue::Object;
+}
+
+static bool is_number(const JsonValue * value, double expected)
+{   //the report keeps 6 significant digits
+    return value && value->type==JsonValue::Number && std::fabs(value->number - expected)<=1e-5*std::fabs(expected) + 1e-9;
+}
+
+template <typename T>
+static bool is_array(const JsonValue * value, const std::vector<T> & expected)
+{
+    if (!value || value->type!=JsonValue::Array || value->items.size()!=expected.size())
+    {
+        return false;
+    }
+    for (size_t i=0; i<expected.size(); i++)
+    {
+        if (!is_number(&value->items[i], static_cast<double>(expected[i])))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void check_report(const std::string & filename, sl::DecodeStats const& stats)
+{
+    JsonValue report;
+    CHECK(io_util::write_decode_stats(filename, stats));
+    CHECK(read_report(filename, report));
+    if (report.type!=JsonValue::Object)
+    {
+        return;
+    }
+
+    const char * keys[] = {"image_size", "roi", "bits", "columns_only", "pixels", "shadow_pixels", "valid_pixels", 
+                           "timing_ms", "load_threads", "bit_planes", "contrast_histogram", "contrast_bin_width"};
+    CHECK(report.members.size()==sizeof(keys)/sizeof(keys[0]));
+    for (size_t i=0; i<sizeof(keys)/sizeof(keys[0]); i++)
+    {
+        CHECK(report.member(keys[i])!=NULL);
+    }
+
+    const JsonValue * columns_only = report.member("columns_only");
+    CHECK(is_array(report.member("image_size"), std::vector<int>{stats.image_size.width, stats.image_size.height}));
+    CHECK(is_array(report.member("roi"), std::vector<int>{stats.roi.x, stats.roi.y, stats.roi.width, stats.roi.height}));
+    CHECK(is_number(report.member("bits"), stats.bits));
+    CHECK(columns_only && columns_only->type==JsonValue::Bool && columns_only->boolean==stats.columns_only);
+    CHECK(is_number(report.member("pixels"), static_cast<double>(stats.roi.area())));
+    CHECK(is_number(report.member("shadow_pixels"), static_cast<double>(stats.shadow_pixels)));
+    CHECK(is_number(report.member("valid_pixels"), static_cast<double>(stats.valid_pixels)));
+    CHECK(is_number(report.member("load_threads"), stats.load_threads));
+    CHECK(is_array(report.member("contrast_histogram"), stats.contrast_histogram));
+    CHECK(is_number(report.member("contrast_bin_width"), stats.contrast_bin_width));
+
+    const JsonValue * timing = report.member("timing_ms");
+    CHECK(timing && timing->type==JsonValue::Object && timing->members.size()==8);
+    if (timing)
+    {
+        CHECK(is_number(timing->member("total"), stats.total_ms));
+        CHECK(is_number(timing->member("load"), stats.load_ms));
+        CHECK(is_number(timing->member("load_wait"), stats.wait_ms));
+        CHECK(is_number(timing->member("direct_light"), stats.direct_light_ms));
+        CHECK(is_number(timing->member("compare"), stats.compare_ms));
+        CHECK(is_number(timing->member("assemble"), stats.assemble_ms));
+        CHECK(is_number(timing->member("gray_to_binary"), stats.convert_ms));
+        CHECK(is_number(timing->member("phase"), stats.phase_ms));
+    }
+
+    //bit planes in push order: vertical from the most significant bit, then horizontal
+    const JsonValue * planes = report.member("bit_planes");
+    CHECK(planes && planes->type==JsonValue::Array && planes->items.size()==stats.uncertain_pixels.size());
+    for (size_t i=0; planes && i<planes->items.size() && i<stats.uncertain_pixels.size(); i++)
+    {
+        const JsonValue & plane = planes->items[i];
+        const unsigned channel = (i>=stats.bits ? 1 : 0);
+        const unsigned bit = stats.bits - 1 - static_cast<unsigned>(i%stats.bits);
+        const JsonValue * direction = plane.member("direction");
+        CHECK(direction && direction->string==(channel ? "horizontal" : "vertical"));
+        CHECK(is_number(plane.member("bit"), bit));
+        CHECK(is_number(plane.member("uncertain_pixels"), static_cast<double>(stats.uncertain_pixels[i])));
+
+        const sl::BitStats * bit_stats = NULL;
+        for (size_t j=0; j<stats.bit_stats.size(); j++)
+        {
+            if (stats.bit_stats[j].channel==channel && stats.bit_stats[j].bit==bit)
+            {
+                bit_stats = &stats.bit_stats[j];
+                break;
+            }
+        }
+        CHECK(plane.members.size()==(bit_stats ? 5u : 3u));
+        if (bit_stats)
+        {
+            CHECK(is_number(plane.member("resolved"), bit_stats->resolved));
+            CHECK(is_number(plane.member("contrast"), bit_stats->contrast));
+        }
+    }
+}
+
+static void test_reports(const std::filesystem::path & dir)
+{
+    std::mt19937 rng(99);
+    const cv::Size size(45, 7);
+    const unsigned bits = 4;
+    const unsigned m = 5;
+    const unsigned flags[] = {sl::RobustDecode | sl::ReportDecode | sl::BitStatsDecode, 
+                              sl::SimpleDecode | sl::ReportDecode | sl::ColumnsOnlyDecode, 
+                              sl::RobustDecode | sl::ReportDecode | sl::PackedDecode,
+                              sl::SimpleDecode};
+    for (unsigned f : flags)
+    {
+        const unsigned pairs = 1 + ((f & sl::ColumnsOnlyDecode) ? 1 : 2)*bits;
+        std::vector<cv::Mat> images = random_set(size, pairs, CV_8U, 255, m, rng);
+        cv::Mat direct_light = ((f & sl::RobustDecode) ? random_direct_light(size, CV_8U, 255, rng) : cv::Mat());
+        cv::Mat pattern_image, min_max_image;
+        sl::DecodeStats stats;
+        CHECK(decode_set(images, bits, f, direct_light, m, pattern_image, min_max_image, &stats));
+        CHECK(stats.image_size==size && stats.bits==bits);
+        CHECK((f & sl::ReportDecode)==0 || stats.uncertain_pixels.size()==pairs - 1);
+        check_report((dir / "decode_stats.json").string(), stats);
+    }
+
+    //every field distinct, bit stats for some planes only
+    sl::DecodeStats stats;
+    stats.image_size = cv::Size(1280, 960);
+    stats.roi = cv::Rect(10, 20, 1000, 900);
+    stats.bits = 3;
+    stats.columns_only = false;
+    stats.shadow_pixels = 12345;
+    stats.valid_pixels = 678901;
+    stats.contrast_histogram.assign(256, 0);
+    stats.contrast_histogram[0] = 5000000000LL;
+    stats.contrast_histogram[255] = 17;
+    stats.contrast_bin_width = 256;
+    stats.uncertain_pixels = std::vector<int64_t>{900, 800, 700, 600, 500, 400};
+    sl::BitStats bit_stats = {1, 0, 0.25, 17.5};
+    stats.bit_stats.push_back(bit_stats);
+    bit_stats.channel = 0; bit_stats.bit = 2; bit_stats.resolved = 0.875; bit_stats.contrast = 40.125;
+    stats.bit_stats.push_back(bit_stats);
+    stats.total_ms = 101.5; stats.load_ms = 52.25; stats.wait_ms = 3.125; stats.direct_light_ms = 4.5;
+    stats.compare_ms = 11.75; stats.assemble_ms = 6.5; stats.convert_ms = 2.25; stats.phase_ms = 0.5;
+    stats.load_threads = 3;
+    check_report((dir / "filled.json").string(), stats);
+
+    //empty report: default stats, nothing decoded
+    check_report((dir / "empty.json").string(), sl::DecodeStats());
+
+    CHECK(!io_util::write_decode_stats((dir / "missing" / "decode_stats.json").string(), sl::DecodeStats()));
+}
+
+//histogram and shadow count against a plain count over the white/black pair, 8 and 16 bit sets (m above one 16 bit bin too)
+static void test_contrast_counts(void)
+{
+    std::mt19937 rng(7);
+    const cv::Size size(61, 9);
+    const unsigned bits = 3;
+    const unsigned pairs = 1 + 2*bits;
+    struct {int depth; int max_value; unsigned m;} sets[] = {{CV_8U, 255, 5}, {CV_16U, 4095, 40}, {CV_16U, 65535, 300}};
+    for (auto const& set : sets)
+    {
+        std::vector<cv::Mat> images = random_set(size, pairs, set.depth, set.max_value, set.m, rng);
+        cv::Mat pattern_image, min_max_image;
+        sl::DecodeStats stats;
+        CHECK(decode_set(images, bits, sl::SimpleDecode | sl::ReportDecode, cv::Mat(), set.m, pattern_image, min_max_image, &stats));
+
+        const unsigned shift = (set.depth==CV_16U ? 8 : 0);
+        std::vector<int64_t> histogram(256, 0);
+        int64_t shadow_pixels = 0;
+        for (int h=0; h<size.height; h++)
+        {
+            for (int w=0; w<size.width; w++)
+            {
+                int white = (set.depth==CV_16U ? images[0].at<unsigned short>(h, w) : images[0].at<unsigned char>(h, w));
+                int black = (set.depth==CV_16U ? images[1].at<unsigned short>(h, w) : images[1].at<unsigned char>(h, w));
+                int contrast = std::abs(white - black);
+                histogram[std::min(255, contrast>>shift)]++;
+                shadow_pixels += (contrast<static_cast<int>(set.m));
+            }
+        }
+        CHECK(stats.contrast_bin_width==(1u<<shift));
+        CHECK(stats.contrast_histogram==histogram);
+        CHECK(stats.shadow_pixels==shadow_pixels);
+        CHECK(shadow_pixels>0 && shadow_pixels<size.area());
+    }
+}
+
+int main(int /*argc*/, char ** /*argv*/)
+{
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "decode_stats_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    test_reports(dir);
+    test_contrast_counts();
+
+    std::filesystem::remove_all(dir);
+    return test_result("decode_stats_test");
+}
@@ -0,0 +1,235 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//direct/global light: DirectLightEstimator against a plain min/max of the frames, the frames picked by
+//get_direct_light_images, and a robust decode that estimates the direct light while the pairs are pushed
+
+#include "structured_light.hpp"
+#include "test_util.hpp"
+
+//Ld and Lg from the per pixel min/max of the frames (Nayar et al.)
+template <typename T>
+static cv::Mat reference_direct_light(const std::vector<cv::Mat> & images, float b)
+{
+    cv::Mat direct_light(images[0].size(), CV_MAKETYPE(images[0].depth(), 2));
+    for (int h=0; h<direct_light.rows; h++)
+    {
+        for (int w=0; w<direct_light.cols; w++)
+        {
+            unsigned Lmin = images[0].at<T>(h, w), Lmax = Lmin;
+            for (size_t i=1; i<images.size(); i++)
+            {
+                Lmin = std::min(Lmin, static_cast<unsigned>(images[i].at<T>(h, w)));
+                Lmax = std::max(Lmax, static_cast<unsigned>(images[i].at<T>(h, w)));
+            }
+            int Ld = static_cast<int>((Lmax - Lmin)/(1.0 - b) + 0.5);
+            int Lg = static_cast<int>(2.0/(1.0 - b*1.0*b)*(Lmin - b*Lmax) + 0.5);
+            direct_light.at<cv::Vec<T, 2> >(h, w) = (Lg>0 ? cv::Vec<T, 2>(static_cast<T>(Ld), static_cast<T>(Lg)) : cv::Vec<T, 2>(static_cast<T>(Lmax), 0));
+        }
+    }
+    return direct_light;
+}
+
+static void test_estimator(void)
+{
+    std::mt19937 rng(7);
+    const int widths[] = {1, 15, 16, 17, 64, 100};
+    const float bs[] = {0.f, 0.3f, 0.5f, 0.9f};
+    for (int width : widths)
+    {
+        for (int depth : {CV_8U, CV_16U})
+        {
+            const int max_value = (depth==CV_16U ? 4095 : 255);
+            for (unsigned count : {1u, 2u, 8u})
+            {
+                std::vector<cv::Mat> images;
+                sl::DirectLightEstimator estimator;
+                for (unsigned i=0; i<count; i++)
+                {
+                    images.push_back(random_image(cv::Size(width, 5), depth, max_value, rng));
+                    CHECK(estimator.push(images.back()));
+                }
+                CHECK(estimator.count()==count);
+                for (float b : bs)
+                {
+                    cv::Mat expected = (depth==CV_16U ? reference_direct_light<unsigned short>(images, b) 
+                                                      : reference_direct_light<unsigned char>(images, b));
+                    cv::Mat direct_light = estimator.estimate(b);
+                    if (!same_bits(direct_light, expected) || !same_bits(sl::estimate_direct_light(images, b), expected))
+                    {
+                        std::cerr << "[direct_light_test] width " << width << " depth " << depth << " count " << count << " b " << b << std::endl;
+                        CHECK(same_bits(direct_light, expected));
+                    }
+                }
+            }
+        }
+    }
+
+    //frames of another size or depth are rejected and leave the estimate as it was
+    sl::DirectLightEstimator estimator;
+    CHECK(estimator.estimate(0.5f).empty());
+    CHECK(!estimator.push(cv::Mat(4, 4, CV_8UC3)));
+    CHECK(!estimator.push(cv::Mat(4, 4, CV_32FC1)));
+    CHECK(estimator.count()==0);
+    cv::Mat image = random_image(cv::Size(4, 4), CV_8U, 255, rng);
+    CHECK(estimator.push(image));
+    CHECK(!estimator.push(cv::Mat(4, 5, CV_8UC1)));
+    CHECK(!estimator.push(cv::Mat(4, 4, CV_16UC1)));
+    CHECK(estimator.count()==1);
+    CHECK(same_bits(estimator.estimate(0.5f), reference_direct_light<unsigned char>(std::vector<cv::Mat>(1, image), 0.5f)));
+    estimator.reset();
+    CHECK(estimator.count()==0 && estimator.estimate(0.5f).empty());
+    CHECK(sl::estimate_direct_light(std::vector<cv::Mat>(), 0.5f).empty());
+}
+
+static void test_direct_light_images(void)
+{
+    //10 bits: 42 images, 4 vertical and 4 horizontal patterns 4 bits before the finest
+    const unsigned expected[] = {14, 34, 15, 35, 16, 36, 17, 37};
+    CHECK(sl::get_direct_light_images(42)==std::vector<unsigned>(expected, expected + 8));
+    //columns only: 22 images, 8 consecutive vertical images ending at the same pattern
+    const unsigned expected_columns[] = {10, 11, 12, 13, 14, 15, 16, 17};
+    CHECK(sl::get_direct_light_images(22, true)==std::vector<unsigned>(expected_columns, expected_columns + 8));
+
+    for (unsigned bits=1; bits<=12; bits++)
+    {
+        for (bool columns_only : {false, true})
+        {
+            const int total_images = 2*(1 + (columns_only ? 1 : 2)*bits);
+            std::vector<unsigned> images = sl::get_direct_light_images(total_images, columns_only);
+            CHECK(images.empty() || images.size()==8);
+            for (unsigned index : images)
+            {   //never the white/black pair
+                CHECK(index>=2 && index<static_cast<unsigned>(total_images));
+            }
+        }
+    }
+    CHECK(sl::get_direct_light_images(0).empty() && sl::get_direct_light_images(2, true).empty());
+}
+
+//robust decode estimating the direct light from the images pushed
+//ahead: the light images are given after the white/black pair (set_direct_light_images), otherwise picked from the pushed pairs
+static bool decode_estimated(const std::vector<cv::Mat> & images, unsigned bits, unsigned flags, const std::vector<unsigned> & light_images,
+                             float b, unsigned m, bool ahead, cv::Mat & pattern_image, cv::Mat & min_max_image, cv::Mat & direct_light)
+{
+    sl::Decoder decoder;
+    cv::Size projector_size(1<<bits, 1<<bits);
+    if (!decoder.begin(images[0].size(), projector_size, bits, flags, cv::Mat(), m, 0, 0, images[0].depth())
+        || (!ahead && !decoder.estimate_direct_light(light_images, b)))
+    {
+        return false;
+    }
+    for (size_t i=0; i+1<images.size(); i+=2)
+    {
+        if (!decoder.push_pair(images[i], images[i + 1]))
+        {
+            return false;
+        }
+        if (ahead && i==0)
+        {   //every later pair is decoded as it is pushed
+            std::vector<cv::Mat> light_frames;
+            for (unsigned index : light_images)
+            {
+                light_frames.push_back(images[index]);
+            }
+            if (!decoder.set_direct_light_images(light_frames, b) || !decoder.direct_light().data)
+            {
+                return false;
+            }
+        }
+    }
+    direct_light = decoder.direct_light().clone();
+    return decoder.finish(pattern_image, min_max_image);
+}
+
+static void test_robust_decode(void)
+{
+    std::mt19937 rng(11);
+    const unsigned bits = 10;
+    const unsigned m = 5;
+    const float b = 0.5f;
+    for (int depth : {CV_8U, CV_16U})
+    {
+        for (unsigned variant : {0u, static_cast<unsigned>(sl::ColumnsOnlyDecode), static_cast<unsigned>(sl::PackedDecode)})
+        {
+            const unsigned flags = sl::RobustDecode | variant;
+            const unsigned pairs = 1 + ((flags & sl::ColumnsOnlyDecode) ? 1 : 2)*bits;
+            std::vector<cv::Mat> images = random_set(cv::Size(33, 4), pairs, depth, (depth==CV_16U ? 4095 : 255), m, rng);
+            std::vector<unsigned> light_images = sl::get_direct_light_images(static_cast<int>(images.size()), (flags & sl::ColumnsOnlyDecode)!=0);
+            CHECK(light_images.size()==8);
+
+            std::vector<cv::Mat> light_frames;
+            for (unsigned index : light_images)
+            {
+                light_frames.push_back(images[index]);
+            }
+            cv::Mat expected_light = (depth==CV_16U ? reference_direct_light<unsigned short>(light_frames, b) 
+                                                    : reference_direct_light<unsigned char>(light_frames, b));
+
+            cv::Mat given_pattern, given_min_max;
+            CHECK(decode_set(images, bits, flags, expected_light, m, given_pattern, given_min_max));
+            for (bool ahead : {false, true})
+            {
+                cv::Mat pattern_image, min_max_image, direct_light;
+                CHECK(decode_estimated(images, bits, flags, light_images, b, m, ahead, pattern_image, min_max_image, direct_light));
+                if (!same_bits(direct_light, expected_light) || !same_bits(pattern_image, given_pattern) || !same_bits(min_max_image, given_min_max))
+                {
+                    std::cerr << "[direct_light_test] robust decode depth " << depth << " flags " << flags << " ahead " << ahead << std::endl;
+                    CHECK(same_bits(direct_light, expected_light));
+                    CHECK(same_bits(pattern_image, given_pattern));
+                    CHECK(same_bits(min_max_image, given_min_max));
+                }
+            }
+        }
+    }
+
+    //the white/black pair is never a direct light image
+    sl::Decoder decoder;
+    CHECK(decoder.begin(cv::Size(8, 2), cv::Size(16, 16), 4, sl::RobustDecode));
+    CHECK(!decoder.estimate_direct_light(std::vector<unsigned>(1, 1), b));
+    CHECK(!decoder.estimate_direct_light(std::vector<unsigned>(1, 18), b));
+    CHECK(decoder.estimate_direct_light(std::vector<unsigned>(1, 17), b));
+
+    //light images read ahead: after the white/black pair only, with the image size and depth
+    const cv::Mat frame(2, 8, CV_8UC1, cv::Scalar(100));
+    CHECK(decoder.begin(cv::Size(8, 2), cv::Size(16, 16), 4, sl::RobustDecode));
+    CHECK(!decoder.set_direct_light_images(std::vector<cv::Mat>(1, frame), b));
+    CHECK(decoder.push_pair(frame, frame));
+    CHECK(!decoder.set_direct_light_images(std::vector<cv::Mat>(), b));
+    CHECK(!decoder.set_direct_light_images(std::vector<cv::Mat>(1, cv::Mat(2, 8, CV_16UC1, cv::Scalar(100))), b));
+    CHECK(!decoder.set_direct_light_images(std::vector<cv::Mat>(1, cv::Mat(3, 8, CV_8UC1, cv::Scalar(100))), b));
+    CHECK(decoder.set_direct_light_images(std::vector<cv::Mat>(2, frame), b) && decoder.direct_light().data);
+    CHECK(!decoder.set_direct_light_images(std::vector<cv::Mat>(2, frame), b));
+}
+
+int main(int /*argc*/, char ** /*argv*/)
+{
+    test_estimator();
+    test_direct_light_images();
+    test_robust_decode();
+    return test_result("direct_light_test");
+}
@@ -0,0 +1,260 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//FrameStack: frame names, write/open round trip, and rejection of damaged headers
+
+#include "frame_stack.hpp"
+#include "structured_light.hpp"
+#include "test_util.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <opencv2/highgui.hpp>
+
+//header field offsets: magic[8], 10 int32 fields, 3 int64 fields
+enum {VERSION_FIELD = 8, FRAME_COUNT_FIELD = 12, WIDTH_FIELD = 16, HEIGHT_FIELD = 20, DEPTH_FIELD = 44,
+      FRAME_OFFSET_FIELD = 48, FRAME_STRIDE_FIELD = 56, TEXTURE_OFFSET_FIELD = 64, HEADER_BYTES = 72};
+
+static std::vector<char> read_file(const std::string & filename)
+{
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string & filename, const std::vector<char> & data)
+{
+    std::ofstream file(filename.c_str(), std::ios::binary);
+    file.write(data.data(), data.size());
+}
+
+template <typename T>
+static void set_field(std::vector<char> & data, size_t offset, T value)
+{
+    memcpy(&data[offset], &value, sizeof(T));
+}
+
+static bool opens(const std::string & filename)
+{
+    FrameStack stack;
+    return stack.open(filename);
+}
+
+static void test_frame_names(void)
+{
+    std::string filename;
+    unsigned index = 0;
+    CHECK(FrameStack::frame_name("set/frames.s3d", 12)=="set/frames.s3d#12");
+    CHECK(FrameStack::split_frame_name("set/frames.s3d#12", filename, index) && filename=="set/frames.s3d" && index==12);
+    CHECK(FrameStack::split_frame_name("a#b/frames.s3d#0", filename, index) && filename=="a#b/frames.s3d" && index==0);
+    CHECK(!FrameStack::split_frame_name("set/cam_01.png", filename, index));
+    CHECK(!FrameStack::split_frame_name("set/frames.s3d#", filename, index));
+    CHECK(!FrameStack::split_frame_name("set/frames.s3d#1x", filename, index));
+    CHECK(!FrameStack::split_frame_name("set/frames.s3d#-1", filename, index));
+}
+
+static void test_round_trip(const std::filesystem::path & dir)
+{
+    std::mt19937 rng(1234);
+    const cv::Size size(37, 11);   //rows are not a multiple of the alignment
+    std::vector<std::string> images;
+    cv::Mat first_color;
+    for (unsigned i=0; i<5; i++)
+    {
+        cv::Mat color_image(size, CV_8UC3);
+        for (int h=0; h<size.height; h++)
+        {
+            for (int w=0; w<size.width; w++)
+            {
+                color_image.at<cv::Vec3b>(h, w) = cv::Vec3b(static_cast<unsigned char>(rng()), static_cast<unsigned char>(rng()), 
+                                                             static_cast<unsigned char>(rng()));
+            }
+        }
+        images.push_back((dir / ("cam_" + std::to_string(i) + ".png")).string());
+        CHECK(cv::imwrite(images.back(), color_image));
+        if (i==0)
+        {
+            first_color = color_image;
+        }
+    }
+
+    FrameStack::Layout layout;
+    layout.projector_size = cv::Size(800, 600);
+    layout.images_per_bit = 2;
+    layout.columns_only = true;
+    layout.phase_steps = 4;
+    const std::string filename = (dir / FRAME_STACK_FILENAME).string();
+    CHECK(FrameStack::write(filename, images, layout));
+    CHECK(!std::filesystem::exists(filename + ".tmp"));
+
+    FrameStack stack;
+    CHECK(stack.open(filename));
+    CHECK(stack.frame_count()==images.size());
+    CHECK(stack.size()==size && stack.depth()==CV_8U);
+    CHECK(stack.layout().projector_size==layout.projector_size);
+    CHECK(stack.layout().images_per_bit==2 && stack.layout().columns_only && stack.layout().phase_steps==4);
+    for (unsigned i=0; i<images.size(); i++)
+    {
+        cv::Mat frame = stack.frame(i);
+        CHECK(frame.type()==CV_8UC1 && reinterpret_cast<uintptr_t>(frame.data)%64==0);
+        CHECK(same_bits(frame, cv::imread(images[i], cv::IMREAD_GRAYSCALE)));
+        CHECK(same_bits(sl::get_gray_image(FrameStack::frame_name(filename, i)), frame));
+    }
+    CHECK(stack.frame(static_cast<unsigned>(images.size())).empty());
+    CHECK(same_bits(stack.texture(), first_color));
+
+    //shared stacks are mapped once
+    std::shared_ptr<FrameStack> shared = FrameStack::shared(filename);
+    CHECK(shared && shared==FrameStack::shared(filename));
+    CHECK(!FrameStack::shared((dir / "missing.s3d").string()));
+
+    //a loaded frame keeps its stack mapped after the shared stacks are released
+    std::shared_ptr<FrameStack> frame_stack;
+    cv::Mat frame = sl::get_gray_image(FrameStack::frame_name(filename, 2), &frame_stack);
+    CHECK(frame_stack==shared);
+    shared.reset();
+    FrameStack::release_shared();
+    CHECK(frame_stack.use_count()==1 && frame_stack->is_open());
+    CHECK(same_bits(frame, cv::imread(images[2], cv::IMREAD_GRAYSCALE)));
+    frame_stack.reset();
+    stack.close();
+    CHECK(!stack.is_open() && stack.frame(0).empty());
+
+    //without texture
+    CHECK(FrameStack::write(filename, images, layout, false));
+    CHECK(stack.open(filename) && stack.texture().empty());
+    stack.close();
+
+    //missing or different size images: nothing is written
+    const std::string bad_filename = (dir / "bad.s3d").string();
+    std::vector<std::string> missing(images);
+    missing.push_back((dir / "missing.png").string());
+    CHECK(!FrameStack::write(bad_filename, missing, layout));
+    CHECK(cv::imwrite((dir / "small.png").string(), cv::Mat(size.height - 1, size.width, CV_8UC1, cv::Scalar(7))));
+    std::vector<std::string> different(images);
+    different.push_back((dir / "small.png").string());
+    CHECK(!FrameStack::write(bad_filename, different, layout));
+    CHECK(cv::imwrite((dir / "wide.png").string(), cv::Mat(size, CV_16UC1, cv::Scalar(1000))));
+    std::vector<std::string> mixed(images);
+    mixed.push_back((dir / "wide.png").string());
+    CHECK(!FrameStack::write(bad_filename, mixed, layout));
+    CHECK(!std::filesystem::exists(bad_filename) && !std::filesystem::exists(bad_filename + ".tmp"));
+    CHECK(!FrameStack::write(bad_filename, std::vector<std::string>(), layout));
+}
+
+//16 bit frames (12/16 bit cameras) keep their depth, the texture is 8 bit color
+static void test_wide_frames(const std::filesystem::path & dir)
+{
+    std::mt19937 rng(4321);
+    const cv::Size size(23, 9);
+    std::vector<std::string> images;
+    for (unsigned i=0; i<4; i++)
+    {
+        images.push_back((dir / ("wide_" + std::to_string(i) + ".png")).string());
+        CHECK(cv::imwrite(images.back(), random_image(size, CV_16U, 65535, rng)));
+    }
+
+    const std::string filename = (dir / "wide.s3d").string();
+    CHECK(FrameStack::write(filename, images, FrameStack::Layout()));
+    FrameStack stack;
+    CHECK(stack.open(filename));
+    CHECK(stack.frame_count()==images.size() && stack.size()==size && stack.depth()==CV_16U);
+    for (unsigned i=0; i<images.size(); i++)
+    {
+        cv::Mat frame = stack.frame(i);
+        CHECK(frame.type()==CV_16UC1 && reinterpret_cast<uintptr_t>(frame.data)%64==0);
+        CHECK(same_bits(frame, cv::imread(images[i], cv::IMREAD_GRAYSCALE|cv::IMREAD_ANYDEPTH)));
+        CHECK(same_bits(sl::get_gray_image(FrameStack::frame_name(filename, i)), frame));
+    }
+    CHECK(same_bits(stack.texture(), cv::imread(images[0], cv::IMREAD_COLOR)));
+    stack.close();
+
+    //a stride large enough for 8 bit frames is too short for 16 bit ones
+    std::vector<char> data = read_file(filename);
+    set_field<int64_t>(data, FRAME_STRIDE_FIELD, static_cast<int64_t>(size.area()));
+    write_file(filename, data);
+    CHECK(!opens(filename));
+    FrameStack::release_shared();
+}
+
+static void test_damaged_headers(const std::filesystem::path & dir)
+{
+    const std::string filename = (dir / FRAME_STACK_FILENAME).string();
+    const std::string damaged = (dir / "damaged.s3d").string();
+    const std::vector<char> data = read_file(filename);
+    CHECK(data.size()>HEADER_BYTES && opens(filename));
+
+    int64_t frame_offset = 0;
+    memcpy(&frame_offset, &data[FRAME_OFFSET_FIELD], sizeof(int64_t));
+
+    std::vector<std::vector<char> > cases;
+    cases.push_back(std::vector<char>(data.begin(), data.begin() + HEADER_BYTES - 1));   //shorter than the header
+    cases.push_back(std::vector<char>(data.begin(), data.end() - 1));                    //last frame or texture cut
+    cases.push_back(data); cases.back()[0] = 'X';                                        //magic
+    cases.push_back(data); set_field<int32_t>(cases.back(), VERSION_FIELD, 99);
+    cases.push_back(data); set_field<int32_t>(cases.back(), FRAME_COUNT_FIELD, 0);
+    cases.push_back(data); set_field<int32_t>(cases.back(), FRAME_COUNT_FIELD, 1000);
+    cases.push_back(data); set_field<int32_t>(cases.back(), WIDTH_FIELD, 0);
+    cases.push_back(data); set_field<int32_t>(cases.back(), HEIGHT_FIELD, -5);
+    cases.push_back(data); set_field<int32_t>(cases.back(), DEPTH_FIELD, 12);
+    cases.push_back(data); set_field<int32_t>(cases.back(), DEPTH_FIELD, 16);   //16 bit frames do not fit the stride
+    cases.push_back(data); set_field<int64_t>(cases.back(), FRAME_OFFSET_FIELD, HEADER_BYTES - 1);
+    cases.push_back(data); set_field<int64_t>(cases.back(), FRAME_STRIDE_FIELD, 1);
+    cases.push_back(data); set_field<int64_t>(cases.back(), FRAME_STRIDE_FIELD, int64_t(1)<<62);   //4 frames: stride*count wraps to 0
+                           set_field<int32_t>(cases.back(), FRAME_COUNT_FIELD, 4);
+    cases.push_back(data); set_field<int64_t>(cases.back(), FRAME_OFFSET_FIELD, int64_t(1)<<62);
+    cases.push_back(data); set_field<int64_t>(cases.back(), TEXTURE_OFFSET_FIELD, frame_offset - 1);
+    cases.push_back(data); set_field<int64_t>(cases.back(), TEXTURE_OFFSET_FIELD, static_cast<int64_t>(data.size()));
+    for (size_t i=0; i<cases.size(); i++)
+    {
+        write_file(damaged, cases[i]);
+        if (opens(damaged))
+        {
+            std::cerr << "[frame_stack_test] damaged header " << i << " accepted\n";
+            CHECK(!opens(damaged));
+        }
+    }
+    CHECK(!opens((dir / "missing.s3d").string()));
+}
+
+int main(int /*argc*/, char ** /*argv*/)
+{
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "frame_stack_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    test_frame_names();
+    test_round_trip(dir);
+    test_wide_frames(dir);
+    test_damaged_headers(dir);
+
+    std::filesystem::remove_all(dir);
+    return test_result("frame_stack_test");
+}
@@ -0,0 +1,231 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//timing harness (not run by ctest): patch_center_bench [width height [repeat]]
+//point collection of scan3d::reconstruct_model_patch_center() on a synthetic code image: camera pixels bucketed 
+//by projector pixel with the former QMap of std::vector lists, and with the two pass flat (CSR) layout;
+//both must give the same patch centers. Triangulation is the same in both and is not timed.
+
+#include "structured_light.hpp"
+#include "test_util.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+#include <QMap>
+
+//projector pixel bucket: camera center and projector point
+struct PatchCenter
+{
+    unsigned index;
+    cv::Point2d cam;
+    cv::Point2f proj;
+};
+
+//mean time of one call in milliseconds
+static double time_ms(const std::function<void(void)> & function, unsigned repeat)
+{
+    function(); //warm up
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<repeat; i++)
+    {
+        function();
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()/repeat;
+}
+
+//camera looking at a slanted plane: smooth codes covering most of the projector, 
+//some pixels undecoded and some in shadow
+static sl::CodeImage synthetic_codes(cv::Size const& size, cv::Size const& projector_size, cv::Mat & min_max_image, std::mt19937 & rng)
+{
+    std::uniform_int_distribution<int> undecoded(0, 9);
+    std::uniform_int_distribution<int> contrast(0, 255);
+    std::uniform_real_distribution<float> jitter(-0.7f, 0.7f);
+    cv::Mat pattern_image(size, CV_32FC2);
+    min_max_image.create(size, CV_8UC2);
+    for (int h=0; h<size.height; h++)
+    {
+        for (int w=0; w<size.width; w++)
+        {
+            float x = (0.05f + 0.9f*w/size.width + 0.03f*h/size.height)*projector_size.width + jitter(rng);
+            float y = (0.05f + 0.9f*h/size.height)*projector_size.height + jitter(rng);
+            pattern_image.at<cv::Vec2f>(h, w) = (undecoded(rng)==0 ? cv::Vec2f(sl::PIXEL_UNCERTAIN, sl::PIXEL_UNCERTAIN) 
+                                                                   : cv::Vec2f(std::floor(x), std::floor(y)));
+            int value = contrast(rng);
+            min_max_image.at<cv::Vec2b>(h, w) = cv::Vec2b(0, static_cast<unsigned char>(value));
+        }
+    }
+    return sl::CodeImage(pattern_image);
+}
+
+static inline bool skip(sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Size const& projector_size, int threshold, int h, int w)
+{
+    const cv::Vec2w & code = code_image.codes_row(h)[w];
+    return !code_image.valid(h, w) || code[0]>=projector_size.width || code[1]>=projector_size.height
+        || sl::get_contrast(min_max_image.ptr<unsigned char>(h), w, false)<threshold;
+}
+
+//former layout: QMap of projector points and QMap of camera point lists
+static void collect_qmap(sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Size const& projector_size, int threshold,
+                         std::vector<PatchCenter> & centers)
+{
+    const int out_cols = projector_size.width;
+    QMap<unsigned, cv::Point2f> proj_points;
+    QMap<unsigned, std::vector<cv::Point2f> > cam_points;
+    for (int h=0; h<code_image.codes.rows; h++)
+    {
+        for (int w=0; w<code_image.codes.cols; w++)
+        {
+            if (skip(code_image, min_max_image, projector_size, threshold, h, w))
+            {
+                continue;
+            }
+            const cv::Vec2w & code = code_image.codes_row(h)[w];
+            cv::Point2f proj_point(static_cast<float>(code[0]), static_cast<float>(code[1]));
+            unsigned index = static_cast<unsigned>(proj_point.y)*out_cols + static_cast<unsigned>(proj_point.x);
+            proj_points.insert(index, proj_point);
+            cam_points[index].push_back(cv::Point2f(w + code_image.offset.x, h + code_image.offset.y));
+        }
+    }
+
+    centers.clear();
+    QMapIterator<unsigned, cv::Point2f> iter1(proj_points);
+    while (iter1.hasNext())
+    {
+        iter1.next();
+        unsigned index = iter1.key();
+        const std::vector<cv::Point2f> & cam_point_list = cam_points.value(index);
+        const unsigned count = static_cast<unsigned>(cam_point_list.size());
+        cv::Point2d sum(0.0, 0.0);
+        for (std::vector<cv::Point2f>::const_iterator iter2=cam_point_list.begin(); iter2!=cam_point_list.end(); iter2++)
+        {
+            sum.x += iter2->x;
+            sum.y += iter2->y;
+        }
+        PatchCenter center = {index, cv::Point2d(sum.x/count, sum.y/count), iter1.value()};
+        centers.push_back(center);
+    }
+}
+
+//flat layout: bucket sizes, prefix sum, camera points in scan order
+static void collect_csr(sl::CodeImage const& code_image, cv::Mat const& min_max_image, cv::Size const& projector_size, int threshold,
+                        std::vector<PatchCenter> & centers)
+{
+    const int out_cols = projector_size.width;
+    const size_t bucket_count = static_cast<size_t>(projector_size.height)*out_cols;
+    std::vector<unsigned> bucket_start(bucket_count + 1, 0);
+    for (int h=0; h<code_image.codes.rows; h++)
+    {
+        for (int w=0; w<code_image.codes.cols; w++)
+        {
+            if (!skip(code_image, min_max_image, projector_size, threshold, h, w))
+            {
+                const cv::Vec2w & code = code_image.codes_row(h)[w];
+                bucket_start[static_cast<size_t>(code[1])*out_cols + code[0] + 1]++;
+            }
+        }
+    }
+    for (size_t i=0; i<bucket_count; i++)
+    {
+        bucket_start[i + 1] += bucket_start[i];
+    }
+
+    std::vector<cv::Point2f> cam_points(bucket_start[bucket_count]);
+    std::vector<unsigned> bucket_end(bucket_start.begin(), bucket_start.end() - 1);
+    for (int h=0; h<code_image.codes.rows; h++)
+    {
+        for (int w=0; w<code_image.codes.cols; w++)
+        {
+            if (!skip(code_image, min_max_image, projector_size, threshold, h, w))
+            {
+                const cv::Vec2w & code = code_image.codes_row(h)[w];
+                cam_points[bucket_end[static_cast<size_t>(code[1])*out_cols + code[0]]++] = cv::Point2f(w + code_image.offset.x, h + code_image.offset.y);
+            }
+        }
+    }
+
+    centers.clear();
+    for (size_t index=0; index<bucket_count; index++)
+    {
+        const unsigned first = bucket_start[index];
+        const unsigned count = bucket_start[index + 1] - first;
+        if (!count)
+        {
+            continue;
+        }
+        const cv::Point2f & last = cam_points[first + count - 1];
+        const cv::Vec2w & code = code_image.codes_row(static_cast<int>(last.y) - code_image.offset.y)[static_cast<int>(last.x) - code_image.offset.x];
+        cv::Point2d sum(0.0, 0.0);
+        for (unsigned i=first; i<first+count; i++)
+        {
+            sum.x += cam_points[i].x;
+            sum.y += cam_points[i].y;
+        }
+        PatchCenter center = {static_cast<unsigned>(index), cv::Point2d(sum.x/count, sum.y/count), 
+                              cv::Point2f(static_cast<float>(code[0]), static_cast<float>(code[1]))};
+        centers.push_back(center);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    cv::Size size(1280, 960);
+    unsigned repeat = 5;
+    if (argc>=3)
+    {
+        size = cv::Size(atoi(argv[1]), atoi(argv[2]));
+    }
+    if (argc>=4)
+    {
+        repeat = static_cast<unsigned>(atoi(argv[3]));
+    }
+    if (size.width<1 || size.height<1 || repeat<1)
+    {
+        std::cerr << "usage: patch_center_bench [width height [repeat]]\n";
+        return 1;
+    }
+
+    std::mt19937 rng(2024);
+    const cv::Size projector_size(1024, 768);
+    const int threshold = 25;
+    cv::Mat min_max_image;
+    sl::CodeImage code_image = synthetic_codes(size, projector_size, min_max_image, rng);
+
+    std::vector<PatchCenter> qmap_centers, csr_centers;
+    double qmap_ms = time_ms([&]() {collect_qmap(code_image, min_max_image, projector_size, threshold, qmap_centers);}, repeat);
+    double csr_ms = time_ms([&]() {collect_csr(code_image, min_max_image, projector_size, threshold, csr_centers);}, repeat);
+
+    bool same = (qmap_centers.size()==csr_centers.size());
+    for (size_t i=0; same && i<qmap_centers.size(); i++)
+    {
+        same = qmap_centers[i].index==csr_centers[i].index && qmap_centers[i].cam==csr_centers[i].cam && qmap_centers[i].proj==csr_centers[i].proj;
+    }
+    std::cout << "[patch_center_bench] " << size.width << "x" << size.height << ", " << csr_centers.size() << " projector pixels: QMap " 
+              << qmap_ms << " ms, CSR " << csr_ms << " ms (" << qmap_ms/csr_ms << "x), centers " << (same ? "equal" : "DIFFER") << std::endl;
+    return (same ? 0 : 1);
+}
@@ -0,0 +1,215 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+//sl::scale_pattern: a set projected with fewer bits, decoded and scaled, gives the codes of the full set
+//of the same scene rounded to the center of their block of projector pixels
+
+#include "structured_light.hpp"
+#include "test_util.hpp"
+
+//camera pixel -> projector column/row seen by it
+struct Scene
+{
+    cv::Mat cols;   //CV_32SC1
+    cv::Mat rows;
+};
+
+static Scene random_scene(cv::Size const& size, cv::Size const& projector_size, std::mt19937 & rng)
+{
+    std::uniform_int_distribution<int> col(0, projector_size.width - 1);
+    std::uniform_int_distribution<int> row(0, projector_size.height - 1);
+    Scene scene;
+    scene.cols.create(size, CV_32SC1);
+    scene.rows.create(size, CV_32SC1);
+    for (int h=0; h<size.height; h++)
+    {
+        for (int w=0; w<size.width; w++)
+        {
+            scene.cols.at<int>(h, w) = col(rng);
+            scene.rows.at<int>(h, w) = row(rng);
+        }
+    }
+    return scene;
+}
+
+//the images ProjectorWidget projects with the bits coarse Gray bits of the projector: white/black pair, then columns and rows
+static std::vector<cv::Mat> capture_set(const Scene & scene, cv::Size const& projector_size, unsigned bits, bool columns_only)
+{
+    const int size[2] = {projector_size.width, projector_size.height};
+    const cv::Mat * codes[2] = {&scene.cols, &scene.rows};
+    std::vector<cv::Mat> images;
+    images.push_back(cv::Mat(scene.cols.size(), CV_8UC1, cv::Scalar(220)));
+    images.push_back(cv::Mat(scene.cols.size(), CV_8UC1, cv::Scalar(20)));
+    for (int i=0; i<(columns_only ? 1 : 2); i++)
+    {
+        const unsigned projector_bits = sl::get_pattern_bits(size[i]);
+        const int offset = ((1<<projector_bits) - size[i])/2;
+        for (unsigned k=0; k<bits; k++)
+        {
+            const unsigned bit = projector_bits - 1 - k;
+            cv::Mat image1(scene.cols.size(), CV_8UC1), image2(scene.cols.size(), CV_8UC1);
+            for (int h=0; h<image1.rows; h++)
+            {
+                for (int w=0; w<image1.cols; w++)
+                {
+                    const bool lit = ((sl::binaryToGray(codes[i]->at<int>(h, w) + offset)>>bit) & 1)!=0;
+                    image1.at<unsigned char>(h, w) = (lit ? 200 : 30);
+                    image2.at<unsigned char>(h, w) = (lit ? 30 : 200);
+                }
+            }
+            images.push_back(image1);
+            images.push_back(image2);
+        }
+    }
+    return images;
+}
+
+static bool decode(const std::vector<cv::Mat> & images, cv::Size const& pattern_size, unsigned bits, bool columns_only, cv::Mat & pattern_image)
+{
+    sl::Decoder decoder;
+    const unsigned flags = sl::SimpleDecode | sl::GrayPatternDecode | (columns_only ? sl::ColumnsOnlyDecode : 0);
+    if (!decoder.begin(images[0].size(), pattern_size, bits, flags, cv::Mat(), 5))
+    {
+        return false;
+    }
+    for (size_t i=0; i+1<images.size(); i+=2)
+    {
+        if (!decoder.push_pair(images[i], images[i + 1]))
+        {
+            return false;
+        }
+    }
+    cv::Mat min_max_image;
+    return decoder.finish(pattern_image, min_max_image);
+}
+
+//pattern size of the set with fewer bits, as ProjectorWidget::get_effective_size
+static cv::Size reduced_size(cv::Size const& projector_size, unsigned bits)
+{
+    cv::Size size = projector_size;
+    while (size.width>(1<<bits)) { size.width >>= 1; }
+    while (size.height>(1<<bits)) { size.height >>= 1; }
+    return size;
+}
+
+static void test_reduced_set(cv::Size const& projector_size, unsigned skipped, bool columns_only)
+{
+    std::mt19937 rng(projector_size.width + skipped);
+    const cv::Size size(64, 48);
+    const unsigned bits = sl::get_pattern_bits(projector_size.width);
+    const Scene scene = random_scene(size, projector_size, rng);
+
+    //full set: the codes of the scene
+    cv::Mat full_pattern;
+    CHECK(decode(capture_set(scene, projector_size, bits, columns_only), projector_size, bits, columns_only, full_pattern));
+    CHECK(full_pattern.size()==size);
+    if (full_pattern.size()!=size)
+    {
+        return;
+    }
+    int exact = 0;
+    for (int h=0; h<size.height; h++)
+    {
+        for (int w=0; w<size.width; w++)
+        {
+            const cv::Vec2f & code = full_pattern.at<cv::Vec2f>(h, w);
+            exact += (code[0]==scene.cols.at<int>(h, w) && code[1]==(columns_only ? 0 : scene.rows.at<int>(h, w)));
+        }
+    }
+    CHECK(exact==size.area());
+
+    //the same scene with the finest bits skipped
+    const cv::Size pattern_size = reduced_size(projector_size, bits - skipped);
+    cv::Mat reduced_pattern;
+    CHECK(decode(capture_set(scene, projector_size, bits - skipped, columns_only), pattern_size, bits - skipped, columns_only, reduced_pattern));
+    CHECK(reduced_pattern.size()==size);
+    if (reduced_pattern.size()!=size)
+    {
+        return;
+    }
+    CHECK(sl::scale_pattern(reduced_pattern, pattern_size, projector_size, columns_only));
+
+    //full codes rounded to the center of their block
+    const int block = 1<<skipped;
+    const int offset[2] = {((1<<bits) - projector_size.width)/2, ((1<<bits) - projector_size.height)/2};
+    int matched = 0, max_error = 0;
+    for (int h=0; h<size.height; h++)
+    {
+        for (int w=0; w<size.width; w++)
+        {
+            const cv::Vec2f & full = full_pattern.at<cv::Vec2f>(h, w);
+            const cv::Vec2f & scaled = reduced_pattern.at<cv::Vec2f>(h, w);
+            bool same = true;
+            for (int i=0; i<(columns_only ? 1 : 2); i++)
+            {
+                const int code = static_cast<int>(full[i]);
+                const float center = ((code + offset[i])/block)*block - offset[i] + 0.5f*(block - 1);
+                same = same && (scaled[i]==center);
+                max_error = std::max(max_error, static_cast<int>(std::ceil(std::fabs(scaled[i] - full[i]))));
+            }
+            same = same && (!columns_only || scaled[1]==0.f);
+            matched += same;
+        }
+    }
+    CHECK(matched==size.area());
+    CHECK(2*max_error<=block);
+}
+
+static void test_invalid_sizes(void)
+{
+    cv::Mat pattern_image(2, 3, CV_32FC2, cv::Scalar(5.f, 7.f));
+    cv::Mat copy = pattern_image.clone();
+
+    //not a halved projector size
+    CHECK(!sl::scale_pattern(pattern_image, cv::Size(300, 192), cv::Size(1024, 768)));
+    CHECK(!sl::scale_pattern(pattern_image, cv::Size(256, 200), cv::Size(1024, 768)));
+    CHECK(same_bits(pattern_image, copy));
+
+    //full resolution: nothing to do
+    CHECK(sl::scale_pattern(pattern_image, cv::Size(1024, 768), cv::Size(1024, 768)));
+    CHECK(same_bits(pattern_image, copy));
+
+    //columns only: the row size is not checked and the row code kept
+    CHECK(sl::scale_pattern(pattern_image, cv::Size(512, 100), cv::Size(1024, 768), true));
+    CHECK(pattern_image.at<cv::Vec2f>(1, 2)==cv::Vec2f(10.5f, 7.f));
+
+    //invalid codes stay invalid
+    cv::Mat invalid(1, 1, CV_32FC2, cv::Scalar(sl::PIXEL_UNCERTAIN, sl::PIXEL_UNCERTAIN));
+    CHECK(sl::scale_pattern(invalid, cv::Size(256, 192), cv::Size(1024, 768)));
+    CHECK(sl::INVALID(invalid.at<cv::Vec2f>(0, 0)));
+}
+
+int main(int /*argc*/, char ** /*argv*/)
+{
+    for (bool columns_only : {false, true})
+    {
+        test_reduced_set(cv::Size(1024, 768), 2, columns_only);
+        test_reduced_set(cv::Size(800, 600), 2, columns_only);
+        test_reduced_set(cv::Size(1024, 768), 1, columns_only);
+    }
+    test_invalid_sizes();
+    return test_result("scale_pattern_test");
+}
@@ -0,0 +1,172 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __TEST_UTIL_HPP__
+#define __TEST_UTIL_HPP__
+
+#include <iostream>
+#include <random>
+#include <cstring>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "structured_light.hpp"
+
+//failed checks are reported and counted, the test returns the count
+static int test_failures = 0;
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            std::cerr << "[test] FAILED " << __FILE__ << ":" << __LINE__ << ": " << #cond << std::endl; \
+            test_failures++; \
+        } \
+    } while (0)
+
+static inline int test_result(const char * name)
+{
+    if (test_failures)
+    {
+        std::cerr << "[" << name << "] " << test_failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "[" << name << "] ok\n";
+    return 0;
+}
+
+//same size, type and bytes (NaN codes compare equal)
+static inline bool same_bits(const cv::Mat & a, const cv::Mat & b)
+{
+    if (a.size()!=b.size() || a.type()!=b.type())
+    {
+        return false;
+    }
+    const size_t row_bytes = a.cols*a.elemSize();
+    for (int h=0; h<a.rows; h++)
+    {
+        if (memcmp(a.ptr(h), b.ptr(h), row_bytes))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//random CV_8UC1 or CV_16UC1 image with values in [0,max_value]
+static inline cv::Mat random_image(cv::Size const& size, int depth, int max_value, std::mt19937 & rng)
+{
+    std::uniform_int_distribution<int> value(0, max_value);
+    cv::Mat image(size, CV_MAKETYPE(depth, 1));
+    for (int h=0; h<size.height; h++)
+    {
+        for (int w=0; w<size.width; w++)
+        {
+            if (depth==CV_16U) {image.ptr<unsigned short>(h)[w] = static_cast<unsigned short>(value(rng));}
+            else               {image.ptr<unsigned char>(h)[w] = static_cast<unsigned char>(value(rng));}
+        }
+    }
+    return image;
+}
+
+//image2 close to image1: equal values and differences around m are frequent, one pixel in four is unrelated
+static inline cv::Mat random_pair_image(const cv::Mat & image1, int max_value, int m, std::mt19937 & rng)
+{
+    std::uniform_int_distribution<int> value(0, max_value);
+    std::uniform_int_distribution<int> delta(-2*m - 2, 2*m + 2);
+    std::uniform_int_distribution<int> unrelated(0, 3);
+    cv::Mat image2(image1.size(), image1.type());
+    const bool wide = (image1.depth()==CV_16U);
+    for (int h=0; h<image1.rows; h++)
+    {
+        for (int w=0; w<image1.cols; w++)
+        {
+            int value1 = (wide ? image1.ptr<unsigned short>(h)[w] : image1.ptr<unsigned char>(h)[w]);
+            int value2 = (unrelated(rng)==0 ? value(rng) : std::min(max_value, std::max(0, value1 + delta(rng))));
+            if (wide) {image2.ptr<unsigned short>(h)[w] = static_cast<unsigned short>(value2);}
+            else      {image2.ptr<unsigned char>(h)[w] = static_cast<unsigned char>(value2);}
+        }
+    }
+    return image2;
+}
+
+//white/black pair followed by the bit pairs of every direction
+static inline std::vector<cv::Mat> random_set(cv::Size const& size, unsigned pairs, int depth, int max_value, int m, std::mt19937 & rng)
+{
+    std::vector<cv::Mat> images;
+    for (unsigned i=0; i<pairs; i++)
+    {
+        images.push_back(random_image(size, depth, max_value, rng));
+        images.push_back(random_pair_image(images.back(), max_value, m, rng));
+    }
+    return images;
+}
+
+static inline cv::Mat random_direct_light(cv::Size const& size, int depth, int max_value, std::mt19937 & rng)
+{
+    cv::Mat Ld = random_image(size, depth, max_value, rng);
+    cv::Mat Lg = random_image(size, depth, max_value, rng);
+    cv::Mat direct_light(size, CV_MAKETYPE(depth, 2));
+    for (int h=0; h<size.height; h++)
+    {
+        for (int w=0; w<size.width; w++)
+        {
+            if (depth==CV_16U)
+            {
+                direct_light.ptr<cv::Vec2w>(h)[w] = cv::Vec2w(Ld.ptr<unsigned short>(h)[w], Lg.ptr<unsigned short>(h)[w]);
+            }
+            else
+            {
+                direct_light.ptr<cv::Vec2b>(h)[w] = cv::Vec2b(Ld.ptr<unsigned char>(h)[w], Lg.ptr<unsigned char>(h)[w]);
+            }
+        }
+    }
+    return direct_light;
+}
+
+static inline bool decode_set(const std::vector<cv::Mat> & images, unsigned bits, unsigned flags, const cv::Mat & direct_light, unsigned m,
+                              cv::Mat & pattern_image, cv::Mat & min_max_image, sl::DecodeStats * stats = NULL)
+{
+    sl::Decoder decoder;
+    cv::Size projector_size(1<<bits, 1<<bits);
+    if (!decoder.begin(images[0].size(), projector_size, bits, flags, direct_light, m, 0, 0, images[0].depth()))
+    {
+        return false;
+    }
+    for (size_t i=0; i+1<images.size(); i+=2)
+    {
+        if (!decoder.push_pair(images[i], images[i + 1]))
+        {
+            return false;
+        }
+    }
+    return decoder.finish(pattern_image, min_max_image, NULL, stats);
+}
+
+#endif //__TEST_UTIL_HPP__
@@ -0,0 +1,197 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//scan3d::triangulate_batch: float and double structure of arrays triangulation against approximate_ray_intersection
+//on random ray pairs, empty and single point batches, and the same points without the distance output
+
+#include "scan3d.hpp"
+#include "test_util.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//projector rotated around y and shifted to the side of the camera
+struct Stereo
+{
+    double Rt[9];   //R^T row major
+    double T[3];
+};
+
+static Stereo test_stereo(void)
+{
+    const double a = 0.3, b = 0.05;
+    //R = Rx(b)*Ry(a)
+    const double R[9] = { std::cos(a),              0.0,         std::sin(a),
+                          std::sin(b)*std::sin(a),  std::cos(b), -std::sin(b)*std::cos(a),
+                         -std::cos(b)*std::sin(a),  std::sin(b),  std::cos(b)*std::cos(a)};
+    Stereo stereo;
+    for (int i=0; i<3; i++)
+    {
+        for (int j=0; j<3; j++)
+        {
+            stereo.Rt[3*i + j] = R[3*j + i];
+        }
+    }
+    stereo.T[0] = -200.0; stereo.T[1] = 10.0; stereo.T[2] = 30.0;
+    return stereo;
+}
+
+//rays of random points 300 to 900 units in front of the camera, with noise so the rays do not meet:
+//cam_uv and proj_uv hold the n x followed by the n y coordinates
+static void random_rays(const Stereo & stereo, size_t n, std::mt19937 & rng, std::vector<double> & cam_uv, std::vector<double> & proj_uv)
+{
+    std::uniform_real_distribution<double> xy(-0.4, 0.4), depth(300.0, 900.0), noise(-1e-3, 1e-3);
+    cam_uv.resize(2*n);
+    proj_uv.resize(2*n);
+    for (size_t i=0; i<n; i++)
+    {
+        const double z = depth(rng);
+        const double p[3] = {xy(rng)*z, xy(rng)*z, z};
+        //projector coordinates R*p+T, with R the transpose of Rt
+        double q[3];
+        for (int k=0; k<3; k++)
+        {
+            q[k] = stereo.Rt[k]*p[0] + stereo.Rt[3 + k]*p[1] + stereo.Rt[6 + k]*p[2] + stereo.T[k];
+        }
+        cam_uv[i] = p[0]/p[2] + noise(rng);
+        cam_uv[n + i] = p[1]/p[2] + noise(rng);
+        proj_uv[i] = q[0]/q[2] + noise(rng);
+        proj_uv[n + i] = q[1]/q[2] + noise(rng);
+    }
+}
+
+static cv::Point3d reference_point(const Stereo & stereo, double x1, double y1, double x2, double y2, double & distance)
+{
+    const double * Rt = stereo.Rt;
+    const double * T = stereo.T;
+    cv::Point3d v1(x1, y1, 1.0);
+    cv::Point3d v2(Rt[0]*x2 + Rt[1]*y2 + Rt[2], Rt[3]*x2 + Rt[4]*y2 + Rt[5], Rt[6]*x2 + Rt[7]*y2 + Rt[8]);
+    cv::Point3d center(-(Rt[0]*T[0] + Rt[1]*T[1] + Rt[2]*T[2]), -(Rt[3]*T[0] + Rt[4]*T[1] + Rt[5]*T[2]), -(Rt[6]*T[0] + Rt[7]*T[1] + Rt[8]*T[2]));
+    return scan3d::approximate_ray_intersection(v1, cv::Point3d(0.0, 0.0, 0.0), v2, center, &distance);
+}
+
+//largest point and distance errors of a batch relative to the point depth, NaN counts as a failure
+template <typename Real>
+static void batch_errors(const Stereo & stereo, const std::vector<double> & cam_uv, const std::vector<double> & proj_uv, size_t n,
+                         const std::vector<Real> & xyz, const std::vector<Real> & dist, double & point_error, double & distance_error)
+{
+    point_error = distance_error = 0.0;
+    for (size_t i=0; i<n; i++)
+    {
+        double distance;
+        cv::Point3d p = reference_point(stereo, cam_uv[i], cam_uv[n + i], proj_uv[i], proj_uv[n + i], distance);
+        double e = std::max(std::max(std::abs(xyz[i] - p.x), std::abs(xyz[n + i] - p.y)), std::abs(xyz[2*n + i] - p.z))/p.z;
+        point_error = (e==e ? std::max(point_error, e) : HUGE_VAL);
+        e = std::abs(dist[i] - distance)/p.z;
+        distance_error = (e==e ? std::max(distance_error, e) : HUGE_VAL);
+    }
+}
+
+template <typename Real>
+static void test_batch(size_t n, double tolerance)
+{
+    const Stereo stereo = test_stereo();
+    std::mt19937 rng(static_cast<unsigned>(25 + n));
+    std::vector<double> cam_uv, proj_uv;
+    random_rays(stereo, n, rng, cam_uv, proj_uv);
+
+    std::vector<Real> cam(cam_uv.begin(), cam_uv.end()), proj(proj_uv.begin(), proj_uv.end());
+    const Real Rt[9] = {static_cast<Real>(stereo.Rt[0]), static_cast<Real>(stereo.Rt[1]), static_cast<Real>(stereo.Rt[2]),
+                        static_cast<Real>(stereo.Rt[3]), static_cast<Real>(stereo.Rt[4]), static_cast<Real>(stereo.Rt[5]),
+                        static_cast<Real>(stereo.Rt[6]), static_cast<Real>(stereo.Rt[7]), static_cast<Real>(stereo.Rt[8])};
+    const Real T[3] = {static_cast<Real>(stereo.T[0]), static_cast<Real>(stereo.T[1]), static_cast<Real>(stereo.T[2])};
+    std::vector<Real> xyz(3*n), dist(n);
+    scan3d::triangulate_batch(cam.data(), proj.data(), n, Rt, T, xyz.data(), dist.data());
+
+    double point_error, distance_error;
+    batch_errors(stereo, cam_uv, proj_uv, n, xyz, dist, point_error, distance_error);
+    std::cout << "[triangulate_batch_test] " << (sizeof(Real)==sizeof(float) ? "float" : "double") << " n=" << n 
+              << ": point error " << point_error << ", distance error " << distance_error << " (relative to depth)\n";
+    CHECK(point_error<tolerance);
+    CHECK(distance_error<tolerance);
+
+    //without the distance output: the same points
+    std::vector<Real> xyz_only(3*n);
+    scan3d::triangulate_batch(cam.data(), proj.data(), n, Rt, T, xyz_only.data());
+    bool same = true;
+    for (size_t i=0; i<3*n; i++)
+    {
+        same = same && std::abs(xyz_only[i] - xyz[i])<=std::abs(xyz[i])*std::numeric_limits<Real>::epsilon()*4;
+    }
+    CHECK(same);
+}
+
+//an empty batch writes nothing
+template <typename Real>
+static void test_empty_batch(void)
+{
+    const Real Rt[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    const Real T[3] = {-100, 0, 0};
+    const Real uv[2] = {0, 0};
+    Real xyz[3] = {7, 7, 7};
+    Real dist[1] = {7};
+    scan3d::triangulate_batch(uv, uv, 0, Rt, T, xyz, dist);
+    scan3d::triangulate_batch(uv, uv, 0, Rt, T, xyz);
+    CHECK(xyz[0]==7 && xyz[1]==7 && xyz[2]==7 && dist[0]==7);
+}
+
+//triangulate_rays() forwards one ray pair to the double batch
+static void test_single_ray(void)
+{
+    const Stereo stereo = test_stereo();
+    std::mt19937 rng(1);
+    std::vector<double> cam_uv, proj_uv;
+    random_rays(stereo, 1, rng, cam_uv, proj_uv);
+
+    cv::Matx33d Rt;
+    std::copy(stereo.Rt, stereo.Rt + 9, Rt.val);
+    cv::Vec3d T(stereo.T[0], stereo.T[1], stereo.T[2]);
+    cv::Point3d p;
+    double distance = -1.0;
+    scan3d::triangulate_rays(cv::Point2d(cam_uv[0], cam_uv[1]), cv::Point2d(proj_uv[0], proj_uv[1]), Rt, T, p, &distance);
+
+    double expected_distance;
+    cv::Point3d expected = reference_point(stereo, cam_uv[0], cam_uv[1], proj_uv[0], proj_uv[1], expected_distance);
+    CHECK(std::abs(p.x - expected.x)<1e-9*expected.z && std::abs(p.y - expected.y)<1e-9*expected.z && std::abs(p.z - expected.z)<1e-9*expected.z);
+    CHECK(std::abs(distance - expected_distance)<1e-9*expected.z);
+    scan3d::triangulate_rays(cv::Point2d(cam_uv[0], cam_uv[1]), cv::Point2d(proj_uv[0], proj_uv[1]), Rt, T, p);
+    CHECK(std::abs(p.z - expected.z)<1e-9*expected.z);
+}
+
+int main(int /*argc*/, char ** /*argv*/)
+{
+    for (size_t n : {size_t(1), size_t(3), size_t(1000)})
+    {
+        test_batch<double>(n, 1e-12);
+        test_batch<float>(n, 1e-4);
+    }
+    test_empty_batch<double>();
+    test_empty_batch<float>();
+    test_single_ray();
+    return test_result("triangulate_batch_test");
+}
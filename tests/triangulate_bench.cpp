@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2012, Daniel Moreno and Gabriel Taubin
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Brown University nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL DANIEL MORENO AND GABRIEL TAUBIN BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//timing harness (not run by ctest): triangulate_bench [points [repeat]]
+//points per second of scan3d::triangulate_batch (float and double, with the distance output) on undistorted rays, 
+//and of the former per point path scan3d::triangulate_stereo on pixels, which undistorts both points every call
+
+#include "scan3d.hpp"
+#include "test_util.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+//mean time of one call in milliseconds
+static double time_ms(const std::function<void(void)> & function, unsigned repeat)
+{
+    function(); //warm up
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<repeat; i++)
+    {
+        function();
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()/repeat;
+}
+
+static double mpoints_per_second(size_t points, double ms)
+{
+    return points/(ms*1e3);
+}
+
+int main(int argc, char ** argv)
+{
+    size_t n = 1<<20;
+    unsigned repeat = 10;
+    if (argc>=2)
+    {
+        n = static_cast<size_t>(atol(argv[1]));
+    }
+    if (argc>=3)
+    {
+        repeat = static_cast<unsigned>(atoi(argv[2]));
+    }
+    if (n<1 || repeat<1)
+    {
+        std::cerr << "usage: triangulate_bench [points [repeat]]\n";
+        return 1;
+    }
+
+    //camera and projector without distortion, projector rotated 0.3 rad around y and shifted to the side
+    cv::Mat K = cv::Mat::zeros(3, 3, CV_64FC1);
+    K.at<double>(0,0) = K.at<double>(1,1) = 1000.0;
+    K.at<double>(0,2) = 640.0; K.at<double>(1,2) = 480.0; K.at<double>(2,2) = 1.0;
+    cv::Mat kc = cv::Mat::zeros(1, 5, CV_64FC1);
+    cv::Mat Rt = cv::Mat::zeros(3, 3, CV_64FC1);
+    Rt.at<double>(0,0) = Rt.at<double>(2,2) = std::cos(0.3);
+    Rt.at<double>(0,2) = -std::sin(0.3); Rt.at<double>(2,0) = std::sin(0.3); Rt.at<double>(1,1) = 1.0;
+    cv::Mat T = cv::Mat::zeros(3, 1, CV_64FC1);
+    T.at<double>(0,0) = -200.0; T.at<double>(2,0) = 30.0;
+    double Rt_double[9], T_double[3] = {T.at<double>(0,0), T.at<double>(1,0), T.at<double>(2,0)};
+    float Rt_float[9], T_float[3] = {static_cast<float>(T_double[0]), static_cast<float>(T_double[1]), static_cast<float>(T_double[2])};
+    for (int i=0; i<9; i++)
+    {
+        Rt_double[i] = Rt.at<double>(i/3, i%3);
+        Rt_float[i] = static_cast<float>(Rt_double[i]);
+    }
+
+    //rays of random points 300 to 900 units in front of the camera, x followed by y coordinates
+    std::mt19937 rng(2025);
+    std::uniform_real_distribution<double> xy(-0.4, 0.4), depth(300.0, 900.0);
+    std::vector<double> cam_uv(2*n), proj_uv(2*n);
+    for (size_t i=0; i<n; i++)
+    {
+        const double z = depth(rng);
+        const double p[3] = {xy(rng)*z, xy(rng)*z, z};
+        //projector coordinates R*p+T, with R the transpose of Rt
+        double q[3];
+        for (int k=0; k<3; k++)
+        {
+            q[k] = Rt_double[k]*p[0] + Rt_double[3 + k]*p[1] + Rt_double[6 + k]*p[2] + T_double[k];
+        }
+        cam_uv[i] = p[0]/p[2];
+        cam_uv[n + i] = p[1]/p[2];
+        proj_uv[i] = q[0]/q[2];
+        proj_uv[n + i] = q[1]/q[2];
+    }
+    std::vector<float> cam_uv_float(cam_uv.begin(), cam_uv.end()), proj_uv_float(proj_uv.begin(), proj_uv.end());
+    std::vector<double> xyz(3*n), dist(n);
+    std::vector<float> xyz_float(3*n), dist_float(n);
+
+    double double_ms = time_ms([&]() {scan3d::triangulate_batch(cam_uv.data(), proj_uv.data(), n, Rt_double, T_double, xyz.data(), dist.data());}, repeat);
+    double float_ms = time_ms([&]() {scan3d::triangulate_batch(cam_uv_float.data(), proj_uv_float.data(), n, Rt_float, T_float, xyz_float.data(), dist_float.data());}, repeat);
+
+    //per point path on the pixels of the same rays, fewer points: it is much slower
+    const size_t stereo_n = std::min(n, size_t(1<<16));
+    std::vector<cv::Point3d> stereo_xyz(stereo_n);
+    double stereo_ms = time_ms([&]()
+    {
+        for (size_t i=0; i<stereo_n; i++)
+        {
+            cv::Point2d p1(1000.0*cam_uv[i] + 640.0, 1000.0*cam_uv[n + i] + 480.0);
+            cv::Point2d p2(1000.0*proj_uv[i] + 640.0, 1000.0*proj_uv[n + i] + 480.0);
+            scan3d::triangulate_stereo(K, kc, K, kc, Rt, T, p1, p2, stereo_xyz[i]);
+        }
+    }, 1);
+
+    //all three give the same points
+    double float_error = 0.0, stereo_error = 0.0;
+    for (size_t i=0; i<n; i++)
+    {
+        const double scale = std::max(1.0, std::abs(xyz[2*n + i]));
+        for (int k=0; k<3; k++)
+        {
+            float_error = std::max(float_error, std::abs(xyz_float[k*n + i] - xyz[k*n + i])/scale);
+        }
+        if (i<stereo_n)
+        {
+            const cv::Point3d & p = stereo_xyz[i];
+            stereo_error = std::max(stereo_error, std::max(std::max(std::abs(p.x - xyz[i]), std::abs(p.y - xyz[n + i])), std::abs(p.z - xyz[2*n + i]))/scale);
+        }
+    }
+    const bool same = (float_error<1e-3 && stereo_error<1e-6);
+
+    std::cout << "[triangulate_bench] " << n << " points: batch double " << mpoints_per_second(n, double_ms) << " Mpts/s, batch float " 
+              << mpoints_per_second(n, float_ms) << " Mpts/s, triangulate_stereo " << mpoints_per_second(stereo_n, stereo_ms) 
+              << " Mpts/s (" << stereo_n << " points), points " << (same ? "equal" : "DIFFER") << " (float " << float_error 
+              << ", stereo " << stereo_error << " relative)" << std::endl;
+    return (same ? 0 : 1);
+}